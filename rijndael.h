@@ -2,6 +2,7 @@
 #ifndef RIJNDAEL_H_
 #define RIJNDAEL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -14,6 +15,7 @@ typedef struct
 	uint32_t drk[128];	/* decryption round keys */
 	int nr;				/* number of rounds */
 	int blocklen;		/* length in bytes of an input and output block */
+	int backend;		/* index of the backend in use; 0 is "auto" */
 } rijn_context;
 
 int rijn_set_key( rijn_context *ctx, uint8_t *key, int nkeybits,
@@ -23,12 +25,94 @@ void rijn_encrypt( rijn_context *ctx, uint8_t *input, uint8_t *output );
 
 void rijn_decrypt( rijn_context *ctx, uint8_t *input, uint8_t *output );
 
+int rijn_ecb_encrypt( rijn_context *ctx, uint8_t *input, uint8_t *output,
+						size_t nbytes );
+
+int rijn_ecb_decrypt( rijn_context *ctx, uint8_t *input, uint8_t *output,
+						size_t nbytes );
+
+void rijn_encrypt_multikey( rijn_context **ctx, uint8_t **input,
+							uint8_t **output, size_t n );
+
+void rijn_decrypt_multikey( rijn_context **ctx, uint8_t **input,
+							uint8_t **output, size_t n );
+
 int rijn_cbc_encrypt( rijn_context *ctx, uint8_t *iv, uint8_t *input,
 						uint8_t *output, size_t nbytes );
 
 int rijn_cbc_decrypt( rijn_context *ctx, uint8_t *iv, uint8_t *input,
 						uint8_t *output, size_t nbytes );
 
+int rijn_ctr_crypt( rijn_context *ctx, uint8_t *counter, uint8_t *input,
+					uint8_t *output, size_t nbytes );
+
+int rijn_cmac( rijn_context *ctx, uint8_t *input, size_t nbytes,
+				uint8_t *mac );
+
+void rijn_cmac_double( uint8_t *block, int blocklen );
+
+void rijn_cmac_halve( uint8_t *block, int blocklen );
+
+int rijn_eax_encrypt( rijn_context *ctx, uint8_t *nonce, size_t noncelen,
+						uint8_t *header, size_t headerlen, uint8_t *input,
+						uint8_t *output, size_t nbytes, uint8_t *tag );
+
+int rijn_eax_decrypt( rijn_context *ctx, uint8_t *nonce, size_t noncelen,
+						uint8_t *header, size_t headerlen, uint8_t *input,
+						uint8_t *output, size_t nbytes, uint8_t *tag );
+
+uint32_t rijn_crc32c( uint32_t crc, const uint8_t *data, size_t nbytes );
+
+int rijn_cbc_encrypt_crc( rijn_context *ctx, uint8_t *iv, uint8_t *input,
+						uint8_t *output, size_t nbytes, uint32_t *incrc,
+						uint32_t *outcrc );
+
+int rijn_cbc_decrypt_crc( rijn_context *ctx, uint8_t *iv, uint8_t *input,
+						uint8_t *output, size_t nbytes, uint32_t *incrc,
+						uint32_t *outcrc );
+
+int rijn_ctr_crypt_crc( rijn_context *ctx, uint8_t *counter, uint8_t *input,
+						uint8_t *output, size_t nbytes, uint32_t *incrc,
+						uint32_t *outcrc );
+
+int rijn_backend_count( void );
+
+const char *rijn_backend_name( int i );
+
+int rijn_backend_available( const char *name );
+
+int rijn_set_backend( rijn_context *ctx, const char *name );
+
+const char *rijn_get_backend( const rijn_context *ctx );
+
+int rijn_set_default_backend( const char *name );
+
+int rijn_set_threshold( const char *name, int nblockbits, size_t nbytes );
+
+size_t rijn_get_threshold( const char *name, int nblockbits );
+
+const char *rijn_auto_backend( int decrypt, int nblockbits, size_t nbytes );
+
+int rijn_autotune( const char *path, int force );
+
+/* shadow verification hooks, as set by rijndael_shadow.c */
+#define RIJN_SHADOW_ECB_ENCRYPT	0
+#define RIJN_SHADOW_ECB_DECRYPT	1
+#define RIJN_SHADOW_CBC_ENCRYPT	2
+#define RIJN_SHADOW_CBC_DECRYPT	3
+#define RIJN_SHADOW_CTR			4
+
+typedef struct
+{
+	void *( *begin )( int op, rijn_context *ctx, const uint8_t *iv,
+					  const uint8_t *input, size_t nbytes );
+	void ( *end )( void *sample, const uint8_t *output );
+} rijn_shadow_hooks;
+
+void rijn_set_shadow( const rijn_shadow_hooks *hooks );
+
+void rijn_hold_shadow( int hold );
+
 /* AES equivalent defines */
 #define aes_set_key(ctx, key, nkeybits) rijn_set_key(ctx, key, nkeybits, 128)
 
@@ -36,12 +120,52 @@ int rijn_cbc_decrypt( rijn_context *ctx, uint8_t *iv, uint8_t *input,
 
 #define aes_decrypt(ctx, input, output) rijn_decrypt(ctx, input, output)
 
+#define aes_ecb_encrypt(ctx, input, output, nbytes) \
+					rijn_ecb_encrypt(ctx, input, output, nbytes)
+
+#define aes_ecb_decrypt(ctx, input, output, nbytes) \
+					rijn_ecb_decrypt(ctx, input, output, nbytes)
+
+#define aes_encrypt_multikey(ctx, input, output, n) \
+					rijn_encrypt_multikey(ctx, input, output, n)
+
+#define aes_decrypt_multikey(ctx, input, output, n) \
+					rijn_decrypt_multikey(ctx, input, output, n)
+
 #define aes_cbc_encrypt(ctx, iv, input, output, nbytes) \
 					rijn_cbc_encrypt(ctx, iv, input, output, nbytes)
 
 #define aes_cbc_decrypt(ctx, iv, input, output, nbytes) \
 					rijn_cbc_decrypt(ctx, iv, input, output, nbytes)
 
+#define aes_ctr_crypt(ctx, counter, input, output, nbytes) \
+					rijn_ctr_crypt(ctx, counter, input, output, nbytes)
+
+#define aes_cmac(ctx, input, nbytes, mac) rijn_cmac(ctx, input, nbytes, mac)
+
+#define aes_eax_encrypt(ctx, nonce, noncelen, header, headerlen, input, \
+						output, nbytes, tag) \
+					rijn_eax_encrypt(ctx, nonce, noncelen, header, headerlen, \
+									 input, output, nbytes, tag)
+
+#define aes_eax_decrypt(ctx, nonce, noncelen, header, headerlen, input, \
+						output, nbytes, tag) \
+					rijn_eax_decrypt(ctx, nonce, noncelen, header, headerlen, \
+									 input, output, nbytes, tag)
+
+#define aes_cbc_encrypt_crc(ctx, iv, input, output, nbytes, incrc, outcrc) \
+					rijn_cbc_encrypt_crc(ctx, iv, input, output, nbytes, \
+										 incrc, outcrc)
+
+#define aes_cbc_decrypt_crc(ctx, iv, input, output, nbytes, incrc, outcrc) \
+					rijn_cbc_decrypt_crc(ctx, iv, input, output, nbytes, \
+										 incrc, outcrc)
+
+#define aes_ctr_crypt_crc(ctx, counter, input, output, nbytes, incrc, \
+						  outcrc) \
+					rijn_ctr_crypt_crc(ctx, counter, input, output, nbytes, \
+									   incrc, outcrc)
+
 #define aes_context rijn_context
 
 #ifdef __cplusplus
@@ -58,12 +58,16 @@ Encrypt         187.17 ns/op            170.96 MB/s
 Decrypt         198.28 ns/op            161.39 MB/s
  */
 
+#define _GNU_SOURCE		/* for rijndael_pipe.c */
+
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
 char rcs_id_rijndael_test[] =
 		"$Id: rijndael_bench.c 1.36 2020-03-27 09:11:39-05 Ron Exp $";
@@ -71,6 +75,18 @@ char rcs_id_rijndael_test[] =
 #include "rijndael.h"
 
 #include "rijndael.c"
+#include "rijndael_engine.c"
+#include "rijndael_pipe.c"
+#include "rijndael_log.c"
+#include "rijndael_daemon.c"
+#include "rijndael_proxy.c"
+#include "rijndael_keystream.c"
+#include "rijndael_reencrypt.c"
+#include "rijndael_pmac.c"
+#include "rijndael_poly1305.c"
+#include "rijndael_hctr2.c"
+#include "rijndael_kdf.c"
+#include "rijndael_shadow.c"
 
 #ifdef __cplusplus
 extern "C" {
@@ -163,6 +179,17 @@ seconds(void)
 }
 
 
+/* elapsed (wall clock) time, for latencies that include waiting */
+static double
+wall_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
 /* Benchmark the Rijndael functions implemented in rijndael.c. */
 static void
 benchmark(void)
@@ -184,9 +211,9 @@ benchmark(void)
 
 	printf("Benchmarking the Rijndael functions implemented in rijndael.c.\n");
 
-	for (blockbits = 128; blockbits <= 256; blockbits += 64) {
+	for (blockbits = 128; blockbits <= 256; blockbits += 32) {
 		size_t size = blockbits / 8;
-		for (keybits = 128; keybits <= 256; keybits += 64) {
+		for (keybits = 128; keybits <= 256; keybits += 32) {
 			printf("\nblockbits=%d  keybits=%d:\n", blockbits, keybits);
 			start = seconds();
 			for (i = 0; i < loopcount; i++) {
@@ -231,6 +258,1118 @@ benchmark(void)
 }
 
 
+/* Compare the bulk ECB backends in rijndael.c over several buffer sizes.
+ * Each context is pinned to one backend with rijn_set_backend, so this
+ * shows where each one starts to win and what "auto" picks.
+ */
+static void
+benchmark_bulk(void)
+{
+	static rijn_context ctx;
+	static uint8_t key[32];
+	static uint8_t buf[32 * 512];
+	static size_t nblocks[] = { 8, 64, 512 };
+	size_t i, k, loopcount;
+	double start, dur;
+	int b, blockbits, decrypt;
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(buf, sizeof(buf));
+
+	printf("\nBulk ECB in MB/s by backend (keybits=128):\n");
+	for (b = 0; b < rijn_backend_count(); b++) {
+		if (!rijn_backend_available(rijn_backend_name(b))) {
+			printf("Backend %s is not available on this CPU.\n",
+					rijn_backend_name(b));
+		}
+	}
+
+	for (blockbits = 128; blockbits <= 256; blockbits += 32) {
+		size_t size = blockbits / 8;
+		printf("\nblockbits=%d:\t\t", blockbits);
+		for (b = 0; b < rijn_backend_count(); b++) {
+			if (rijn_backend_available(rijn_backend_name(b))) {
+				printf(" %17s", rijn_backend_name(b));
+			}
+		}
+		printf("\n");
+		for (decrypt = 0; decrypt <= 1; decrypt++) {
+			for (k = 0; k < sizeof(nblocks) / sizeof(nblocks[0]); k++) {
+				size_t n = nblocks[k];
+				loopcount = 20000000 / n / size * 8;
+
+				printf("ECB %s %3d blocks", decrypt ? "Decrypt" : "Encrypt",
+						(int)n);
+				for (b = 0; b < rijn_backend_count(); b++) {
+					if (!rijn_backend_available(rijn_backend_name(b))) {
+						continue;
+					}
+					rijn_set_key(&ctx, key, 128, blockbits);
+					rijn_set_backend(&ctx, rijn_backend_name(b));
+					start = seconds();
+					for (i = 0; i < loopcount; i++) {
+						if (decrypt) {
+							rijn_ecb_decrypt(&ctx, buf, buf, n * size);
+						} else {
+							rijn_ecb_encrypt(&ctx, buf, buf, n * size);
+						}
+					}
+					dur = seconds() - start;
+					printf(" %17.2f", size * n * loopcount / 1e6 / dur);
+				}
+				printf("\n");
+			}
+		}
+	}
+}
+
+
+/* Compare rijn_encrypt on each of many contexts with one multi-key call. */
+static void
+benchmark_multikey(void)
+{
+	static rijn_context ctx[512];
+	static rijn_context *pctx[512];
+	static uint8_t buf[512][32];
+	static uint8_t *pbuf[512];
+	static uint8_t key[32];
+	size_t i, j, loopcount;
+	double start, single, multi;
+	int blockbits;
+
+	printf("\nMulti-key ECB in MB/s, 512 contexts (keybits=128):\n");
+	for (blockbits = 128; blockbits <= 256; blockbits += 32) {
+		size_t size = blockbits / 8;
+		loopcount = 20000000 / 512 / size * 8;
+		for (i = 0; i < 512; i++) {
+			rand_bytes(key, sizeof(key));
+			rand_bytes(buf[i], sizeof(buf[i]));
+			rijn_set_key(&ctx[i], key, 128, blockbits);
+			pctx[i] = &ctx[i];
+			pbuf[i] = buf[i];
+		}
+
+		start = seconds();
+		for (j = 0; j < loopcount; j++) {
+			for (i = 0; i < 512; i++) {
+				rijn_encrypt(&ctx[i], buf[i], buf[i]);
+			}
+		}
+		single = seconds() - start;
+
+		start = seconds();
+		for (j = 0; j < loopcount; j++) {
+			rijn_encrypt_multikey(pctx, pbuf, pbuf, 512);
+		}
+		multi = seconds() - start;
+
+		printf("blockbits=%d  rijn_encrypt: %8.2f  rijn_encrypt_multikey: "
+				"%8.2f\n", blockbits, size * 512 * loopcount / 1e6 / single,
+				size * 512 * loopcount / 1e6 / multi);
+	}
+}
+
+
+/* Compare direct rijn_cbc_encrypt calls with the same jobs run by the job
+   engine, for many small independent messages. */
+static void
+benchmark_engine(void)
+{
+	static rijn_context ctx[512];
+	static rijn_job job[512];
+	static uint8_t buf[512][64], iv[512][16];
+	static uint8_t key[32];
+	static size_t nblocks[] = { 1, 4 };
+	size_t i, j, k, loopcount;
+	double start, direct, engined;
+	rijn_engine *engine = rijn_engine_create(1);
+
+	if (engine == NULL) {
+		return;
+	}
+	for (i = 0; i < 512; i++) {
+		rand_bytes(key, sizeof(key));
+		rijn_set_key(&ctx[i], key, 128, 128);
+	}
+	rand_bytes(buf[0], sizeof(buf));
+	rand_bytes(iv[0], sizeof(iv));
+
+	printf("\nJob engine, 512 independent CBC encryptions (keybits=128):\n");
+	for (k = 0; k < sizeof(nblocks) / sizeof(nblocks[0]); k++) {
+		size_t nbytes = 16 * nblocks[k];
+		loopcount = 10000000 / 512 / nbytes * 8;
+
+		start = seconds();
+		for (j = 0; j < loopcount; j++) {
+			for (i = 0; i < 512; i++) {
+				rijn_cbc_encrypt(&ctx[i], iv[i], buf[i], buf[i], nbytes);
+			}
+		}
+		direct = seconds() - start;
+
+		start = seconds();
+		for (j = 0; j < loopcount; j++) {
+			for (i = 0; i < 512; i++) {
+				job[i].op = RIJN_JOB_CBC_ENCRYPT;
+				job[i].ctx = &ctx[i];
+				job[i].iv = iv[i];
+				job[i].input = job[i].output = buf[i];
+				job[i].nbytes = nbytes;
+				rijn_engine_submit(engine, &job[i]);
+			}
+			for (i = 0; i < 512; i++) {
+				rijn_job_wait(engine, &job[i]);
+			}
+		}
+		engined = seconds() - start;
+
+		printf("%3d-byte messages  direct: %8.2f MB/s  engine: %8.2f MB/s\n",
+				(int)nbytes, nbytes * 512 * loopcount / 1e6 / direct,
+				nbytes * 512 * loopcount / 1e6 / engined);
+	}
+	rijn_engine_destroy(engine);
+}
+
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+#define LATENCY_SAMPLES 300
+
+/* Report the latency of 64-byte decryptions through the job engine while
+   it is kept busy with 4 MB encryptions, first with the bulk job run whole,
+   then sliced into chunks, then with the small jobs run inline. */
+static void
+benchmark_latency(void)
+{
+	static uint8_t bulk[4 << 20];
+	static uint8_t msg[64], iv[16], bulkiv[16], key[32];
+	static double lat[LATENCY_SAMPLES];
+	static rijn_context bulkctx, msgctx;
+	static rijn_job bulkjob, msgjob;
+	static const struct {
+		const char *label;
+		size_t chunk_bytes;
+		int priority;
+	} run[] = {
+		{ "bulk unsliced, small queued", sizeof(bulk), RIJN_JOB_AUTO },
+		{ "bulk in 64 KB chunks, small queued", 65536, RIJN_JOB_AUTO },
+		{ "bulk in 64 KB chunks, small inline", 65536, RIJN_JOB_LATENCY },
+	};
+	rijn_engine *engine;
+	double start;
+	size_t r, i;
+
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&bulkctx, key, 128, 128);
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&msgctx, key, 128, 128);
+
+	printf("\n64-byte CBC decryption latency in microseconds "
+			"during 4 MB CBC encryptions:\n");
+	for (r = 0; r < sizeof(run) / sizeof(run[0]); r++) {
+		engine = rijn_engine_create(1);
+		if (engine == NULL) {
+			return;
+		}
+		rijn_engine_set_limits(engine, sizeof(msg), run[r].chunk_bytes);
+
+		bulkjob.op = RIJN_JOB_CBC_ENCRYPT;
+		bulkjob.ctx = &bulkctx;
+		bulkjob.iv = bulkiv;
+		bulkjob.input = bulkjob.output = bulk;
+		bulkjob.nbytes = sizeof(bulk);
+		bulkjob.priority = RIJN_JOB_BULK;
+		rijn_engine_submit(engine, &bulkjob);
+
+		for (i = 0; i < LATENCY_SAMPLES; i++) {
+			/* let the engine get into its bulk work */
+			struct timespec pause = { 0, 100000 * (long)(1 + i % 20) };
+
+			if (rijn_job_poll(&bulkjob) != RIJN_JOB_PENDING) {
+				rijn_engine_submit(engine, &bulkjob);
+			}
+			nanosleep(&pause, NULL);
+			msgjob.op = RIJN_JOB_CBC_DECRYPT;
+			msgjob.ctx = &msgctx;
+			msgjob.iv = iv;
+			msgjob.input = msgjob.output = msg;
+			msgjob.nbytes = sizeof(msg);
+			msgjob.priority = run[r].priority;
+			start = wall_seconds();
+			rijn_engine_submit(engine, &msgjob);
+			rijn_job_wait(engine, &msgjob);
+			lat[i] = (wall_seconds() - start) * 1e6;
+		}
+		rijn_engine_destroy(engine);
+
+		qsort(lat, LATENCY_SAMPLES, sizeof(lat[0]), compare_doubles);
+		printf("%-36s p50: %9.1f  p99: %9.1f\n", run[r].label,
+				lat[LATENCY_SAMPLES / 2], lat[LATENCY_SAMPLES * 99 / 100]);
+	}
+}
+
+
+/* Compare a read/rijn_cbc_encrypt/write loop with rijn_cbc_pipe and
+   rijn_cbc_splice, reading a 64 MB temporary file and writing to /dev/null. */
+static void
+benchmark_pipe(void)
+{
+	static uint8_t buf[256 * 1024];
+	static uint8_t key[32], iv[16];
+	rijn_context ctx;
+	FILE *in = tmpfile();
+	int out = open("/dev/null", O_WRONLY);
+	size_t i, total = 64 << 20;
+	ssize_t n;
+	double start, serial, piped, spliced;
+
+	if (in == NULL || out < 0) {
+		return;
+	}
+	rand_bytes(buf, sizeof(buf));
+	for (i = 0; i < total; i += sizeof(buf)) {
+		if (write(fileno(in), buf, sizeof(buf)) != sizeof(buf)) {
+			return;
+		}
+	}
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&ctx, key, 128, 128);
+
+	lseek(fileno(in), 0, SEEK_SET);
+	start = wall_seconds();
+	while ((n = read(fileno(in), buf, sizeof(buf))) > 0) {
+		rijn_cbc_encrypt(&ctx, iv, buf, buf, n);
+		if (write(out, buf, n) != n) {
+			break;
+		}
+	}
+	serial = wall_seconds() - start;
+
+	lseek(fileno(in), 0, SEEK_SET);
+	start = wall_seconds();
+	rijn_cbc_pipe(&ctx, iv, fileno(in), out, RIJN_PIPE_ENCRYPT | RIJN_PIPE_PIN,
+			0, 0);
+	piped = wall_seconds() - start;
+
+	lseek(fileno(in), 0, SEEK_SET);
+	start = wall_seconds();
+	rijn_cbc_splice(&ctx, iv, fileno(in), out, RIJN_PIPE_ENCRYPT, 0);
+	spliced = wall_seconds() - start;
+
+	printf("\nCBC encrypt 64 MB file to /dev/null in MB/s (keybits=128):\n"
+			"read/encrypt/write loop: %8.2f  rijn_cbc_pipe: %8.2f  "
+			"rijn_cbc_splice: %8.2f\n", total / 1e6 / serial,
+			total / 1e6 / piped, total / 1e6 / spliced);
+	fclose(in);
+	close(out);
+}
+
+
+#define LOG_THREADS	8
+#define LOG_RECORDS	250		/* per thread */
+#define LOG_RECLEN	100
+
+static rijn_context log_ctx;
+static rijn_log *log_log;
+static int log_fd;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The old way: pad and CBC encrypt each record, write it and fdatasync. */
+static void *
+log_each_record(void *arg)
+{
+	uint8_t record[LOG_RECLEN + 16], iv[16];
+	size_t padded = (LOG_RECLEN / 16 + 1) * 16;
+	int i;
+
+	(void)arg;
+	for (i = 0; i < LOG_RECORDS; i++) {
+		rand_bytes(iv, sizeof(iv));
+		memset(record, (int)(padded - LOG_RECLEN), sizeof(record));
+		rijn_cbc_encrypt(&log_ctx, iv, record, record, padded);
+		pthread_mutex_lock(&log_lock);
+		if (write(log_fd, iv, sizeof(iv)) != sizeof(iv) ||
+				write(log_fd, record, padded) != (ssize_t)padded) {
+			i = LOG_RECORDS;
+		}
+		pthread_mutex_unlock(&log_lock);
+		fdatasync(log_fd);
+	}
+	return NULL;
+}
+
+static void *
+log_group_commit(void *arg)
+{
+	uint8_t record[LOG_RECLEN] = { 0 };
+	int i;
+
+	(void)arg;
+	for (i = 0; i < LOG_RECORDS; i++) {
+		rijn_log_append(log_log, record, sizeof(record), NULL);
+	}
+	return NULL;
+}
+
+/* Append 100-byte records from 8 threads, each record encrypted and synced
+   on its own versus group commits to a rijn_log. */
+static void
+benchmark_log(void)
+{
+	char path[] = "rijn_bench_logXXXXXX";
+	pthread_t thread[LOG_THREADS];
+	uint8_t key[16];
+	double start, each, group;
+	off_t each_bytes, group_bytes;
+	uint64_t commits;
+	int t, n = LOG_THREADS * LOG_RECORDS;
+
+	log_fd = mkstemp(path);
+	if (log_fd < 0) {
+		return;
+	}
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&log_ctx, key, 128, 128);
+
+	start = wall_seconds();
+	for (t = 0; t < LOG_THREADS; t++) {
+		pthread_create(&thread[t], NULL, log_each_record, NULL);
+	}
+	for (t = 0; t < LOG_THREADS; t++) {
+		pthread_join(thread[t], NULL);
+	}
+	each = wall_seconds() - start;
+	each_bytes = lseek(log_fd, 0, SEEK_END);
+
+	if (ftruncate(log_fd, 0) || (log_log = rijn_log_open(&log_ctx, path, 0))
+			== NULL) {
+		close(log_fd);
+		unlink(path);
+		return;
+	}
+	start = wall_seconds();
+	for (t = 0; t < LOG_THREADS; t++) {
+		pthread_create(&thread[t], NULL, log_group_commit, NULL);
+	}
+	for (t = 0; t < LOG_THREADS; t++) {
+		pthread_join(thread[t], NULL);
+	}
+	commits = rijn_log_commits(log_log);
+	rijn_log_close(log_log);
+	group = wall_seconds() - start;
+	group_bytes = lseek(log_fd, 0, SEEK_END);
+
+	printf("\nDurable appends of %d-byte records from %d threads:\n"
+			"per-record CBC + fdatasync: %8.0f records/s  %5.1f bytes/record "
+			"overhead\n"
+			"rijn_log group commit:      %8.0f records/s  %5.1f bytes/record "
+			"overhead, %.1f records/commit\n", LOG_RECLEN, LOG_THREADS,
+			n / each, (double)each_bytes / n - LOG_RECLEN, n / group,
+			(double)group_bytes / n - LOG_RECLEN, (double)n / commits);
+	close(log_fd);
+	unlink(path);
+}
+
+
+#define DAEMON_CLIENTS	8
+#define DAEMON_REQUESTS	2000	/* per client */
+#define DAEMON_BYTES	64		/* per request */
+#define DAEMON_DEPTH	16		/* ring requests in flight */
+
+static char daemon_path[64];
+static uint8_t daemon_key[16];
+
+/* arg is 0 for the socket, 1 for a ring one request at a time, 2 for a
+   ring DAEMON_DEPTH deep */
+static void *
+daemon_client(void *arg)
+{
+	rijn_client *client;
+	uint32_t handle;
+	uint64_t tag;
+	int i, mode = (int)(intptr_t)arg;
+
+	client = rijn_client_connect(daemon_path, DAEMON_BYTES * DAEMON_DEPTH);
+	if (client == NULL) {
+		return NULL;
+	}
+	if (rijn_client_key(client, daemon_key, 128, 128, &handle) == 0 &&
+			(mode == 0 || rijn_client_ring(client, DAEMON_DEPTH) == 0)) {
+		for (i = 0; i < DAEMON_REQUESTS; i++) {
+			if (mode < 2) {
+				rijn_client_crypt(client, RIJN_JOB_ECB_ENCRYPT, handle, NULL,
+						0, DAEMON_BYTES);
+				continue;
+			}
+			if (i >= DAEMON_DEPTH) {
+				rijn_client_reap(client, &tag, 1);
+			}
+			rijn_client_submit(client, RIJN_JOB_ECB_ENCRYPT, handle, NULL,
+					i % DAEMON_DEPTH * DAEMON_BYTES, DAEMON_BYTES, i);
+		}
+		while (mode == 2 && (rijn_client_reap(client, &tag, 1) == 0 ||
+				errno != EAGAIN)) {
+		}
+	}
+	rijn_client_close(client);
+	return NULL;
+}
+
+/* Small ECB requests from 8 clients of one daemon sharing a key handle,
+   over the socket and through shared-memory rings: requests/s, and how
+   many the daemon gathered into each engine batch. */
+static void
+benchmark_daemon(void)
+{
+	static const char *mode[] = { "socket", "ring", "ring, 16 deep" };
+	pthread_t thread[DAEMON_CLIENTS];
+	rijn_daemon *daemon;
+	uint64_t requests, batches, last_requests = 0, last_batches = 0;
+	double start, elapsed;
+	int m, t;
+
+	snprintf(daemon_path, sizeof(daemon_path), "rijn_bench_daemon.%d",
+			(int)getpid());
+	rand_bytes(daemon_key, sizeof(daemon_key));
+	daemon = rijn_daemon_start(daemon_path, 2);
+	if (daemon == NULL) {
+		return;
+	}
+
+	printf("\nDaemon, %d clients of %d-byte ECB requests:\n", DAEMON_CLIENTS,
+			DAEMON_BYTES);
+	for (m = 0; m < 3; m++) {
+		start = wall_seconds();
+		for (t = 0; t < DAEMON_CLIENTS; t++) {
+			pthread_create(&thread[t], NULL, daemon_client, (void *)(intptr_t)m);
+		}
+		for (t = 0; t < DAEMON_CLIENTS; t++) {
+			pthread_join(thread[t], NULL);
+		}
+		elapsed = wall_seconds() - start;
+		rijn_daemon_stats(daemon, &requests, &batches);
+		printf("%-14s %8.0f requests/s, %5.1f requests/batch\n", mode[m],
+				(requests - last_requests) / elapsed, batches == last_batches ?
+				0.0 : (double)(requests - last_requests) /
+				(batches - last_batches));
+		last_requests = requests;
+		last_batches = batches;
+	}
+	rijn_daemon_stop(daemon);
+}
+
+
+#define PROXY_CONNS		2000
+#define PROXY_BYTES		(64 << 20)		/* each way */
+#define PROXY_CHUNK		(1 << 20)
+
+static int proxy_listen;
+static int proxy_fd;
+
+/* Echo each connection to proxy_listen until it is shut down. */
+static void *
+proxy_echo(void *arg)
+{
+	static uint8_t buf[65536];
+	ssize_t n;
+	int fd;
+
+	while ((fd = accept(proxy_listen, NULL, NULL)) >= 0) {
+		while ((n = read(fd, buf, sizeof(buf))) > 0) {
+			if (write(fd, buf, n) != n) {
+				break;
+			}
+		}
+		close(fd);
+	}
+	return arg;
+}
+
+static void *
+proxy_send(void *arg)
+{
+	uint8_t *chunk = (uint8_t *)arg;
+	size_t sent;
+
+	for (sent = 0; sent < PROXY_BYTES; sent += PROXY_CHUNK) {
+		if (write(proxy_fd, chunk, PROXY_CHUNK) != PROXY_CHUNK) {
+			break;
+		}
+	}
+	shutdown(proxy_fd, SHUT_WR);
+	return NULL;
+}
+
+/* An echo server behind an opening and a sealing rijn_proxy on loopback:
+   short connections per second, then one connection's throughput. */
+static void
+benchmark_proxy(void)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	rijn_context ctx;
+	rijn_proxy *opener, *sealer;
+	pthread_t echo, sender;
+	uint8_t key[16], msg[64], *chunk, *sink;
+	char port[16];
+	double start, conns, each_way;
+	size_t got;
+	ssize_t n;
+	int i, fd;
+
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&ctx, key, 128, 128);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	proxy_listen = socket(AF_INET, SOCK_STREAM, 0);
+	if (proxy_listen < 0 || bind(proxy_listen, (struct sockaddr *)&addr,
+			sizeof(addr)) || listen(proxy_listen, 64) ||
+			getsockname(proxy_listen, (struct sockaddr *)&addr, &len) ||
+			pthread_create(&echo, NULL, proxy_echo, NULL)) {
+		return;
+	}
+	snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+	opener = rijn_proxy_start(&ctx, RIJN_PROXY_OPEN, "127.0.0.1", "0",
+			"127.0.0.1", port);
+	snprintf(port, sizeof(port), "%d", opener ? rijn_proxy_port(opener) : 0);
+	sealer = opener == NULL ? NULL : rijn_proxy_start(&ctx, RIJN_PROXY_SEAL,
+			"127.0.0.1", "0", "127.0.0.1", port);
+	addr.sin_port = htons(sealer ? rijn_proxy_port(sealer) : 0);
+
+	start = wall_seconds();
+	for (i = 0; sealer && i < PROXY_CONNS; i++) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+				write(fd, msg, sizeof(msg)) != sizeof(msg) ||
+				read(fd, msg, sizeof(msg)) <= 0) {
+			i = PROXY_CONNS;
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+	conns = PROXY_CONNS / (wall_seconds() - start);
+
+	/* one thread sends while this one reads the echo back */
+	chunk = (uint8_t *)calloc(1, PROXY_CHUNK);
+	sink = (uint8_t *)malloc(PROXY_CHUNK);
+	proxy_fd = sealer ? socket(AF_INET, SOCK_STREAM, 0) : -1;
+	got = 0;
+	start = wall_seconds();
+	if (chunk && sink && proxy_fd >= 0 && connect(proxy_fd,
+			(struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+			pthread_create(&sender, NULL, proxy_send, chunk) == 0) {
+		while ((n = read(proxy_fd, sink, PROXY_CHUNK)) > 0) {
+			got += n;
+		}
+		pthread_join(sender, NULL);
+	}
+	each_way = got / 1e9 / (wall_seconds() - start);
+
+	printf("\nEncrypting proxy pair, echo on loopback: %6.0f connections/s, "
+			"%.2f GB/s each way\n", conns, each_way);
+	free(chunk);
+	free(sink);
+	if (proxy_fd >= 0) {
+		close(proxy_fd);
+	}
+	rijn_proxy_stop(sealer);
+	rijn_proxy_stop(opener);
+	shutdown(proxy_listen, SHUT_RDWR);
+	pthread_join(echo, NULL);
+	close(proxy_listen);
+}
+
+
+#define KEYSTREAM_SAMPLES 100000
+#define KEYSTREAM_BURST 32
+
+/* Report the latency of 64-byte CTR encryptions arriving in bursts of 32,
+   computed on arrival with rijn_ctr_crypt, then taken from a keystream
+   reservoir refilled between bursts, then from one kept full by its
+   thread. */
+static void
+benchmark_keystream(void)
+{
+	static uint8_t msg[64], ctr[16], key[16];
+	static double lat[KEYSTREAM_SAMPLES];
+	static const char *label[] = {
+		"on demand (rijn_ctr_crypt)",
+		"reservoir refilled when idle",
+		"reservoir with background thread",
+	};
+	struct timespec pause = { 0, 50000 };
+	rijn_context ctx;
+	rijn_keystream *ks;
+	double start;
+	int r, i;
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(ctr, sizeof(ctr));
+	rijn_set_key(&ctx, key, 128, 128);
+
+	printf("\n64-byte CTR encryption latency in nanoseconds, "
+			"bursts of %d:\n", KEYSTREAM_BURST);
+	for (r = 0; r < 3; r++) {
+		ks = r == 0 ? NULL : rijn_keystream_create(&ctx, ctr,
+				65536, r == 2);
+		if (r > 0 && ks == NULL) {
+			return;
+		}
+		for (i = 0; i < KEYSTREAM_SAMPLES; i++) {
+			if (i % KEYSTREAM_BURST == 0) {
+				/* idle between bursts */
+				if (r == 1) {
+					rijn_keystream_refill(ks, 0);
+				} else {
+					nanosleep(&pause, NULL);
+				}
+			}
+			start = wall_seconds();
+			if (r == 0) {
+				rijn_ctr_crypt(&ctx, ctr, msg, msg, sizeof(msg));
+			} else {
+				rijn_keystream_crypt(ks, msg, msg, sizeof(msg));
+			}
+			lat[i] = (wall_seconds() - start) * 1e9;
+		}
+		rijn_keystream_destroy(ks);
+
+		qsort(lat, KEYSTREAM_SAMPLES, sizeof(lat[0]), compare_doubles);
+		printf("%-34s p50: %7.0f  p99: %7.0f  p99.9: %7.0f\n", label[r],
+				lat[KEYSTREAM_SAMPLES / 2], lat[KEYSTREAM_SAMPLES * 99 / 100],
+				lat[KEYSTREAM_SAMPLES * 999 / 1000]);
+	}
+}
+
+
+/* Rotate 64 MB of CBC ciphertext to a new key, in CBC and in CTR mode: by
+   decrypting all of it into a temporary buffer and encrypting that, then
+   with the fused rijn_reencrypt, then with rijn_reencrypt_parallel on
+   every CPU. */
+static void
+benchmark_reencrypt(void)
+{
+	static uint8_t key[32], oldiv[16], newiv[16];
+	rijn_context oldctx, newctx;
+	uint8_t *data, *temp;
+	size_t total = 64 << 20;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	double start, twopass, fused, parallel;
+	int mode;
+
+	data = (uint8_t *)malloc(total);
+	temp = (uint8_t *)malloc(total);
+	if (data == NULL || temp == NULL) {
+		free(data);
+		free(temp);
+		return;
+	}
+	rand_bytes(data, total);
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&oldctx, key, 128, 128);
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&newctx, key, 128, 128);
+
+	/* each run re-encrypts the data in place; what it holds by then does
+	   not change the time */
+	printf("\nRe-encrypt 64 MB of CBC data to a new key in MB/s "
+			"(keybits=128, %ld CPUs):\n", ncpus);
+	for (mode = RIJN_REENCRYPT_CBC; mode <= RIJN_REENCRYPT_CTR; mode++) {
+		start = wall_seconds();
+		rijn_cbc_decrypt(&oldctx, oldiv, data, temp, total);
+		if (mode == RIJN_REENCRYPT_CBC) {
+			rijn_cbc_encrypt(&newctx, newiv, temp, data, total);
+		} else {
+			rijn_ctr_crypt(&newctx, newiv, temp, data, total);
+		}
+		twopass = wall_seconds() - start;
+
+		start = wall_seconds();
+		rijn_reencrypt(RIJN_REENCRYPT_CBC, &oldctx, oldiv, mode, &newctx,
+				newiv, data, data, total);
+		fused = wall_seconds() - start;
+
+		start = wall_seconds();
+		rijn_reencrypt_parallel(RIJN_REENCRYPT_CBC, &oldctx, oldiv, mode,
+				&newctx, newiv, data, data, total, (int)ncpus);
+		parallel = wall_seconds() - start;
+
+		printf("CBC to %s  two passes: %8.2f  rijn_reencrypt: %8.2f  "
+				"rijn_reencrypt_parallel: %8.2f\n",
+				mode == RIJN_REENCRYPT_CBC ? "CBC" : "CTR",
+				total / 1e6 / twopass, total / 1e6 / fused,
+				total / 1e6 / parallel);
+	}
+	free(data);
+	free(temp);
+}
+
+
+/* CBC encrypt 64 MB alone, then with a CRC32C pass over the plaintext and
+   one over the ciphertext, then with both CRCs fused into the encryption;
+   and rijn_crc32c alone. */
+static void
+benchmark_crc(void)
+{
+	static uint8_t key[32], iv[16];
+	rijn_context ctx;
+	uint8_t *data;
+	size_t total = 64 << 20;
+	uint32_t incrc = 0, outcrc = 0;
+	double start, alone, passes, fused, crc;
+
+	data = (uint8_t *)malloc(total);
+	if (data == NULL) {
+		return;
+	}
+	rand_bytes(data, total);
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&ctx, key, 128, 128);
+
+	start = wall_seconds();
+	rijn_cbc_encrypt(&ctx, iv, data, data, total);
+	alone = wall_seconds() - start;
+
+	start = wall_seconds();
+	incrc = rijn_crc32c(0, data, total);
+	rijn_cbc_encrypt(&ctx, iv, data, data, total);
+	outcrc = rijn_crc32c(0, data, total);
+	passes = wall_seconds() - start;
+
+	start = wall_seconds();
+	rijn_cbc_encrypt_crc(&ctx, iv, data, data, total, &incrc, &outcrc);
+	fused = wall_seconds() - start;
+
+	start = wall_seconds();
+	incrc = rijn_crc32c(incrc, data, total);
+	crc = wall_seconds() - start;
+
+	printf("\nCBC encrypt 64 MB with CRC32C of plaintext and ciphertext in "
+			"MB/s (keybits=128):\n"
+			"encrypt only: %8.2f  three passes: %8.2f  "
+			"rijn_cbc_encrypt_crc: %8.2f  (rijn_crc32c: %8.2f)\n",
+			total / 1e6 / alone, total / 1e6 / passes, total / 1e6 / fused,
+			total / 1e6 / crc);
+	free(data);
+}
+
+
+/* MAC 64 MB with rijn_cmac, rijn_pmac and rijn_pmac_parallel on every
+   CPU. */
+static void
+benchmark_pmac(void)
+{
+	static uint8_t key[32], mac[16];
+	static rijn_pmac_key pk;
+	rijn_context ctx;
+	uint8_t *data;
+	size_t total = 64 << 20;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	double start, cmac, pmac, parallel;
+
+	data = (uint8_t *)malloc(total);
+	if (data == NULL) {
+		return;
+	}
+	rand_bytes(data, total);
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&ctx, key, 128, 128);
+	rijn_pmac_init(&pk, &ctx);
+
+	start = wall_seconds();
+	rijn_cmac(&ctx, data, total, mac);
+	cmac = wall_seconds() - start;
+
+	start = wall_seconds();
+	rijn_pmac(&pk, data, total, mac);
+	pmac = wall_seconds() - start;
+
+	start = wall_seconds();
+	rijn_pmac_parallel(&pk, data, total, mac, (int)ncpus);
+	parallel = wall_seconds() - start;
+
+	printf("\nMAC 64 MB in MB/s (keybits=128, %ld CPUs):\n"
+			"rijn_cmac: %8.2f  rijn_pmac: %8.2f  rijn_pmac_parallel: %8.2f\n",
+			ncpus, total / 1e6 / cmac, total / 1e6 / pmac,
+			total / 1e6 / parallel);
+	free(data);
+}
+
+
+#define POLY_SHORT 4096		/* 64-byte messages per batch */
+
+/* Poly1305-AES over 64 KB messages with the one-block loop and with the
+   four-way AVX2 kernel (when the CPU has it), then over 64-byte messages
+   one call at a time and in batches, against rijn_cmac. */
+static void
+benchmark_poly1305(void)
+{
+#ifdef __SIZEOF_INT128__
+	static uint8_t key[32], nonce[POLY_SHORT][16], tags[POLY_SHORT][16];
+	static uint8_t msg[65536], *nonces[POLY_SHORT], *tagp[POLY_SHORT];
+	static const uint8_t *msgs[POLY_SHORT];
+	static size_t lens[POLY_SHORT];
+	rijn_poly1305_state st;
+	rijn_context ctx;
+	uint8_t tag[16];
+	double start, scalar, vector, cmac, single, batch;
+	int i, loops = 200;
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(msg, sizeof(msg));
+	rand_bytes(nonce, sizeof(nonce));
+	rijn_set_key(&ctx, key, 128, 128);
+
+	start = wall_seconds();
+	for (i = 0; i < loops; i++) {
+		rijn_poly1305_init(&st, key);
+		rijn_poly1305_blocks(&st, msg, sizeof(msg), 1ULL << 40);
+		rijn_poly1305_finish(&st, tag);
+	}
+	scalar = wall_seconds() - start;
+
+	start = wall_seconds();
+	for (i = 0; i < loops; i++) {
+		rijn_poly1305_aes(&ctx, key + 16, nonce[i], msg, sizeof(msg), tag);
+	}
+	vector = wall_seconds() - start;
+
+	start = wall_seconds();
+	for (i = 0; i < loops; i++) {
+		rijn_cmac(&ctx, msg, sizeof(msg), tag);
+	}
+	cmac = wall_seconds() - start;
+
+	printf("\nPoly1305-AES on 64 KB messages in MB/s: 64-bit limbs: %8.2f  "
+			"rijn_poly1305_aes: %8.2f  (rijn_cmac: %8.2f)\n",
+			loops * sizeof(msg) / 1e6 / scalar,
+			loops * sizeof(msg) / 1e6 / vector,
+			loops * sizeof(msg) / 1e6 / cmac);
+
+	for (i = 0; i < POLY_SHORT; i++) {
+		nonces[i] = nonce[i];
+		msgs[i] = msg + 64 * i;
+		lens[i] = 64;
+		tagp[i] = tags[i];
+	}
+	start = wall_seconds();
+	for (i = 0; i < POLY_SHORT; i++) {
+		rijn_poly1305_aes(&ctx, key + 16, nonces[i], msgs[i], 64, tagp[i]);
+	}
+	single = wall_seconds() - start;
+
+	start = wall_seconds();
+	rijn_poly1305_aes_batch(&ctx, key + 16, nonces, msgs, lens, tagp,
+			POLY_SHORT);
+	batch = wall_seconds() - start;
+
+	printf("Poly1305-AES on 64-byte messages in messages/s: one call each: "
+			"%10.0f  rijn_poly1305_aes_batch: %10.0f\n",
+			POLY_SHORT / single, POLY_SHORT / batch);
+#endif
+}
+
+
+#define HCTR2_SECTOR 4096	/* bytes per HCTR2 message */
+
+/* HCTR2 over 4 KB sectors against CTR, which does no hashing, and POLYVAL
+   with carry-less multiply (when the CPU has it) against the portable
+   one-block loop. */
+static void
+benchmark_hctr2(void)
+{
+	static uint8_t key[32], buf[1 << 20];
+	rijn_hctr2_key hk;
+	rijn_context ctx;
+	uint8_t iv[16], tweak[8];
+	uint64_t s[2] = { 0, 0 };
+	double start, hctr2, ctr, fast, soft;
+	size_t off;
+	int i, loops = 20;
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(buf, sizeof(buf));
+	rijn_set_key(&ctx, key, 128, 128);
+	rijn_hctr2_init(&hk, &ctx);
+
+	start = wall_seconds();
+	for (i = 0; i < loops; i++) {
+		for (off = 0; off < sizeof(buf); off += HCTR2_SECTOR) {
+			memcpy(tweak, &off, sizeof(tweak));
+			rijn_hctr2_encrypt(&hk, tweak, sizeof(tweak), buf + off,
+					buf + off, HCTR2_SECTOR);
+		}
+	}
+	hctr2 = wall_seconds() - start;
+
+	start = wall_seconds();
+	for (i = 0; i < loops; i++) {
+		for (off = 0; off < sizeof(buf); off += HCTR2_SECTOR) {
+			memset(iv, 0, sizeof(iv));
+			memcpy(iv, &off, sizeof(off));
+			rijn_ctr_crypt(&ctx, iv, buf + off, buf + off, HCTR2_SECTOR);
+		}
+	}
+	ctr = wall_seconds() - start;
+
+	printf("\nHCTR2 on 4 KB sectors in MB/s: rijn_hctr2_encrypt: %8.2f  "
+			"(rijn_ctr_crypt: %8.2f)\n",
+			loops * sizeof(buf) / 1e6 / hctr2,
+			loops * sizeof(buf) / 1e6 / ctr);
+
+	start = wall_seconds();
+	for (i = 0; i < loops; i++) {
+		rijn_polyval_blocks((const uint64_t (*)[2])hk.h, s, buf,
+				sizeof(buf) / 16);
+	}
+	fast = wall_seconds() - start;
+
+	start = wall_seconds();
+	for (i = 0; i < loops; i++) {
+		rijn_polyval_blocks_soft(hk.h[0], s, buf, sizeof(buf) / 16);
+	}
+	soft = wall_seconds() - start;
+
+	printf("POLYVAL in MB/s: rijn_polyval: %8.2f  portable: %8.2f\n",
+			loops * sizeof(buf) / 1e6 / fast,
+			loops * sizeof(buf) / 1e6 / soft);
+}
+
+
+#define KDF_TENANTS 20000	/* derivations per timing */
+#define KDF_SUBKEYS 8		/* 256-bit keys per derivation */
+
+/* Eight AES-256 subkeys per tenant from SP 800-108: one rijn_cmac per
+   counter and rijn_set_key on each copy, against rijn_kdf_ctr_keys. */
+static void
+benchmark_kdf(void)
+{
+	static rijn_context keys[KDF_SUBKEYS];
+	uint8_t key[32], msg[32], out[KDF_SUBKEYS * 32];
+	rijn_context ctx;
+	double start, serial, lanes;
+	int t, i;
+
+	rand_bytes(key, sizeof(key));
+	rijn_set_key(&ctx, key, 256, 128);
+
+	start = wall_seconds();
+	for (t = 0; t < KDF_TENANTS; t++) {
+		memset(msg, 0, sizeof(msg));
+		memcpy(msg + 4, "tenant", 6);
+		memcpy(msg + 11, &t, sizeof(t));
+		msg[17] = (uint8_t)(sizeof(out) * 8 >> 8);
+		for (i = 0; i < (int)sizeof(out) / 16; i++) {
+			msg[3] = (uint8_t)(i + 1);
+			rijn_cmac(&ctx, msg, 19, out + 16 * i);
+		}
+		for (i = 0; i < KDF_SUBKEYS; i++) {
+			rijn_set_key(&keys[i], out + 32 * i, 256, 128);
+		}
+	}
+	serial = wall_seconds() - start;
+
+	start = wall_seconds();
+	for (t = 0; t < KDF_TENANTS; t++) {
+		rijn_kdf_ctr_keys(&ctx, (const uint8_t *)"tenant", 6,
+				(const uint8_t *)&t, sizeof(t), keys, KDF_SUBKEYS, 256, 128);
+	}
+	lanes = wall_seconds() - start;
+
+	printf("\nKDF, %d AES-256 subkeys per derivation, in derivations/s: "
+			"serial CMAC: %10.0f  rijn_kdf_ctr_keys: %10.0f\n", KDF_SUBKEYS,
+			KDF_TENANTS / serial, KDF_TENANTS / lanes);
+}
+
+
+#define SHADOW_CALLS 100000	/* calls per timing */
+#define SHADOW_BYTES 4096		/* bytes per call */
+
+/* 4 KB CTR calls with shadow checking off and sampling one call in 1000
+   and in 100, and what the sampled calls cost their callers. */
+static void
+benchmark_shadow(void)
+{
+	static uint8_t buf[SHADOW_BYTES];
+	static const unsigned rates[] = { 0, 1000, 100 };
+	uint8_t key[32], counter[16];
+	rijn_shadow_stats stats;
+	rijn_context ctx;
+	double start, elapsed;
+	int i, r;
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(buf, sizeof(buf));
+	rijn_set_key(&ctx, key, 256, 128);
+	memset(counter, 0, sizeof(counter));
+
+	printf("\nShadow verification, %d-byte CTR calls, in MB/s:", SHADOW_BYTES);
+	for (r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++) {
+		if (rates[r] && rijn_shadow_start(rates[r], NULL, NULL)) {
+			continue;
+		}
+		start = wall_seconds();
+		for (i = 0; i < SHADOW_CALLS; i++) {
+			rijn_ctr_crypt(&ctx, counter, buf, buf, sizeof(buf));
+		}
+		elapsed = wall_seconds() - start;
+		if (rates[r]) {
+			rijn_shadow_stop();
+			rijn_shadow_get_stats(&stats);
+			printf("  1 in %u: %8.1f (%llu checked, %llu dropped, "
+					"%.1f us per sample)", rates[r],
+					SHADOW_CALLS * (double)SHADOW_BYTES / elapsed / 1e6,
+					(unsigned long long)stats.checked,
+					(unsigned long long)stats.dropped,
+					stats.sampled + stats.dropped ? stats.caller_ns / 1e3 /
+					(stats.sampled + stats.dropped) : 0.0);
+		} else {
+			printf("  off: %8.1f",
+					SHADOW_CALLS * (double)SHADOW_BYTES / elapsed / 1e6);
+		}
+	}
+	printf("\n");
+}
+
+
+/* Time a full autotune calibration and show what "auto" picks afterwards.
+ */
+static void
+benchmark_autotune(void)
+{
+	static size_t nblocks[] = { 1, 8, 64, 512 };
+	double start;
+	size_t k;
+	int blockbits, decrypt;
+
+	start = seconds();
+	rijn_autotune(NULL, 1);
+	printf("\nAutotune calibration took %.2f s.  \"auto\" now uses:\n",
+			seconds() - start);
+
+	for (blockbits = 128; blockbits <= 256; blockbits += 32) {
+		for (decrypt = 0; decrypt <= 1; decrypt++) {
+			printf("blockbits=%d %s:", blockbits,
+					decrypt ? "decrypt" : "encrypt");
+			for (k = 0; k < sizeof(nblocks) / sizeof(nblocks[0]); k++) {
+				printf("  %d: %s", (int)nblocks[k], rijn_auto_backend(decrypt,
+						blockbits, nblocks[k] * blockbits / 8));
+			}
+			printf("\n");
+		}
+	}
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -239,6 +1378,23 @@ main(int argc, char *argv[])
 	}
 
 	benchmark();
+	benchmark_bulk();
+	benchmark_multikey();
+	benchmark_engine();
+	benchmark_latency();
+	benchmark_pipe();
+	benchmark_log();
+	benchmark_daemon();
+	benchmark_proxy();
+	benchmark_keystream();
+	benchmark_reencrypt();
+	benchmark_crc();
+	benchmark_pmac();
+	benchmark_poly1305();
+	benchmark_hctr2();
+	benchmark_kdf();
+	benchmark_shadow();
+	benchmark_autotune();
 
 	return EXIT_SUCCESS;
 }
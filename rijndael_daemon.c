@@ -0,0 +1,1512 @@
+/*
+ *	Local encryption daemon for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USING rijndael_daemon.c/rijndael_daemon.h:
+ *
+ * The daemon lets several processes share one set of key schedules and
+ * have their small requests batched together.  It listens on a Unix domain
+ * socket; each client hands it a memfd-backed buffer over the socket with
+ * SCM_RIGHTS, and requests then name a key handle and a range of that
+ * buffer, which the daemon encrypts or decrypts in place.  The buffer must
+ * be sealed against shrinking and growing, so that no client can make the
+ * daemon's mapping of it fault.  Linux only.
+ *
+ * rijn_daemon *rijn_daemon_start( const char *path, int nthreads );
+ *
+ * listens on a socket created at path (mode 0600) and serves it from a
+ * thread of its own, with a rijn_engine of nthreads threads doing the
+ * work.  Returns the daemon, or NULL with errno set.
+ *
+ * void rijn_daemon_stats( rijn_daemon *daemon, uint64_t *requests,
+ *						   uint64_t *batches );
+ *
+ * tells how many requests have been served in how many batches.
+ *
+ * void rijn_daemon_stop( rijn_daemon *daemon );
+ *
+ * disconnects every client, removes the socket and frees the daemon.
+ *
+ * rijn_client *rijn_client_connect( const char *path, size_t bufsize );
+ * uint8_t *rijn_client_buffer( rijn_client *client );
+ *
+ * connect to the daemon at path and give the client a shared buffer of
+ * bufsize bytes.  rijn_client_connect returns NULL with errno set on
+ * failure.
+ *
+ * int rijn_client_key( rijn_client *client, uint8_t *key, int nkeybits,
+ *						int nblockbits, uint32_t *handle );
+ *
+ * has the daemon expand a key, as rijn_set_key would, and stores its
+ * handle in *handle.  A key already loaded by any client gets the same
+ * handle and is not expanded again; a handle may be used by every client
+ * and lasts while a client that loaded it is connected.  After that it is
+ * refused with EINVAL, even once another key takes its place.
+ *
+ * int rijn_client_crypt( rijn_client *client, int op, uint32_t handle,
+ *						  uint8_t *iv, size_t offset, size_t nbytes );
+ *
+ * runs op, one of the RIJN_JOB_* operations of rijndael_engine.h, on the
+ * nbytes at offset in the shared buffer, in place, and updates iv for CBC
+ * as rijn_cbc_* would.  Returns 0, or 1 with errno set.
+ *
+ * int rijn_client_ring( rijn_client *client, unsigned entries );
+ *
+ * attaches a submission and a completion ring of entries each (a power of
+ * 2, at most 4096) in memory shared with the daemon.  The daemon's ring
+ * thread polls every ring and spins a while when they go idle before
+ * sleeping on a futex, so while it is busy a request through a ring costs
+ * no system call on either side.  Once a ring is attached
+ * rijn_client_crypt goes through it.
+ *
+ * int rijn_client_submit( rijn_client *client, int op, uint32_t handle,
+ *						   uint8_t *iv, size_t offset, size_t nbytes,
+ *						   uint64_t tag );
+ *
+ * queues a request on the ring without waiting for it.  Returns 1 with
+ * errno EAGAIN while entries requests are outstanding.  A CBC iv must
+ * stay put until the request is reaped, which updates it.
+ *
+ * int rijn_client_reap( rijn_client *client, uint64_t *tag, int wait );
+ *
+ * takes the oldest outstanding request, in submission order, once it is
+ * done, and stores its tag.  Returns 0, or 1 with errno set: the
+ * request's error (the tag is stored), EAGAIN if nothing is outstanding
+ * or, unless wait, nothing is done yet, or ECONNRESET if the daemon went
+ * away.
+ *
+ * void rijn_client_close( rijn_client *client );
+ *
+ * disconnects and frees the client.
+ *
+ * A client may be used by one thread at a time.  The daemon reads every
+ * request waiting on every connection, submits them to its engine with
+ * rijn_engine_submit_batch, and replies once the batch is done, so small
+ * requests from different clients run interleaved through
+ * rijn_encrypt_multikey; the ring thread does the same with whatever is
+ * on every ring.  Anyone who can open the socket can use every key
+ * loaded, so it is created readable only by its owner.
+ *
+ * Compile with -DRIJN_DAEMON_MAIN, along with rijndael.c and
+ * rijndael_engine.c, for a program that runs a daemon:
+ *
+ *	rijndael_daemon socket-path [threads]
+ *
+ * Link with -lpthread.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE			/* for memfd_create and accept4 */
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <fcntl.h>
+	#include <linux/futex.h>
+	#include <poll.h>
+	#include <sys/mman.h>
+	#include <sys/socket.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+	#include <sys/un.h>
+#endif
+
+#include "rijndael.h"
+#include "rijndael_engine.h"
+#include "rijndael_daemon.h"
+
+/* message types */
+#define RIJN_MSG_HELLO	1	/* carries the client's memfd */
+#define RIJN_MSG_KEY	2
+#define RIJN_MSG_CRYPT	3
+#define RIJN_MSG_RING	4	/* carries the ring's memfd; the reply, the bell */
+
+/* A handle holds ( nblockbits - 128 ) / 32 in the low three bits, so a
+   client knows how long an iv is, the key's index + 1 in the next 16 and
+   the generation of the key's slot in the top 13.  A slot's generation
+   moves on when its key is freed, so an old handle does not reach the
+   next key put there. */
+#define RIJN_HANDLE( index, gen, nblockbits ) \
+	( (uint32_t) ( gen ) << 19 | ( (uint32_t) ( index ) + 1 ) << 3 | \
+	  (uint32_t) ( ( nblockbits ) - 128 ) / 32 )
+#define RIJN_HANDLE_INDEX( handle )	( (int) ( ( ( handle ) >> 3 ) & 0xffff ) - 1 )
+#define RIJN_HANDLE_KEYS	0xffff	/* the most keys loaded at once */
+#define RIJN_HANDLE_GENS	0x1fff	/* generation mask */
+#define RIJN_HANDLE_BLOCKLEN( handle )	( 16 + 4 * (int) ( ( handle ) & 7 ) )
+
+#define RIJN_DAEMON_ENTRIES	4096	/* the most entries in a ring */
+#define RIJN_DAEMON_SPINS	1000	/* idle polls of a ring before sleeping */
+
+/* a request, and its reply with status and error filled in */
+typedef struct
+{
+	uint32_t type;			/* RIJN_MSG_* */
+	int32_t op;				/* RIJN_JOB_* */
+	uint32_t handle;
+	int32_t nkeybits;
+	int32_t nblockbits;
+	int32_t status;			/* 0, or 1 with error set */
+	int32_t error;
+	uint32_t pad;
+	uint64_t offset;
+	uint64_t nbytes;		/* or a ring's entries */
+	uint8_t data[32];		/* key or iv */
+} rijn_msg;
+
+/* a submission ring entry */
+typedef struct
+{
+	int32_t op;
+	uint32_t handle;
+	uint64_t offset;
+	uint64_t nbytes;
+	uint8_t iv[32];
+} rijn_daemon_sqe;
+
+/* a completion ring entry, in the same order */
+typedef struct
+{
+	int32_t status;
+	int32_t error;
+	uint8_t iv[32];
+} rijn_daemon_cqe;
+
+/* The head of a ring's shared memory, the entries of both rings after it.
+   The client's and the daemon's indexes are on separate lines; each side
+   keeps the index it alone reads to itself. */
+typedef struct
+{
+	uint32_t sq_tail;		/* written by the client */
+	uint32_t cq_wait;		/* the client sleeps on cq_tail */
+	char pad0[56];
+	uint32_t cq_tail;		/* written by the daemon */
+	char pad1[60];
+} rijn_daemon_ring;
+
+/* the daemon's doorbell, shared with every ring */
+typedef struct
+{
+	uint32_t seq;			/* bumped to wake the ring thread */
+	uint32_t sleeping;		/* the ring thread sleeps on seq */
+} rijn_daemon_bell;
+
+struct rijn_client
+{
+	int fd;
+	uint8_t *map;
+	size_t size;
+	rijn_daemon_ring *ring;	/* NULL until rijn_client_ring */
+	rijn_daemon_bell *bell;
+	unsigned entries;
+	unsigned sq_tail, cq_head;
+	uint64_t *tags;			/* per ring slot */
+	uint8_t **ivs;
+};
+
+#ifdef __linux__
+
+typedef struct
+{
+	rijn_context ctx;
+	uint8_t key[32];
+	int nkeybits, nblockbits;
+	int refs;				/* connections that loaded it; 0 if free */
+	unsigned gen;			/* of the slot, in its handles */
+} rijn_daemon_key;
+
+typedef struct
+{
+	int fd;
+	int dead;				/* close after the current batch */
+	uint8_t *map;			/* the client's buffer */
+	size_t size;
+	int *handles;			/* indexes of the keys this connection loaded */
+	int nhandles, caphandles;
+	rijn_daemon_ring *ring;	/* or NULL */
+	unsigned entries;
+	unsigned sq_head, cq_tail;
+	int broken;				/* the client overran its ring */
+	int posted;				/* completions to publish */
+} rijn_daemon_conn;
+
+typedef struct
+{
+	rijn_job job;
+	rijn_msg msg;
+	int conn;
+	int error;				/* refused without running */
+} rijn_daemon_request;
+
+typedef struct
+{
+	rijn_daemon_request *req;
+	rijn_job **jobs;		/* as many as req */
+	int n, cap;
+} rijn_daemon_batch;
+
+/* The socket thread alone changes connections and keys, holding lock; the
+   ring thread holds lock for each pass over the rings. */
+struct rijn_daemon
+{
+	int listenfd;
+	int wake[2];			/* written by rijn_daemon_stop */
+	rijn_engine *engine;
+	pthread_t thread, ringthread;
+	pthread_mutex_t lock;
+	rijn_daemon_bell *bell;
+	int bellfd;
+	int stopping;
+	rijn_daemon_conn *conn;
+	int nconns, capconns;
+	rijn_daemon_key *key;	/* by RIJN_HANDLE_INDEX */
+	int nkeys, capkeys;
+	rijn_daemon_batch sock;	/* from the socket thread */
+	rijn_daemon_batch rings;	/* from the ring thread */
+	struct pollfd *pfd;
+	uint64_t requests, batches;
+	char path[sizeof( ( (struct sockaddr_un *) 0 )->sun_path )];
+};
+
+
+/* Grow *array of *cap elements of size bytes to hold at least n. */
+static int rijn_daemon_grow( void *array, int *cap, int n, size_t size )
+{
+	void *grown;
+	int newcap;
+
+	if ( n <= *cap )
+		return 0;
+	newcap = *cap ? 2 * *cap : 16;
+	while ( newcap < n )
+		newcap *= 2;
+	grown = realloc( *(void **) array, newcap * size );
+	if ( grown == NULL )
+		return 1;
+	*(void **) array = grown;
+	*cap = newcap;
+
+	return 0;
+}
+
+
+/* Wait up to ms milliseconds (forever if negative) while *addr is val. */
+static int rijn_futex_wait( uint32_t *addr, uint32_t val, int ms )
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = ( ms % 1000 ) * 1000000L;
+
+	return (int) syscall( SYS_futex, addr, FUTEX_WAIT, val,
+						  ms < 0 ? NULL : &ts, NULL, 0 );
+}
+
+
+static void rijn_futex_wake( uint32_t *addr )
+{
+	syscall( SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+}
+
+
+static rijn_daemon_sqe *rijn_daemon_sq( rijn_daemon_ring *ring )
+{
+	return (rijn_daemon_sqe *) ( ring + 1 );
+}
+
+
+static rijn_daemon_cqe *rijn_daemon_cq( rijn_daemon_ring *ring,
+										unsigned entries )
+{
+	return (rijn_daemon_cqe *) ( rijn_daemon_sq( ring ) + entries );
+}
+
+
+static size_t rijn_daemon_ring_size( unsigned entries )
+{
+	return sizeof( rijn_daemon_ring ) +
+		   entries * ( sizeof( rijn_daemon_sqe ) + sizeof( rijn_daemon_cqe ) );
+}
+
+
+/* Send a message on sock, with fd attached if it is not -1. */
+static int rijn_msg_send( int sock, rijn_msg *msg, int fd )
+{
+	char control[CMSG_SPACE( sizeof( int ) )];
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	ssize_t n;
+
+	memset( &mh, 0, sizeof( mh ) );
+	iov.iov_base = msg;
+	iov.iov_len = sizeof( *msg );
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if ( fd >= 0 )
+	{
+		memset( control, 0, sizeof( control ) );
+		mh.msg_control = control;
+		mh.msg_controllen = sizeof( control );
+		cmsg = CMSG_FIRSTHDR( &mh );
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+		memcpy( CMSG_DATA( cmsg ), &fd, sizeof( int ) );
+	}
+
+	while ( ( n = sendmsg( sock, &mh, MSG_NOSIGNAL ) ) < 0 && errno == EINTR )
+		;
+
+	return n == (ssize_t) sizeof( *msg ) ? 0 : 1;
+}
+
+
+/* Receive a message from sock into msg, and any fd with it into *fd (-1
+   if none).  Returns what recvmsg does. */
+static ssize_t rijn_msg_recv( int sock, rijn_msg *msg, int *fd, int flags )
+{
+	char control[CMSG_SPACE( sizeof( int ) )];
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	ssize_t n;
+
+	do
+	{
+		memset( &mh, 0, sizeof( mh ) );
+		iov.iov_base = msg;
+		iov.iov_len = sizeof( *msg );
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = control;
+		mh.msg_controllen = sizeof( control );
+		n = recvmsg( sock, &mh, flags | MSG_CMSG_CLOEXEC );
+	} while ( n < 0 && errno == EINTR );
+
+	*fd = -1;
+	for ( cmsg = n < 0 ? NULL : CMSG_FIRSTHDR( &mh ); cmsg;
+		  cmsg = CMSG_NXTHDR( &mh, cmsg ) )
+		if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS )
+			memcpy( fd, CMSG_DATA( cmsg ), sizeof( int ) );
+
+	return n;
+}
+
+
+static void rijn_daemon_reply( rijn_daemon *d, int c, rijn_msg *msg,
+							   int status, int error, int fd )
+{
+	msg->status = status;
+	msg->error = error;
+	if ( rijn_msg_send( d->conn[c].fd, msg, fd ) )
+		d->conn[c].dead = 1;
+}
+
+
+/* Return 1 if memfd fd can no longer change size, else 0. */
+static int rijn_daemon_sealed( int fd )
+{
+	int seals = fcntl( fd, F_GET_SEALS );
+
+	return seals >= 0 && ( seals & ( F_SEAL_SHRINK | F_SEAL_GROW ) ) ==
+						 ( F_SEAL_SHRINK | F_SEAL_GROW );
+}
+
+
+/* Map the buffer whose memfd came with a RIJN_MSG_HELLO. */
+static int rijn_daemon_hello( rijn_daemon_conn *conn, int fd )
+{
+	struct stat st;
+	void *map;
+
+	if ( fd < 0 || conn->map != NULL || !rijn_daemon_sealed( fd ) )
+		return EINVAL;
+	if ( fstat( fd, &st ) )
+		return errno;
+	map = st.st_size == 0 ? NULL : mmap( NULL, st.st_size,
+										 PROT_READ | PROT_WRITE,
+										 MAP_SHARED, fd, 0 );
+	if ( map == MAP_FAILED || map == NULL )
+		return map == NULL ? EINVAL : errno;
+	conn->map = (uint8_t *) map;
+	conn->size = st.st_size;
+
+	return 0;
+}
+
+
+/* Map the ring whose memfd came with a RIJN_MSG_RING. */
+static int rijn_daemon_ring_attach( rijn_daemon_conn *conn, int fd,
+									uint64_t entries )
+{
+	struct stat st;
+	void *map;
+
+	if ( fd < 0 || conn->ring != NULL || entries == 0 ||
+		 entries > RIJN_DAEMON_ENTRIES || ( entries & ( entries - 1 ) ) ||
+		 !rijn_daemon_sealed( fd ) )
+		return EINVAL;
+	if ( fstat( fd, &st ) )
+		return errno;
+	if ( (uint64_t) st.st_size < rijn_daemon_ring_size( entries ) )
+		return EINVAL;
+	map = mmap( NULL, rijn_daemon_ring_size( entries ),
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	if ( map == MAP_FAILED )
+		return errno;
+	conn->ring = (rijn_daemon_ring *) map;
+	conn->entries = (unsigned) entries;
+	conn->sq_head = conn->cq_tail = 0;
+
+	return 0;
+}
+
+
+/* Find or expand a key for a RIJN_MSG_KEY.  Returns 0 or an errno. */
+static int rijn_daemon_key_load( rijn_daemon *d, int c, rijn_msg *msg )
+{
+	rijn_daemon_conn *conn = &d->conn[c];
+	rijn_daemon_key *key;
+	int h, unused = -1;
+	unsigned gen;
+
+	if ( msg->nkeybits < 128 || msg->nkeybits > 256 || msg->nkeybits % 32 )
+		return EINVAL;
+	if ( rijn_daemon_grow( &conn->handles, &conn->caphandles,
+						   conn->nhandles + 1, sizeof( int ) ) )
+		return ENOMEM;
+
+	for ( h = 0; h < d->nkeys; h++ )
+	{
+		key = &d->key[h];
+		if ( key->refs == 0 )
+			unused = unused < 0 ? h : unused;
+		else if ( key->nkeybits == msg->nkeybits &&
+				  key->nblockbits == msg->nblockbits &&
+				  memcmp( key->key, msg->data, msg->nkeybits / 8 ) == 0 )
+			break;
+	}
+	if ( h == d->nkeys )
+	{
+		h = unused;
+		if ( h < 0 )
+		{
+			if ( d->nkeys == RIJN_HANDLE_KEYS )
+				return ENOSPC;
+			if ( rijn_daemon_grow( &d->key, &d->capkeys, d->nkeys + 1,
+								   sizeof( *d->key ) ) )
+				return ENOMEM;
+			h = d->nkeys++;
+			d->key[h].gen = 0;
+		}
+		key = &d->key[h];
+		gen = key->gen;
+		memset( key, 0, sizeof( *key ) );
+		key->gen = gen;
+		if ( rijn_set_key( &key->ctx, msg->data, msg->nkeybits,
+						   msg->nblockbits ) )
+			return EINVAL;
+		memcpy( key->key, msg->data, msg->nkeybits / 8 );
+		key->nkeybits = msg->nkeybits;
+		key->nblockbits = msg->nblockbits;
+	}
+
+	d->key[h].refs++;
+	conn->handles[conn->nhandles++] = h;
+	msg->handle = RIJN_HANDLE( h, d->key[h].gen, msg->nblockbits );
+
+	return 0;
+}
+
+
+/* Check a RIJN_MSG_CRYPT from connection c.  Returns 0 or an errno. */
+static int rijn_daemon_check( rijn_daemon *d, int c, rijn_msg *msg )
+{
+	rijn_daemon_conn *conn = &d->conn[c];
+	int h = RIJN_HANDLE_INDEX( msg->handle );
+
+	if ( conn->map == NULL || h < 0 || h >= d->nkeys ||
+		 d->key[h].refs == 0 ||
+		 msg->handle != RIJN_HANDLE( h, d->key[h].gen,
+									 d->key[h].nblockbits ) ||
+		 msg->offset > conn->size || msg->nbytes > conn->size - msg->offset )
+		return EINVAL;
+
+	return 0;
+}
+
+
+/* Add a request to a batch, to be refused with error if that is not 0. */
+static int rijn_daemon_queue( rijn_daemon_batch *b, int c, rijn_msg *msg,
+							  int error )
+{
+	rijn_daemon_request *req;
+
+	if ( rijn_daemon_grow( &b->req, &b->cap, b->n + 1, sizeof( *b->req ) ) )
+		return ENOMEM;
+
+	req = &b->req[b->n++];
+	memset( &req->job, 0, sizeof( req->job ) );
+	req->msg = *msg;
+	req->conn = c;
+	req->error = error;
+
+	return 0;
+}
+
+
+/* Run a batch through the engine; each request's outcome is left in its
+   job, or its error. */
+static void rijn_daemon_run( rijn_daemon *d, rijn_daemon_batch *b )
+{
+	rijn_daemon_request *req;
+	rijn_job **jobs;
+	int i, n = 0;
+
+	/* b->jobs is kept as large as b->req */
+	jobs = (rijn_job **) realloc( b->jobs, b->cap * sizeof( rijn_job * ) );
+	if ( jobs != NULL )
+		b->jobs = jobs;
+	for ( i = 0; i < b->n; i++ )
+	{
+		req = &b->req[i];
+		if ( req->error )
+			continue;
+		req->job.op = req->msg.op;
+		req->job.ctx = &d->key[RIJN_HANDLE_INDEX( req->msg.handle )].ctx;
+		req->job.iv = req->msg.data;
+		req->job.input = req->job.output = d->conn[req->conn].map +
+										   req->msg.offset;
+		req->job.nbytes = req->msg.nbytes;
+		if ( jobs != NULL )
+			jobs[n++] = &req->job;
+	}
+
+	if ( jobs == NULL || ( n && rijn_engine_submit_batch( d->engine, jobs,
+														  n ) ) )
+	{
+		for ( i = 0; i < b->n; i++ )
+			b->req[i].error = b->req[i].error ? b->req[i].error : ENOMEM;
+	}
+	else
+	{
+		for ( i = 0; i < n; i++ )
+			rijn_job_wait( d->engine, jobs[i] );
+	}
+
+	__atomic_add_fetch( &d->requests, b->n, __ATOMIC_RELAXED );
+	__atomic_add_fetch( &d->batches, 1, __ATOMIC_RELAXED );
+}
+
+
+/* Read every message waiting on connection c. */
+static void rijn_daemon_read( rijn_daemon *d, int c )
+{
+	rijn_msg msg;
+	ssize_t n;
+	int fd, error, reply;
+
+	for ( ;; )
+	{
+		n = rijn_msg_recv( d->conn[c].fd, &msg, &fd, MSG_DONTWAIT );
+		if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+			return;
+		if ( n <= 0 )
+		{
+			d->conn[c].dead = 1;
+			return;
+		}
+
+		reply = -1;
+		pthread_mutex_lock( &d->lock );
+		if ( n != (ssize_t) sizeof( msg ) )
+			error = EINVAL;
+		else if ( msg.type == RIJN_MSG_HELLO )
+			error = rijn_daemon_hello( &d->conn[c], fd );
+		else if ( msg.type == RIJN_MSG_KEY )
+			error = rijn_daemon_key_load( d, c, &msg );
+		else if ( msg.type == RIJN_MSG_RING )
+		{
+			error = rijn_daemon_ring_attach( &d->conn[c], fd, msg.nbytes );
+			reply = d->bellfd;
+		}
+		else if ( msg.type == RIJN_MSG_CRYPT )
+		{
+			error = rijn_daemon_check( d, c, &msg );
+			if ( error == 0 )
+				error = rijn_daemon_queue( &d->sock, c, &msg, 0 );
+		}
+		else
+			error = EINVAL;
+		pthread_mutex_unlock( &d->lock );
+
+		if ( fd >= 0 )
+			close( fd );
+		if ( msg.type == RIJN_MSG_CRYPT && error == 0 )
+			continue;	/* replied to after the batch */
+		rijn_daemon_reply( d, c, &msg, error ? 1 : 0, error,
+						   error ? -1 : reply );
+	}
+}
+
+
+/* Run the requests from the sockets as one batch and reply to each. */
+static void rijn_daemon_batch_sock( rijn_daemon *d )
+{
+	rijn_daemon_request *req;
+	int i;
+
+	if ( d->sock.n == 0 )
+		return;
+
+	rijn_daemon_run( d, &d->sock );
+	for ( i = 0; i < d->sock.n; i++ )
+	{
+		req = &d->sock.req[i];
+		if ( req->error )
+			rijn_daemon_reply( d, req->conn, &req->msg, 1, req->error, -1 );
+		else
+			rijn_daemon_reply( d, req->conn, &req->msg, req->job.status,
+							   req->job.error, -1 );
+	}
+	d->sock.n = 0;
+}
+
+
+/* Close connection c, releasing the keys it loaded. */
+static void rijn_daemon_drop( rijn_daemon *d, int c )
+{
+	rijn_daemon_conn *conn = &d->conn[c];
+	rijn_daemon_key *key;
+	unsigned gen;
+	int i;
+
+	for ( i = 0; i < conn->nhandles; i++ )
+	{
+		key = &d->key[conn->handles[i]];
+		if ( --key->refs == 0 )
+		{
+			gen = ( key->gen + 1 ) & RIJN_HANDLE_GENS;
+			memset( key, 0, sizeof( *key ) );
+			key->gen = gen;
+		}
+	}
+	free( conn->handles );
+	if ( conn->map != NULL )
+		munmap( conn->map, conn->size );
+	if ( conn->ring != NULL )
+		munmap( conn->ring, rijn_daemon_ring_size( conn->entries ) );
+	close( conn->fd );
+	d->conn[c] = d->conn[--d->nconns];
+}
+
+
+static void *rijn_daemon_thread( void *arg )
+{
+	rijn_daemon *d = (rijn_daemon *) arg;
+	int i, fd, cap = 0;
+
+	for ( ;; )
+	{
+		if ( rijn_daemon_grow( &d->pfd, &cap, d->nconns + 2,
+							   sizeof( *d->pfd ) ) )
+			break;
+		d->pfd[0].fd = d->wake[0];
+		d->pfd[1].fd = d->listenfd;
+		for ( i = 0; i < d->nconns; i++ )
+			d->pfd[i + 2].fd = d->conn[i].fd;
+		for ( i = 0; i < d->nconns + 2; i++ )
+			d->pfd[i].events = POLLIN;
+
+		if ( poll( d->pfd, d->nconns + 2, -1 ) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			break;
+		}
+		if ( d->pfd[0].revents )
+			break;
+
+		for ( i = 0; i < d->nconns; i++ )
+			if ( d->pfd[i + 2].revents )
+				rijn_daemon_read( d, i );
+		rijn_daemon_batch_sock( d );
+		pthread_mutex_lock( &d->lock );
+		for ( i = d->nconns - 1; i >= 0; i-- )
+			if ( d->conn[i].dead )
+				rijn_daemon_drop( d, i );
+		pthread_mutex_unlock( &d->lock );
+
+		if ( d->pfd[1].revents & POLLIN )
+		{
+			fd = accept4( d->listenfd, NULL, NULL, SOCK_CLOEXEC );
+			pthread_mutex_lock( &d->lock );
+			if ( fd >= 0 && rijn_daemon_grow( &d->conn, &d->capconns,
+											  d->nconns + 1,
+											  sizeof( *d->conn ) ) )
+			{
+				close( fd );
+				fd = -1;
+			}
+			if ( fd >= 0 )
+			{
+				memset( &d->conn[d->nconns], 0, sizeof( *d->conn ) );
+				d->conn[d->nconns++].fd = fd;
+			}
+			pthread_mutex_unlock( &d->lock );
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Take every new entry from every ring into d->rings; with lock held.
+   Returns how many were taken. */
+static int rijn_daemon_ring_collect( rijn_daemon *d )
+{
+	rijn_daemon_conn *conn;
+	rijn_daemon_sqe sqe;
+	rijn_msg msg;
+	unsigned tail;
+	int c;
+
+	d->rings.n = 0;
+	for ( c = 0; c < d->nconns; c++ )
+	{
+		conn = &d->conn[c];
+		if ( conn->ring == NULL || conn->broken )
+			continue;
+		tail = __atomic_load_n( &conn->ring->sq_tail, __ATOMIC_ACQUIRE );
+		if ( tail - conn->sq_head > conn->entries )
+		{
+			conn->broken = 1;
+			continue;
+		}
+		for ( ; conn->sq_head != tail; conn->sq_head++ )
+		{
+			/* copy it out first; the client can still write to it */
+			memcpy( &sqe, &rijn_daemon_sq( conn->ring )[conn->sq_head &
+						  ( conn->entries - 1 )], sizeof( sqe ) );
+			memset( &msg, 0, sizeof( msg ) );
+			msg.type = RIJN_MSG_CRYPT;
+			msg.op = sqe.op;
+			msg.handle = sqe.handle;
+			msg.offset = sqe.offset;
+			msg.nbytes = sqe.nbytes;
+			memcpy( msg.data, sqe.iv, sizeof( msg.data ) );
+			if ( rijn_daemon_queue( &d->rings, c, &msg,
+									rijn_daemon_check( d, c, &msg ) ) )
+				break;	/* try the rest on the next pass */
+		}
+	}
+
+	return d->rings.n;
+}
+
+
+/* Post d->rings' completions, in order, and wake clients waiting on them;
+   with lock held. */
+static void rijn_daemon_ring_post( rijn_daemon *d )
+{
+	rijn_daemon_request *req;
+	rijn_daemon_conn *conn;
+	rijn_daemon_cqe *cqe;
+	int i, c;
+
+	for ( i = 0; i < d->rings.n; i++ )
+	{
+		req = &d->rings.req[i];
+		conn = &d->conn[req->conn];
+		cqe = &rijn_daemon_cq( conn->ring, conn->entries )[conn->cq_tail++ &
+			  ( conn->entries - 1 )];
+		cqe->status = req->error ? 1 : req->job.status;
+		cqe->error = req->error ? req->error : req->job.error;
+		memcpy( cqe->iv, req->msg.data, sizeof( cqe->iv ) );
+		conn->posted = 1;
+	}
+
+	for ( c = 0; c < d->nconns; c++ )
+	{
+		conn = &d->conn[c];
+		if ( !conn->posted )
+			continue;
+		conn->posted = 0;
+		__atomic_store_n( &conn->ring->cq_tail, conn->cq_tail,
+						  __ATOMIC_SEQ_CST );
+		if ( __atomic_load_n( &conn->ring->cq_wait, __ATOMIC_SEQ_CST ) )
+			rijn_futex_wake( &conn->ring->cq_tail );
+	}
+}
+
+
+/* Tell whether any ring has new entries; with lock held. */
+static int rijn_daemon_ring_pending( rijn_daemon *d )
+{
+	rijn_daemon_conn *conn;
+	int c;
+
+	for ( c = 0; c < d->nconns; c++ )
+	{
+		conn = &d->conn[c];
+		if ( conn->ring != NULL && !conn->broken &&
+			 __atomic_load_n( &conn->ring->sq_tail, __ATOMIC_SEQ_CST ) !=
+			 conn->sq_head )
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/* Poll the rings, batching what is on all of them; when they have been
+   idle for RIJN_DAEMON_SPINS polls, sleep until a client rings the bell. */
+static void *rijn_daemon_ring_thread( void *arg )
+{
+	rijn_daemon *d = (rijn_daemon *) arg;
+	rijn_daemon_bell *bell = d->bell;
+	uint32_t seq;
+	int n, idle = 0;
+
+	while ( !__atomic_load_n( &d->stopping, __ATOMIC_ACQUIRE ) )
+	{
+		pthread_mutex_lock( &d->lock );
+		n = rijn_daemon_ring_collect( d );
+		if ( n )
+		{
+			rijn_daemon_run( d, &d->rings );
+			rijn_daemon_ring_post( d );
+		}
+		pthread_mutex_unlock( &d->lock );
+		idle = n ? 0 : idle + 1;
+		if ( idle < RIJN_DAEMON_SPINS )
+			continue;
+
+		/* say so before the last look, so a submitter either is seen or
+		   sees the flag and rings */
+		__atomic_store_n( &bell->sleeping, 1, __ATOMIC_SEQ_CST );
+		seq = __atomic_load_n( &bell->seq, __ATOMIC_SEQ_CST );
+		pthread_mutex_lock( &d->lock );
+		n = rijn_daemon_ring_pending( d );
+		pthread_mutex_unlock( &d->lock );
+		if ( !n && !__atomic_load_n( &d->stopping, __ATOMIC_ACQUIRE ) )
+			rijn_futex_wait( &bell->seq, seq, -1 );
+		__atomic_store_n( &bell->sleeping, 0, __ATOMIC_SEQ_CST );
+		idle = 0;
+	}
+
+	return NULL;
+}
+
+#endif /* __linux__ */
+
+
+rijn_daemon *rijn_daemon_start( const char *path, int nthreads )
+{
+#ifdef __linux__
+	struct sockaddr_un addr;
+	rijn_daemon *d;
+	void *bell = MAP_FAILED;
+	int error, threads = 0, bound = 0;
+
+	if ( strlen( path ) >= sizeof( addr.sun_path ) )
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	d = (rijn_daemon *) calloc( 1, sizeof( *d ) );
+	if ( d == NULL )
+		return NULL;
+	d->wake[0] = d->wake[1] = -1;
+	pthread_mutex_init( &d->lock, NULL );
+	strcpy( d->path, path );
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+
+	/* the socket's mode is set before bind, so that the path is never
+	   reachable with the umask's permissions */
+	d->listenfd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+	if ( d->listenfd < 0 || fchmod( d->listenfd, 0600 ) ||
+		 bind( d->listenfd, (struct sockaddr *) &addr, sizeof( addr ) ) )
+		goto fail;
+	bound = 1;
+	if ( listen( d->listenfd, 64 ) ||
+		 pipe2( d->wake, O_CLOEXEC ) ||
+		 ( d->bellfd = memfd_create( "rijn_daemon",
+									 MFD_CLOEXEC | MFD_ALLOW_SEALING ) ) < 0 ||
+		 ftruncate( d->bellfd, sizeof( rijn_daemon_bell ) ) ||
+		 fcntl( d->bellfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW ) ||
+		 ( bell = mmap( NULL, sizeof( rijn_daemon_bell ),
+						PROT_READ | PROT_WRITE, MAP_SHARED, d->bellfd, 0 ) )
+		 == MAP_FAILED ||
+		 ( d->engine = rijn_engine_create( nthreads ) ) == NULL )
+		goto fail;
+	d->bell = (rijn_daemon_bell *) bell;
+
+	error = pthread_create( &d->ringthread, NULL, rijn_daemon_ring_thread, d );
+	if ( error == 0 )
+	{
+		threads = 1;
+		error = pthread_create( &d->thread, NULL, rijn_daemon_thread, d );
+	}
+	if ( error == 0 )
+		return d;
+	errno = error;
+
+fail:
+	error = errno;
+	if ( threads )
+	{
+		__atomic_store_n( &d->stopping, 1, __ATOMIC_RELEASE );
+		__atomic_add_fetch( &d->bell->seq, 1, __ATOMIC_SEQ_CST );
+		rijn_futex_wake( &d->bell->seq );
+		pthread_join( d->ringthread, NULL );
+	}
+	rijn_engine_destroy( d->engine );
+	if ( bell != MAP_FAILED )
+		munmap( bell, sizeof( rijn_daemon_bell ) );
+	if ( d->bellfd > 0 )
+		close( d->bellfd );
+	if ( d->wake[0] >= 0 )
+	{
+		close( d->wake[0] );
+		close( d->wake[1] );
+	}
+	if ( d->listenfd >= 0 )
+		close( d->listenfd );
+	if ( bound )
+		unlink( path );		/* only the socket this call created */
+	pthread_mutex_destroy( &d->lock );
+	free( d );
+	errno = error;
+	return NULL;
+#else
+	(void) path;
+	(void) nthreads;
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+
+void rijn_daemon_stats( rijn_daemon *daemon, uint64_t *requests,
+						uint64_t *batches )
+{
+#ifdef __linux__
+	*requests = __atomic_load_n( &daemon->requests, __ATOMIC_RELAXED );
+	*batches = __atomic_load_n( &daemon->batches, __ATOMIC_RELAXED );
+#else
+	(void) daemon;
+	*requests = *batches = 0;
+#endif
+}
+
+
+void rijn_daemon_stop( rijn_daemon *daemon )
+{
+#ifdef __linux__
+	rijn_daemon *d = daemon;
+
+	if ( d == NULL )
+		return;
+	if ( write( d->wake[1], "", 1 ) != 1 )
+		return;		/* cannot happen: the pipe is empty */
+	pthread_join( d->thread, NULL );
+	__atomic_store_n( &d->stopping, 1, __ATOMIC_RELEASE );
+	__atomic_add_fetch( &d->bell->seq, 1, __ATOMIC_SEQ_CST );
+	rijn_futex_wake( &d->bell->seq );
+	pthread_join( d->ringthread, NULL );
+
+	while ( d->nconns > 0 )
+		rijn_daemon_drop( d, d->nconns - 1 );
+	rijn_engine_destroy( d->engine );
+	close( d->listenfd );
+	unlink( d->path );
+	close( d->wake[0] );
+	close( d->wake[1] );
+	munmap( d->bell, sizeof( rijn_daemon_bell ) );
+	close( d->bellfd );
+	if ( d->key != NULL )
+		memset( d->key, 0, d->nkeys * sizeof( *d->key ) );
+	free( d->key );
+	free( d->conn );
+	free( d->sock.req );
+	free( d->sock.jobs );
+	free( d->rings.req );
+	free( d->rings.jobs );
+	free( d->pfd );
+	pthread_mutex_destroy( &d->lock );
+	free( d );
+#else
+	(void) daemon;
+#endif
+}
+
+
+#ifdef __linux__
+
+/* Send msg, with fd attached if it is not -1, and read the reply into it,
+   and any fd that came with the reply into *rfd if rfd is not NULL. */
+static int rijn_client_call( rijn_client *client, rijn_msg *msg, int fd,
+							 int *rfd )
+{
+	ssize_t n;
+	int got;
+
+	if ( rijn_msg_send( client->fd, msg, fd ) )
+		return (1);
+	n = rijn_msg_recv( client->fd, msg, &got, 0 );
+	if ( rfd != NULL )
+		*rfd = got;
+	else if ( got >= 0 )
+		close( got );
+	if ( n != (ssize_t) sizeof( *msg ) )
+	{
+		if ( n >= 0 )
+			errno = ECONNRESET;
+		return (1);
+	}
+	if ( msg->status )
+	{
+		errno = msg->error;
+		return (1);
+	}
+
+	return (0);
+}
+
+#endif /* __linux__ */
+
+
+rijn_client *rijn_client_connect( const char *path, size_t bufsize )
+{
+#ifdef __linux__
+	struct sockaddr_un addr;
+	rijn_client *client;
+	rijn_msg msg;
+	int memfd = -1, error;
+
+	if ( strlen( path ) >= sizeof( addr.sun_path ) || bufsize == 0 )
+	{
+		errno = strlen( path ) >= sizeof( addr.sun_path ) ? ENAMETOOLONG
+														   : EINVAL;
+		return NULL;
+	}
+
+	client = (rijn_client *) calloc( 1, sizeof( *client ) );
+	if ( client == NULL )
+		return NULL;
+	client->map = (uint8_t *) MAP_FAILED;
+	client->size = bufsize;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+
+	client->fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+	if ( client->fd < 0 ||
+		 connect( client->fd, (struct sockaddr *) &addr, sizeof( addr ) ) ||
+		 ( memfd = memfd_create( "rijn_client",
+								 MFD_CLOEXEC | MFD_ALLOW_SEALING ) ) < 0 ||
+		 ftruncate( memfd, (off_t) bufsize ) ||
+		 fcntl( memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW ) ||
+		 ( client->map = (uint8_t *) mmap( NULL, bufsize,
+										   PROT_READ | PROT_WRITE,
+										   MAP_SHARED, memfd, 0 ) )
+		 == MAP_FAILED )
+		goto fail;
+
+	memset( &msg, 0, sizeof( msg ) );
+	msg.type = RIJN_MSG_HELLO;
+	if ( rijn_client_call( client, &msg, memfd, NULL ) )
+		goto fail;
+	close( memfd );
+
+	return client;
+
+fail:
+	error = errno;
+	if ( memfd >= 0 )
+		close( memfd );
+	if ( client->map != MAP_FAILED )
+		munmap( client->map, bufsize );
+	if ( client->fd >= 0 )
+		close( client->fd );
+	free( client );
+	errno = error;
+	return NULL;
+#else
+	(void) path;
+	(void) bufsize;
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+
+uint8_t *rijn_client_buffer( rijn_client *client )
+{
+	return client->map;
+}
+
+
+int rijn_client_key( rijn_client *client, uint8_t *key, int nkeybits,
+					 int nblockbits, uint32_t *handle )
+{
+#ifdef __linux__
+	rijn_msg msg;
+	int status;
+
+	if ( nkeybits < 128 || nkeybits > 256 || nkeybits % 32 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	memset( &msg, 0, sizeof( msg ) );
+	msg.type = RIJN_MSG_KEY;
+	msg.nkeybits = nkeybits;
+	msg.nblockbits = nblockbits;
+	memcpy( msg.data, key, nkeybits / 8 );
+	status = rijn_client_call( client, &msg, -1, NULL );
+	if ( status == 0 )
+		*handle = msg.handle;
+	memset( &msg, 0, sizeof( msg ) );
+
+	return status;
+#else
+	(void) client;
+	(void) key;
+	(void) nkeybits;
+	(void) nblockbits;
+	(void) handle;
+	errno = ENOSYS;
+	return (1);
+#endif
+}
+
+
+int rijn_client_crypt( rijn_client *client, int op, uint32_t handle,
+					   uint8_t *iv, size_t offset, size_t nbytes )
+{
+#ifdef __linux__
+	rijn_msg msg;
+	uint64_t tag;
+	int cbc = op == RIJN_JOB_CBC_ENCRYPT || op == RIJN_JOB_CBC_DECRYPT;
+	int blocklen = RIJN_HANDLE_BLOCKLEN( handle );
+
+	if ( blocklen > 32 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+	if ( client->ring != NULL )
+	{
+		if ( client->sq_tail != client->cq_head )
+		{
+			errno = EBUSY;
+			return (1);
+		}
+		if ( rijn_client_submit( client, op, handle, iv, offset, nbytes, 0 ) )
+			return (1);
+		return rijn_client_reap( client, &tag, 1 );
+	}
+
+	memset( &msg, 0, sizeof( msg ) );
+	msg.type = RIJN_MSG_CRYPT;
+	msg.op = op;
+	msg.handle = handle;
+	msg.offset = offset;
+	msg.nbytes = nbytes;
+	if ( cbc )
+		memcpy( msg.data, iv, blocklen );
+	if ( rijn_client_call( client, &msg, -1, NULL ) )
+		return (1);
+	if ( cbc )
+		memcpy( iv, msg.data, blocklen );
+
+	return (0);
+#else
+	(void) client;
+	(void) op;
+	(void) handle;
+	(void) iv;
+	(void) offset;
+	(void) nbytes;
+	errno = ENOSYS;
+	return (1);
+#endif
+}
+
+
+int rijn_client_ring( rijn_client *client, unsigned entries )
+{
+#ifdef __linux__
+	size_t size = rijn_daemon_ring_size( entries );
+	void *ring = MAP_FAILED, *bell = MAP_FAILED;
+	rijn_msg msg;
+	int memfd = -1, bellfd = -1, error;
+
+	if ( client->ring != NULL || entries == 0 ||
+		 entries > RIJN_DAEMON_ENTRIES || ( entries & ( entries - 1 ) ) )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	client->tags = (uint64_t *) calloc( entries, sizeof( uint64_t ) );
+	client->ivs = (uint8_t **) calloc( entries, sizeof( uint8_t * ) );
+	memset( &msg, 0, sizeof( msg ) );
+	msg.type = RIJN_MSG_RING;
+	msg.nbytes = entries;
+	if ( client->tags == NULL || client->ivs == NULL ||
+		 ( memfd = memfd_create( "rijn_ring",
+								 MFD_CLOEXEC | MFD_ALLOW_SEALING ) ) < 0 ||
+		 ftruncate( memfd, (off_t) size ) ||
+		 fcntl( memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW ) ||
+		 ( ring = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+						memfd, 0 ) ) == MAP_FAILED ||
+		 rijn_client_call( client, &msg, memfd, &bellfd ) )
+		goto fail;
+	if ( bellfd < 0 ||
+		 ( bell = mmap( NULL, sizeof( rijn_daemon_bell ),
+						PROT_READ | PROT_WRITE, MAP_SHARED, bellfd, 0 ) )
+		 == MAP_FAILED )
+	{
+		errno = bellfd < 0 ? EPROTO : errno;
+		goto fail;
+	}
+	close( memfd );
+	close( bellfd );
+
+	client->ring = (rijn_daemon_ring *) ring;
+	client->bell = (rijn_daemon_bell *) bell;
+	client->entries = entries;
+	client->sq_tail = client->cq_head = 0;
+
+	return (0);
+
+fail:
+	/* the daemon may hold the ring already, but will never see it used */
+	error = errno;
+	if ( ring != MAP_FAILED )
+		munmap( ring, size );
+	if ( memfd >= 0 )
+		close( memfd );
+	if ( bellfd >= 0 )
+		close( bellfd );
+	free( client->tags );
+	free( client->ivs );
+	client->tags = NULL;
+	client->ivs = NULL;
+	errno = error;
+	return (1);
+#else
+	(void) client;
+	(void) entries;
+	errno = ENOSYS;
+	return (1);
+#endif
+}
+
+
+int rijn_client_submit( rijn_client *client, int op, uint32_t handle,
+						uint8_t *iv, size_t offset, size_t nbytes,
+						uint64_t tag )
+{
+#ifdef __linux__
+	rijn_daemon_sqe *sqe;
+	int cbc = op == RIJN_JOB_CBC_ENCRYPT || op == RIJN_JOB_CBC_DECRYPT;
+	int blocklen = RIJN_HANDLE_BLOCKLEN( handle );
+	unsigned slot;
+
+	if ( client->ring == NULL || blocklen > 32 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+	if ( client->sq_tail - client->cq_head >= client->entries )
+	{
+		errno = EAGAIN;
+		return (1);
+	}
+
+	slot = client->sq_tail & ( client->entries - 1 );
+	sqe = &rijn_daemon_sq( client->ring )[slot];
+	sqe->op = op;
+	sqe->handle = handle;
+	sqe->offset = offset;
+	sqe->nbytes = nbytes;
+	if ( cbc )
+		memcpy( sqe->iv, iv, blocklen );
+	client->tags[slot] = tag;
+	client->ivs[slot] = cbc ? iv : NULL;
+
+	/* publish it, then ring the bell if the ring thread has gone to sleep */
+	__atomic_store_n( &client->ring->sq_tail, ++client->sq_tail,
+					  __ATOMIC_SEQ_CST );
+	if ( __atomic_load_n( &client->bell->sleeping, __ATOMIC_SEQ_CST ) )
+	{
+		__atomic_add_fetch( &client->bell->seq, 1, __ATOMIC_SEQ_CST );
+		rijn_futex_wake( &client->bell->seq );
+	}
+
+	return (0);
+#else
+	(void) client;
+	(void) op;
+	(void) handle;
+	(void) iv;
+	(void) offset;
+	(void) nbytes;
+	(void) tag;
+	errno = ENOSYS;
+	return (1);
+#endif
+}
+
+
+int rijn_client_reap( rijn_client *client, uint64_t *tag, int wait )
+{
+#ifdef __linux__
+	rijn_daemon_ring *ring = client->ring;
+	rijn_daemon_cqe *cqe;
+	unsigned slot;
+	char byte;
+	int spins = 0;
+
+	if ( ring == NULL || client->cq_head == client->sq_tail )
+	{
+		errno = ring == NULL ? EINVAL : EAGAIN;
+		return (1);
+	}
+
+	while ( __atomic_load_n( &ring->cq_tail, __ATOMIC_ACQUIRE ) ==
+			client->cq_head )
+	{
+		if ( !wait )
+		{
+			errno = EAGAIN;
+			return (1);
+		}
+		if ( ++spins < RIJN_DAEMON_SPINS )
+			continue;
+
+		/* as the ring thread does: flag, look again, sleep */
+		__atomic_store_n( &ring->cq_wait, 1, __ATOMIC_SEQ_CST );
+		if ( __atomic_load_n( &ring->cq_tail, __ATOMIC_SEQ_CST ) ==
+			 client->cq_head &&
+			 rijn_futex_wait( &ring->cq_tail, client->cq_head, 1000 ) &&
+			 errno == ETIMEDOUT &&
+			 recv( client->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT ) == 0 )
+		{
+			__atomic_store_n( &ring->cq_wait, 0, __ATOMIC_SEQ_CST );
+			errno = ECONNRESET;
+			return (1);
+		}
+		__atomic_store_n( &ring->cq_wait, 0, __ATOMIC_SEQ_CST );
+		spins = 0;
+	}
+
+	slot = client->cq_head++ & ( client->entries - 1 );
+	cqe = &rijn_daemon_cq( ring, client->entries )[slot];
+	*tag = client->tags[slot];
+	if ( cqe->status )
+	{
+		errno = cqe->error;
+		return (1);
+	}
+	if ( client->ivs[slot] != NULL )
+		memcpy( client->ivs[slot], cqe->iv,
+				RIJN_HANDLE_BLOCKLEN( rijn_daemon_sq( ring )[slot].handle ) );
+
+	return (0);
+#else
+	(void) client;
+	(void) tag;
+	(void) wait;
+	errno = ENOSYS;
+	return (1);
+#endif
+}
+
+
+void rijn_client_close( rijn_client *client )
+{
+#ifdef __linux__
+	if ( client == NULL )
+		return;
+	close( client->fd );
+	munmap( client->map, client->size );
+	if ( client->ring != NULL )
+	{
+		munmap( client->ring, rijn_daemon_ring_size( client->entries ) );
+		munmap( client->bell, sizeof( rijn_daemon_bell ) );
+	}
+	free( client->tags );
+	free( client->ivs );
+	free( client );
+#else
+	(void) client;
+#endif
+}
+
+
+#ifdef RIJN_DAEMON_MAIN
+
+#include <signal.h>
+#include <stdio.h>
+
+int main( int argc, char *argv[] )
+{
+	rijn_daemon *daemon;
+	sigset_t set;
+	int sig, nthreads = argc > 2 ? atoi( argv[2] ) : 2;
+
+	if ( argc < 2 || argc > 3 || nthreads < 1 )
+	{
+		fprintf( stderr, "usage: %s socket-path [threads]\n", argv[0] );
+		return EXIT_FAILURE;
+	}
+
+	/* block the signals before any thread starts, then wait for one */
+	sigemptyset( &set );
+	sigaddset( &set, SIGINT );
+	sigaddset( &set, SIGTERM );
+	pthread_sigmask( SIG_BLOCK, &set, NULL );
+
+	daemon = rijn_daemon_start( argv[1], nthreads );
+	if ( daemon == NULL )
+	{
+		fprintf( stderr, "%s: %s: %s\n", argv[0], argv[1], strerror( errno ) );
+		return EXIT_FAILURE;
+	}
+	sigwait( &set, &sig );
+	rijn_daemon_stop( daemon );
+
+	return EXIT_SUCCESS;
+}
+
+#endif /* RIJN_DAEMON_MAIN */
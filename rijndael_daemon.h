@@ -0,0 +1,48 @@
+#ifndef RIJNDAEL_DAEMON_H_
+#define RIJNDAEL_DAEMON_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+#include "rijndael_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rijn_daemon rijn_daemon;
+typedef struct rijn_client rijn_client;
+
+rijn_daemon *rijn_daemon_start( const char *path, int nthreads );
+
+void rijn_daemon_stats( rijn_daemon *daemon, uint64_t *requests,
+						uint64_t *batches );
+
+void rijn_daemon_stop( rijn_daemon *daemon );
+
+rijn_client *rijn_client_connect( const char *path, size_t bufsize );
+
+uint8_t *rijn_client_buffer( rijn_client *client );
+
+int rijn_client_key( rijn_client *client, uint8_t *key, int nkeybits,
+					 int nblockbits, uint32_t *handle );
+
+int rijn_client_crypt( rijn_client *client, int op, uint32_t handle,
+					   uint8_t *iv, size_t offset, size_t nbytes );
+
+int rijn_client_ring( rijn_client *client, unsigned entries );
+
+int rijn_client_submit( rijn_client *client, int op, uint32_t handle,
+						uint8_t *iv, size_t offset, size_t nbytes,
+						uint64_t tag );
+
+int rijn_client_reap( rijn_client *client, uint64_t *tag, int wait );
+
+void rijn_client_close( rijn_client *client );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_DAEMON_H_ */
@@ -0,0 +1,666 @@
+/*
+ *	Asynchronous job engine for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USING rijndael_engine.c/rijndael_engine.h:
+ *
+ * The engine lets the rijndael functions be used like an offload device:
+ * callers submit jobs and collect them later while engine threads do the
+ * work.
+ *
+ * rijn_engine *rijn_engine_create( int nthreads );
+ *
+ * starts nthreads engine threads and returns the engine, or NULL with errno
+ * set on failure.
+ *
+ * int rijn_engine_submit( rijn_engine *engine, rijn_job *job );
+ *
+ * queues job, a rijn_job the caller has filled in with op (RIJN_JOB_ECB_*
+ * or RIJN_JOB_CBC_*), ctx, iv (CBC only), input, output and nbytes, with the
+ * same meanings as for the rijn_ecb_* and rijn_cbc_* functions, and
+ * optionally callback and arg.  Submission is lock-free and may be done
+ * from any thread, including from a callback.  The job, its buffers and
+ * its context must stay valid and untouched until the job is done.  Jobs
+ * in the queue together may run in any order or at the same time, so a job
+ * that reads another's output or shares its iv must not be submitted until
+ * that job is done.  Returns 0, or 1 with errno set if engine is shutting
+ * down.
+ *
+ * int rijn_engine_submit_batch( rijn_engine *engine, rijn_job **jobs,
+ *								 int n );
+ *
+ * submits n jobs at once, so that an engine thread takes them as one
+ * batch rather than waking for the first.
+ *
+ * int rijn_job_poll( rijn_job *job );
+ *
+ * returns RIJN_JOB_PENDING until the job is done, then what the equivalent
+ * rijn_* call returned: 0 on success or 1 with job->error holding the errno
+ * value.
+ *
+ * int rijn_job_wait( rijn_engine *engine, rijn_job *job );
+ *
+ * blocks until the job is done and returns its status.
+ *
+ * void rijn_engine_destroy( rijn_engine *engine );
+ *
+ * finishes every job already submitted, stops the threads and frees the
+ * engine.
+ *
+ * int rijn_engine_set_limits( rijn_engine *engine, size_t inline_bytes,
+ *							   size_t chunk_bytes );
+ *
+ * sets the sizes that steer the priority classes below, before jobs are
+ * submitted.  Returns 0, or 1 with errno set on invalid argument.
+ *
+ * If callback is not NULL it is called once the job is done and its status
+ * is set; the job belongs to the engine until then.  The callback should
+ * be short because it delays the jobs behind it.
+ *
+ * Priority classes:
+ *
+ * job->priority puts a job in a class so that bulk work cannot hold up
+ * small messages.  A RIJN_JOB_LATENCY job of at most inline_bytes (default
+ * RIJN_ENGINE_INLINE) runs inline in rijn_engine_submit, which calls its
+ * callback; a larger one goes to the urgent queue.  A RIJN_JOB_AUTO job (0,
+ * the default) goes to the urgent queue if it is at most chunk_bytes
+ * (default RIJN_ENGINE_CHUNK) long, else to the bulk queue, as does every
+ * RIJN_JOB_BULK job.  Engine threads take bulk jobs one at a time, oldest
+ * first, so several run at once; each runs chunk_bytes at a time with all
+ * urgent jobs run between chunks, so a small job waits for at most one
+ * chunk of bulk work per engine thread.
+ *
+ * Each engine thread takes all urgent jobs queued so far as one batch.
+ * Jobs that can only run one block at a time, CBC encryption and
+ * single-block ECB, are interleaved across the batch through
+ * rijn_encrypt_multikey and rijn_decrypt_multikey so the blocks of
+ * unrelated callers overlap.  Other jobs already reach the bulk kernels
+ * and run as submitted.
+ *
+ * Link with -lpthread.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rijndael.h"
+#include "rijndael_engine.h"
+
+/* most jobs interleaved through one multi-key call */
+#define RIJN_ENGINE_LANES	64
+
+/* default sizes in bytes for rijn_engine_set_limits */
+#define RIJN_ENGINE_INLINE	4096
+#define RIJN_ENGINE_CHUNK	65536
+
+struct rijn_engine
+{
+	rijn_job *urgent;		/* lock-free stacks of submitted jobs */
+	rijn_job *bulk;
+	rijn_job *backlog;		/* bulk jobs taken off the stack, oldest first, */
+	rijn_job *backlog_end;	/* under lock */
+	size_t inline_bytes;	/* largest RIJN_JOB_LATENCY job run inline */
+	size_t chunk_bytes;		/* bulk jobs run this much at a time */
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* signalled when jobs arrive for sleepers */
+	pthread_cond_t done;	/* broadcast when jobs finish for waiters */
+	int sleepers;			/* engine threads waiting on work */
+	int waiters;			/* rijn_job_wait callers waiting on done */
+	int stop;				/* set by rijn_engine_destroy */
+	int nthreads;
+	pthread_t *thread;
+};
+
+
+/* Publish a job's result, then hand it back through its callback. */
+static void rijn_job_complete( rijn_job *job, int status, int error )
+{
+	rijn_job_callback callback = job->callback;
+
+	job->error = error;
+	__atomic_store_n( &job->status, status, __ATOMIC_SEQ_CST );
+	if ( callback )
+		callback( job );
+}
+
+
+/* Return a job's block length, or 0 if the job cannot run. */
+static int rijn_job_check( rijn_job *job )
+{
+	int blocklen = job->ctx ? job->ctx->blocklen : 0;
+
+	if ( blocklen <= 0 || job->nbytes % blocklen ||
+		 job->op < RIJN_JOB_ECB_ENCRYPT || job->op > RIJN_JOB_CBC_DECRYPT ||
+		 ( job->op >= RIJN_JOB_CBC_ENCRYPT && job->iv == NULL ) )
+		return 0;
+
+	return blocklen;
+}
+
+
+/* Run nbytes of a job from offset off through the rijn_* call it names. */
+static int rijn_job_call( rijn_job *job, size_t off, size_t nbytes )
+{
+	switch ( job->op )
+	{
+	case RIJN_JOB_ECB_ENCRYPT:
+		return rijn_ecb_encrypt( job->ctx, job->input + off,
+								 job->output + off, nbytes );
+	case RIJN_JOB_ECB_DECRYPT:
+		return rijn_ecb_decrypt( job->ctx, job->input + off,
+								 job->output + off, nbytes );
+	case RIJN_JOB_CBC_ENCRYPT:
+		return rijn_cbc_encrypt( job->ctx, job->iv, job->input + off,
+								 job->output + off, nbytes );
+	case RIJN_JOB_CBC_DECRYPT:
+		return rijn_cbc_decrypt( job->ctx, job->iv, job->input + off,
+								 job->output + off, nbytes );
+	}
+	errno = EINVAL;
+	return (1);
+}
+
+
+/* Run a whole job. */
+static void rijn_job_run( rijn_job *job )
+{
+	int status;
+
+	errno = 0;
+	status = rijn_job_call( job, 0, job->nbytes );
+	rijn_job_complete( job, status, status ? errno : 0 );
+}
+
+
+/*
+ * Run n jobs that are CBC encryptions or single-block ECB jobs (all
+ * encryptions, or all decryptions if decrypt), one block of each job per
+ * multi-key call.  Jobs are ordered by shape so that runs of equal block
+ * and key sizes reach the widest kernels.
+ */
+static void rijn_engine_interleave( rijn_job **lane, int n, int decrypt )
+{
+	rijn_context *ctx[RIJN_ENGINE_LANES];
+	uint8_t *in[RIJN_ENGINE_LANES], *out[RIJN_ENGINE_LANES];
+	size_t off[RIJN_ENGINE_LANES];
+	rijn_job *job;
+	uint8_t *chain;
+	int i, j, k, m, active, blocklen;
+
+	for ( i = 1; i < n; i++ )
+	{
+		job = lane[i];
+		for ( j = i; j > 0 && ( lane[j - 1]->ctx->nr > job->ctx->nr ||
+				( lane[j - 1]->ctx->nr == job->ctx->nr &&
+				  lane[j - 1]->ctx->blocklen > job->ctx->blocklen ) ); j-- )
+			lane[j] = lane[j - 1];
+		lane[j] = job;
+	}
+
+	for ( i = active = 0; i < n; i++ )
+	{
+		off[i] = 0;
+		active += lane[i]->nbytes > 0;
+	}
+
+	while ( active )
+	{
+		for ( k = m = 0; k < n; k++ )
+		{
+			job = lane[k];
+			if ( off[k] >= job->nbytes )
+				continue;
+			blocklen = job->ctx->blocklen;
+			if ( job->op == RIJN_JOB_CBC_ENCRYPT )
+			{
+				chain = off[k] ? job->output + off[k] - blocklen : job->iv;
+				in[m] = job->output + off[k];
+				for ( j = 0; j < blocklen; j++ )
+					in[m][j] = job->input[off[k] + j] ^ chain[j];
+			}
+			else
+				in[m] = job->input + off[k];
+			out[m] = job->output + off[k];
+			ctx[m++] = job->ctx;
+			off[k] += blocklen;
+			active -= off[k] >= job->nbytes;
+		}
+		if ( decrypt )
+			rijn_decrypt_multikey( ctx, in, out, m );
+		else
+			rijn_encrypt_multikey( ctx, in, out, m );
+	}
+
+	for ( k = 0; k < n; k++ )
+	{
+		job = lane[k];
+		blocklen = job->ctx->blocklen;
+		if ( job->op == RIJN_JOB_CBC_ENCRYPT && job->nbytes )
+			memcpy( job->iv, job->output + job->nbytes - blocklen, blocklen );
+		rijn_job_complete( job, 0, 0 );
+	}
+}
+
+
+/* Run a batch of jobs, linked through next in submission order. */
+static void rijn_engine_run( rijn_job *batch )
+{
+	rijn_job *enc[RIJN_ENGINE_LANES], *dec[RIJN_ENGINE_LANES];
+	rijn_job *job, *next;
+	int nenc = 0, ndec = 0, blocklen;
+
+	for ( job = batch; job; job = next )
+	{
+		next = job->next;
+		blocklen = rijn_job_check( job );
+		if ( blocklen == 0 )
+			rijn_job_complete( job, 1, EINVAL );
+		else if ( job->op == RIJN_JOB_CBC_ENCRYPT ||
+				  ( job->op == RIJN_JOB_ECB_ENCRYPT &&
+					job->nbytes == (size_t) blocklen ) )
+		{
+			enc[nenc++] = job;
+			if ( nenc == RIJN_ENGINE_LANES )
+			{
+				rijn_engine_interleave( enc, nenc, 0 );
+				nenc = 0;
+			}
+		}
+		else if ( job->op == RIJN_JOB_ECB_DECRYPT &&
+				  job->nbytes == (size_t) blocklen )
+		{
+			dec[ndec++] = job;
+			if ( ndec == RIJN_ENGINE_LANES )
+			{
+				rijn_engine_interleave( dec, ndec, 1 );
+				ndec = 0;
+			}
+		}
+		else
+			rijn_job_run( job );
+	}
+	if ( nenc )
+		rijn_engine_interleave( enc, nenc, 0 );
+	if ( ndec )
+		rijn_engine_interleave( dec, ndec, 1 );
+}
+
+
+/* Whether any queue holds jobs. */
+static int rijn_engine_pending( rijn_engine *engine )
+{
+	return __atomic_load_n( &engine->urgent, __ATOMIC_SEQ_CST ) != NULL ||
+		   __atomic_load_n( &engine->bulk, __ATOMIC_SEQ_CST ) != NULL ||
+		   __atomic_load_n( &engine->backlog, __ATOMIC_SEQ_CST ) != NULL;
+}
+
+
+/* Wake rijn_job_wait callers after jobs have completed. */
+static void rijn_engine_wake( rijn_engine *engine )
+{
+	if ( __atomic_load_n( &engine->waiters, __ATOMIC_SEQ_CST ) )
+	{
+		pthread_mutex_lock( &engine->lock );
+		pthread_cond_broadcast( &engine->done );
+		pthread_mutex_unlock( &engine->lock );
+	}
+}
+
+
+/* Take every job on a stack, returned oldest first. */
+static rijn_job *rijn_engine_take( rijn_job **head )
+{
+	rijn_job *list, *batch, *next;
+
+	list = __atomic_exchange_n( head, NULL, __ATOMIC_ACQUIRE );
+	for ( batch = NULL; list; list = next )
+	{
+		next = list->next;
+		list->next = batch;
+		batch = list;
+	}
+
+	return batch;
+}
+
+
+/* Run the urgent jobs queued so far.  Returns whether there were any. */
+static int rijn_engine_urgent( rijn_engine *engine )
+{
+	rijn_job *batch;
+
+	if ( __atomic_load_n( &engine->urgent, __ATOMIC_RELAXED ) == NULL )
+		return 0;
+	batch = rijn_engine_take( &engine->urgent );
+	if ( batch == NULL )
+		return 0;
+	rijn_engine_run( batch );
+	rijn_engine_wake( engine );
+
+	return 1;
+}
+
+
+/* Take the oldest bulk job, or NULL if there is none.  Each engine thread
+   takes one at a time, and another is woken for any left, so bulk jobs run
+   side by side. */
+static rijn_job *rijn_engine_next_bulk( rijn_engine *engine )
+{
+	rijn_job *job, *batch;
+
+	if ( __atomic_load_n( &engine->bulk, __ATOMIC_RELAXED ) == NULL &&
+		 __atomic_load_n( &engine->backlog, __ATOMIC_RELAXED ) == NULL )
+		return NULL;
+
+	pthread_mutex_lock( &engine->lock );
+	batch = rijn_engine_take( &engine->bulk );
+	if ( batch != NULL )
+	{
+		if ( engine->backlog != NULL )
+			engine->backlog_end->next = batch;
+		else
+			__atomic_store_n( &engine->backlog, batch, __ATOMIC_SEQ_CST );
+		for ( job = batch; job->next; job = job->next )
+			;
+		engine->backlog_end = job;
+	}
+	job = engine->backlog;
+	if ( job != NULL )
+	{
+		__atomic_store_n( &engine->backlog, job->next, __ATOMIC_SEQ_CST );
+		job->next = NULL;
+		if ( engine->backlog != NULL && engine->sleepers )
+			pthread_cond_signal( &engine->work );
+	}
+	pthread_mutex_unlock( &engine->lock );
+
+	return job;
+}
+
+
+/* Run a bulk job a chunk at a time, with the urgent jobs between chunks. */
+static void rijn_engine_run_bulk( rijn_engine *engine, rijn_job *job )
+{
+	int blocklen = rijn_job_check( job );
+	size_t off, n, chunk;
+	int status = 0;
+
+	if ( blocklen == 0 )
+	{
+		rijn_job_complete( job, 1, EINVAL );
+		return;
+	}
+
+	chunk = engine->chunk_bytes / blocklen * blocklen;
+	if ( chunk == 0 )
+		chunk = blocklen;
+
+	errno = 0;
+	for ( off = 0; off < job->nbytes && status == 0; off += n )
+	{
+		n = job->nbytes - off < chunk ? job->nbytes - off : chunk;
+		status = rijn_job_call( job, off, n );
+		if ( off + n < job->nbytes )
+			rijn_engine_urgent( engine );
+	}
+	rijn_job_complete( job, status, status ? errno : 0 );
+}
+
+
+static void *rijn_engine_thread( void *arg )
+{
+	rijn_engine *engine = (rijn_engine *) arg;
+	rijn_job *job;
+
+	for ( ;; )
+	{
+		if ( rijn_engine_urgent( engine ) )
+			continue;
+
+		job = rijn_engine_next_bulk( engine );
+		if ( job == NULL )
+		{
+			pthread_mutex_lock( &engine->lock );
+			__atomic_add_fetch( &engine->sleepers, 1, __ATOMIC_SEQ_CST );
+			while ( !rijn_engine_pending( engine ) && !engine->stop )
+				pthread_cond_wait( &engine->work, &engine->lock );
+			__atomic_sub_fetch( &engine->sleepers, 1, __ATOMIC_SEQ_CST );
+			if ( !rijn_engine_pending( engine ) && engine->stop )
+			{
+				pthread_mutex_unlock( &engine->lock );
+				return NULL;
+			}
+			pthread_mutex_unlock( &engine->lock );
+			continue;
+		}
+
+		rijn_engine_run_bulk( engine, job );
+		rijn_engine_wake( engine );
+	}
+}
+
+
+rijn_engine *rijn_engine_create( int nthreads )
+{
+	rijn_engine *engine;
+	int i;
+
+	if ( nthreads <= 0 )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	engine = (rijn_engine *) calloc( 1, sizeof( *engine ) );
+	if ( engine == NULL )
+		return NULL;
+	engine->thread = (pthread_t *) calloc( nthreads, sizeof( *engine->thread ) );
+	if ( engine->thread == NULL )
+	{
+		free( engine );
+		return NULL;
+	}
+	engine->inline_bytes = RIJN_ENGINE_INLINE;
+	engine->chunk_bytes = RIJN_ENGINE_CHUNK;
+	pthread_mutex_init( &engine->lock, NULL );
+	pthread_cond_init( &engine->work, NULL );
+	pthread_cond_init( &engine->done, NULL );
+
+	for ( i = 0; i < nthreads; i++ )
+	{
+		if ( pthread_create( &engine->thread[i], NULL, rijn_engine_thread,
+							 engine ) )
+			break;
+		engine->nthreads++;
+	}
+	if ( engine->nthreads == 0 )
+	{
+		rijn_engine_destroy( engine );
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	return engine;
+}
+
+
+int rijn_engine_set_limits( rijn_engine *engine, size_t inline_bytes,
+							size_t chunk_bytes )
+{
+	if ( chunk_bytes == 0 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+	engine->inline_bytes = inline_bytes;
+	engine->chunk_bytes = chunk_bytes;
+
+	return (0);
+}
+
+
+/*
+ * Reset a job for submission and return the queue it belongs on, or NULL
+ * if it is a small RIJN_JOB_LATENCY job to run inline.
+ */
+static rijn_job **rijn_engine_route( rijn_engine *engine, rijn_job *job )
+{
+	job->status = RIJN_JOB_PENDING;
+	job->error = 0;
+	job->next = NULL;
+
+	switch ( job->priority )
+	{
+	case RIJN_JOB_LATENCY:
+		if ( job->nbytes <= engine->inline_bytes )
+			return NULL;
+		return &engine->urgent;
+	case RIJN_JOB_BULK:
+		return &engine->bulk;
+	default:
+		return job->nbytes <= engine->chunk_bytes ? &engine->urgent
+												  : &engine->bulk;
+	}
+}
+
+
+/* Push the chain of jobs first ... last onto queue in one step. */
+static void rijn_engine_push( rijn_engine *engine, rijn_job **queue,
+							  rijn_job *first, rijn_job *last )
+{
+	rijn_job *head = __atomic_load_n( queue, __ATOMIC_RELAXED );
+
+	do
+		last->next = head;
+	while ( !__atomic_compare_exchange_n( queue, &head, first, 1,
+										  __ATOMIC_SEQ_CST,
+										  __ATOMIC_RELAXED ) );
+
+	/* a sleeper counted itself before it last looked at the queues */
+	if ( __atomic_load_n( &engine->sleepers, __ATOMIC_SEQ_CST ) )
+	{
+		pthread_mutex_lock( &engine->lock );
+		pthread_cond_signal( &engine->work );
+		pthread_mutex_unlock( &engine->lock );
+	}
+}
+
+
+int rijn_engine_submit( rijn_engine *engine, rijn_job *job )
+{
+	rijn_job **queue;
+
+	if ( __atomic_load_n( &engine->stop, __ATOMIC_ACQUIRE ) )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	queue = rijn_engine_route( engine, job );
+	if ( queue == NULL )
+		rijn_engine_run( job );
+	else
+		rijn_engine_push( engine, queue, job, job );
+
+	return (0);
+}
+
+
+int rijn_engine_submit_batch( rijn_engine *engine, rijn_job **jobs, int n )
+{
+	rijn_job *first[2] = { NULL, NULL }, *last[2] = { NULL, NULL };
+	rijn_job **queue;
+	int i, q;
+
+	if ( __atomic_load_n( &engine->stop, __ATOMIC_ACQUIRE ) )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	/* chain the urgent jobs and the bulk jobs */
+	for ( i = 0; i < n; i++ )
+	{
+		queue = rijn_engine_route( engine, jobs[i] );
+		if ( queue == NULL )
+		{
+			rijn_engine_run( jobs[i] );
+			continue;
+		}
+		q = queue == &engine->bulk;
+		if ( last[q] )
+			last[q]->next = jobs[i];
+		else
+			first[q] = jobs[i];
+		last[q] = jobs[i];
+	}
+	for ( q = 0; q < 2; q++ )
+		if ( first[q] )
+			rijn_engine_push( engine, q ? &engine->bulk : &engine->urgent,
+							  first[q], last[q] );
+
+	return (0);
+}
+
+
+int rijn_job_poll( rijn_job *job )
+{
+	return __atomic_load_n( &job->status, __ATOMIC_ACQUIRE );
+}
+
+
+int rijn_job_wait( rijn_engine *engine, rijn_job *job )
+{
+	int status = rijn_job_poll( job );
+
+	if ( status != RIJN_JOB_PENDING )
+		return status;
+
+	pthread_mutex_lock( &engine->lock );
+	__atomic_add_fetch( &engine->waiters, 1, __ATOMIC_SEQ_CST );
+	while ( ( status = rijn_job_poll( job ) ) == RIJN_JOB_PENDING )
+		pthread_cond_wait( &engine->done, &engine->lock );
+	__atomic_sub_fetch( &engine->waiters, 1, __ATOMIC_SEQ_CST );
+	pthread_mutex_unlock( &engine->lock );
+
+	return status;
+}
+
+
+void rijn_engine_destroy( rijn_engine *engine )
+{
+	int i;
+
+	if ( engine == NULL )
+		return;
+
+	pthread_mutex_lock( &engine->lock );
+	__atomic_store_n( &engine->stop, 1, __ATOMIC_RELEASE );
+	pthread_cond_broadcast( &engine->work );
+	pthread_mutex_unlock( &engine->lock );
+
+	for ( i = 0; i < engine->nthreads; i++ )
+		pthread_join( engine->thread[i], NULL );
+
+	pthread_cond_destroy( &engine->done );
+	pthread_cond_destroy( &engine->work );
+	pthread_mutex_destroy( &engine->lock );
+	free( engine->thread );
+	free( engine );
+}
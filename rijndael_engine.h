@@ -0,0 +1,71 @@
+#ifndef RIJNDAEL_ENGINE_H_
+#define RIJNDAEL_ENGINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* rijn_job operations */
+#define RIJN_JOB_ECB_ENCRYPT	0
+#define RIJN_JOB_ECB_DECRYPT	1
+#define RIJN_JOB_CBC_ENCRYPT	2
+#define RIJN_JOB_CBC_DECRYPT	3
+
+/* rijn_job priority classes */
+#define RIJN_JOB_AUTO			0	/* by size: urgent if small, else bulk */
+#define RIJN_JOB_LATENCY		1	/* run inline or ahead of bulk work */
+#define RIJN_JOB_BULK			2	/* run in chunks behind urgent jobs */
+
+/* rijn_job status while the job is queued or running */
+#define RIJN_JOB_PENDING		(-1)
+
+typedef struct rijn_job rijn_job;
+
+typedef void ( *rijn_job_callback )( rijn_job *job );
+
+struct rijn_job
+{
+	/* filled in by the caller */
+	int op;						/* one of RIJN_JOB_* */
+	rijn_context *ctx;
+	uint8_t *iv;				/* CBC only; updated as by rijn_cbc_* */
+	uint8_t *input;
+	uint8_t *output;
+	size_t nbytes;
+	int priority;				/* one of RIJN_JOB_AUTO, _LATENCY, _BULK */
+	rijn_job_callback callback;	/* NULL, or called when the job is done */
+	void *arg;					/* for the caller's use */
+
+	/* filled in by the engine */
+	int status;					/* RIJN_JOB_PENDING, 0 or 1 */
+	int error;					/* errno value when status is 1 */
+	rijn_job *next;
+};
+
+typedef struct rijn_engine rijn_engine;
+
+rijn_engine *rijn_engine_create( int nthreads );
+
+int rijn_engine_set_limits( rijn_engine *engine, size_t inline_bytes,
+							size_t chunk_bytes );
+
+int rijn_engine_submit( rijn_engine *engine, rijn_job *job );
+
+int rijn_engine_submit_batch( rijn_engine *engine, rijn_job **jobs, int n );
+
+int rijn_job_poll( rijn_job *job );
+
+int rijn_job_wait( rijn_engine *engine, rijn_job *job );
+
+void rijn_engine_destroy( rijn_engine *engine );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_ENGINE_H_ */
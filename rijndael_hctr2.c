@@ -0,0 +1,457 @@
+/*
+ *	HCTR2 wide-block encryption for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * USING rijndael_hctr2.c/rijndael_hctr2.h:
+ *
+ * HCTR2 (Crowley, Huckleberry and Biggers, 2021) is a tweakable wide-block
+ * cipher: it encrypts a whole message of 16 bytes or more as one block, so
+ * the ciphertext is exactly as long as the plaintext and a change to any
+ * plaintext byte changes every ciphertext byte.  That suits disk sectors
+ * and other places with no room for an IV or a tag.  The tweak (a sector
+ * number, say) may be any length; the same plaintext under a different
+ * tweak encrypts differently.  HCTR2 gives no authentication.
+ *
+ * int rijn_hctr2_init( rijn_hctr2_key *hk, rijn_context *ctx );
+ *
+ * sets up hk for HCTR2 under the key in ctx, which must have 128-bit blocks
+ * (any key length).  The context is copied.  Returns 0, or 1 with errno
+ * EINVAL for another block length.
+ *
+ * int rijn_hctr2_encrypt( rijn_hctr2_key *hk, const uint8_t *tweak,
+ *						   size_t tweaklen, uint8_t *input, uint8_t *output,
+ *						   size_t nbytes );
+ * int rijn_hctr2_decrypt( rijn_hctr2_key *hk, const uint8_t *tweak,
+ *						   size_t tweaklen, uint8_t *input, uint8_t *output,
+ *						   size_t nbytes );
+ *
+ * encrypt or decrypt nbytes of input to output, which may be the same
+ * buffer.  Return 0, or 1 with errno EINVAL if nbytes is less than 16.
+ *
+ * void rijn_polyval( const uint8_t *h, const uint8_t *input, size_t nbytes,
+ *					  uint8_t *result );
+ *
+ * writes POLYVAL (RFC 8452) of input under the 16-byte key h to result; a
+ * partial last block is padded with zeros.
+ *
+ * int rijn_xctr_crypt( rijn_context *ctx, const uint8_t *iv, uint64_t block,
+ *						uint8_t *input, uint8_t *output, size_t nbytes );
+ *
+ * XORs input with the XCTR keystream to output: the j-th 16 bytes are XORed
+ * with the encryption of iv XOR the little-endian 128-bit block + j, so a
+ * message can be done in pieces by passing the index of each piece's first
+ * block.  HCTR2 starts at block 1.  Returns 0, or 1 with errno EINVAL if
+ * ctx does not have 128-bit blocks.
+ *
+ * The keystream blocks are made RIJN_HCTR2_BATCH at a time and encrypted
+ * together through the bulk ECB kernels.  POLYVAL uses carry-less multiply
+ * (PCLMULQDQ) where the CPU has it, taking RIJN_POLYVAL_POWERS blocks per
+ * reduction against precomputed powers of the hash key; elsewhere it falls
+ * back to a portable shift-and-XOR multiply.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rijndael.h"
+#include "rijndael_hctr2.h"
+
+#define RIJN_HCTR2_BATCH	64	/* keystream blocks per bulk encryption */
+
+#define RIJN_POLYVAL_K	0xc200000000000000ULL	/* x^-64 reduction constant */
+
+
+static uint64_t rijn_hctr2_le64( const uint8_t *p )
+{
+	uint64_t v = 0;
+	int i;
+
+	for ( i = 7; i >= 0; i-- )
+		v = v << 8 | p[i];
+
+	return( v );
+}
+
+
+static void rijn_hctr2_put64( uint8_t *p, uint64_t v )
+{
+	int i;
+
+	for ( i = 0; i < 8; i++ )
+		p[i] = ( uint8_t )( v >> ( 8 * i ) );
+}
+
+
+/* 64x64 -> 128-bit carry-less multiply, four bits of b at a time */
+static void rijn_clmul64( uint64_t a, uint64_t b, uint64_t *lo, uint64_t *hi )
+{
+	uint64_t tl[16], th[16], l = 0, h = 0;
+	int i, k;
+
+	/* a times each 4-bit polynomial */
+	tl[0] = th[0] = 0;
+	tl[1] = a;
+	th[1] = 0;
+	for ( i = 2; i < 16; i += 2 )
+	{
+		tl[i] = tl[i / 2] << 1;
+		th[i] = th[i / 2] << 1 | tl[i / 2] >> 63;
+		tl[i + 1] = tl[i] ^ a;
+		th[i + 1] = th[i];
+	}
+	for ( i = 60; i >= 0; i -= 4 )
+	{
+		h = h << 4 | l >> 60;
+		l <<= 4;
+		k = ( int )( b >> i & 15 );
+		l ^= tl[k];
+		h ^= th[k];
+	}
+	*lo = l;
+	*hi = h;
+}
+
+
+/* r = a * b * x^-128 mod x^128 + x^127 + x^126 + x^121 + 1, the POLYVAL
+   dot product: the 256-bit product is folded down 64 bits at a time. */
+static void rijn_polyval_dot( const uint64_t *a, const uint64_t *b,
+							  uint64_t *r )
+{
+	uint64_t c0, c1, c2, c3, m0, m1, n0, n1, t0, t1;
+
+	rijn_clmul64( a[0], b[0], &c0, &c1 );
+	rijn_clmul64( a[1], b[1], &c2, &c3 );
+	rijn_clmul64( a[0], b[1], &m0, &m1 );
+	rijn_clmul64( a[1], b[0], &n0, &n1 );
+	c1 ^= m0 ^ n0;
+	c2 ^= m1 ^ n1;
+
+	rijn_clmul64( c0, RIJN_POLYVAL_K, &t0, &t1 );
+	c1 ^= t0;
+	c2 ^= c0 ^ t1;
+	rijn_clmul64( c1, RIJN_POLYVAL_K, &t0, &t1 );
+	r[0] = c2 ^ t0;
+	r[1] = c3 ^ c1 ^ t1;
+}
+
+
+static void rijn_polyval_blocks_soft( const uint64_t *h, uint64_t *s,
+									  const uint8_t *p, size_t nblocks )
+{
+	for ( ; nblocks; nblocks--, p += 16 )
+	{
+		s[0] ^= rijn_hctr2_le64( p );
+		s[1] ^= rijn_hctr2_le64( p + 8 );
+		rijn_polyval_dot( s, h, s );
+	}
+}
+
+
+#if !defined( RIJN_NO_CLMUL ) && defined( __GNUC__ ) && defined( __x86_64__ )
+	#define RIJN_POLYVAL_CLMUL
+#endif
+
+#ifdef RIJN_POLYVAL_CLMUL
+
+#include <immintrin.h>
+
+static int rijn_polyval_have_clmul( void )
+{
+	static int have_clmul = -1;
+
+	if ( have_clmul < 0 )
+	{
+		__builtin_cpu_init();
+		have_clmul = __builtin_cpu_supports( "pclmul" ) ? 1 : 0;
+	}
+
+	return( have_clmul );
+}
+
+
+/* lo:hi ^= a * b, unreduced */
+__attribute__(( target( "pclmul" ) ))
+static inline void rijn_polyval_mul_acc( __m128i a, __m128i b, __m128i *lo,
+										 __m128i *hi )
+{
+	__m128i mid;
+
+	mid = _mm_xor_si128( _mm_clmulepi64_si128( a, b, 0x01 ),
+						 _mm_clmulepi64_si128( a, b, 0x10 ) );
+	*lo = _mm_xor_si128( *lo, _mm_xor_si128( _mm_clmulepi64_si128( a, b, 0x00 ),
+											 _mm_slli_si128( mid, 8 ) ) );
+	*hi = _mm_xor_si128( *hi, _mm_xor_si128( _mm_clmulepi64_si128( a, b, 0x11 ),
+											 _mm_srli_si128( mid, 8 ) ) );
+}
+
+
+/* lo:hi * x^-128, the same two folds as rijn_polyval_dot */
+__attribute__(( target( "pclmul" ) ))
+static inline __m128i rijn_polyval_reduce( __m128i lo, __m128i hi )
+{
+	const __m128i k = _mm_set_epi64x( ( long long )RIJN_POLYVAL_K, 0 );
+
+	lo = _mm_xor_si128( _mm_shuffle_epi32( lo, 0x4e ),
+						_mm_clmulepi64_si128( lo, k, 0x10 ) );
+	lo = _mm_xor_si128( _mm_shuffle_epi32( lo, 0x4e ),
+						_mm_clmulepi64_si128( lo, k, 0x10 ) );
+
+	return( _mm_xor_si128( lo, hi ) );
+}
+
+
+/* RIJN_POLYVAL_POWERS blocks per reduction: the first block, with the
+   accumulator added, is multiplied by the highest power of h and the last
+   by h itself, the products summed and reduced once. */
+__attribute__(( target( "pclmul" ) ))
+static void rijn_polyval_blocks_clmul( const uint64_t ( *h )[2], uint64_t *s,
+									   const uint8_t *p, size_t nblocks )
+{
+	__m128i acc, lo, hi, hp[RIJN_POLYVAL_POWERS];
+	int j;
+
+	for ( j = 0; j < RIJN_POLYVAL_POWERS; j++ )
+		hp[j] = _mm_loadu_si128( ( const __m128i * )h[j] );
+	acc = _mm_loadu_si128( ( const __m128i * )s );
+
+	for ( ; nblocks >= RIJN_POLYVAL_POWERS; nblocks -= RIJN_POLYVAL_POWERS )
+	{
+		lo = hi = _mm_setzero_si128();
+		for ( j = 0; j < RIJN_POLYVAL_POWERS; j++, p += 16 )
+			rijn_polyval_mul_acc( j ? _mm_loadu_si128( ( const __m128i * )p ) :
+								  _mm_xor_si128( acc, _mm_loadu_si128(
+									  ( const __m128i * )p ) ),
+								  hp[RIJN_POLYVAL_POWERS - 1 - j], &lo, &hi );
+		acc = rijn_polyval_reduce( lo, hi );
+	}
+	for ( ; nblocks; nblocks--, p += 16 )
+	{
+		lo = hi = _mm_setzero_si128();
+		rijn_polyval_mul_acc( _mm_xor_si128( acc, _mm_loadu_si128(
+								  ( const __m128i * )p ) ), hp[0], &lo, &hi );
+		acc = rijn_polyval_reduce( lo, hi );
+	}
+	_mm_storeu_si128( ( __m128i * )s, acc );
+}
+
+#endif	/* RIJN_POLYVAL_CLMUL */
+
+
+/* Absorb whole blocks into the accumulator s.  The layout of s and of the
+   powers as two little-endian 64-bit words matches an x86 __m128i. */
+static void rijn_polyval_blocks( const uint64_t ( *h )[2], uint64_t *s,
+								 const uint8_t *p, size_t nblocks )
+{
+#ifdef RIJN_POLYVAL_CLMUL
+	if ( rijn_polyval_have_clmul() )
+	{
+		rijn_polyval_blocks_clmul( h, s, p, nblocks );
+		return;
+	}
+#endif
+	rijn_polyval_blocks_soft( h[0], s, p, nblocks );
+}
+
+
+static void rijn_polyval_powers( const uint8_t *key, uint64_t ( *h )[2] )
+{
+	int j;
+
+	h[0][0] = rijn_hctr2_le64( key );
+	h[0][1] = rijn_hctr2_le64( key + 8 );
+	for ( j = 1; j < RIJN_POLYVAL_POWERS; j++ )
+		rijn_polyval_dot( h[j - 1], h[0], h[j] );
+}
+
+
+/* Absorb nbytes, the last partial block padded with pad then zeros */
+static void rijn_polyval_update( const uint64_t ( *h )[2], uint64_t *s,
+								 const uint8_t *p, size_t nbytes, uint8_t pad )
+{
+	uint8_t last[16];
+	size_t rest = nbytes % 16;
+
+	rijn_polyval_blocks( h, s, p, nbytes / 16 );
+	if ( rest )
+	{
+		memset( last, 0, sizeof( last ) );
+		memcpy( last, p + nbytes - rest, rest );
+		last[rest] = pad;
+		rijn_polyval_blocks( h, s, last, 1 );
+	}
+}
+
+
+void rijn_polyval( const uint8_t *h, const uint8_t *input, size_t nbytes,
+				   uint8_t *result )
+{
+	uint64_t hp[RIJN_POLYVAL_POWERS][2], s[2] = { 0, 0 };
+
+	rijn_polyval_powers( h, hp );
+	rijn_polyval_update( ( const uint64_t ( * )[2] )hp, s, input, nbytes, 0 );
+	rijn_hctr2_put64( result, s[0] );
+	rijn_hctr2_put64( result + 8, s[1] );
+}
+
+
+int rijn_xctr_crypt( rijn_context *ctx, const uint8_t *iv, uint64_t block,
+					 uint8_t *input, uint8_t *output, size_t nbytes )
+{
+	uint8_t ks[RIJN_HCTR2_BATCH * 16];
+	uint64_t iv0;
+	size_t i, j, step;
+
+	if ( ctx->blocklen != 16 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	iv0 = rijn_hctr2_le64( iv );
+	for ( i = 0; i < nbytes; i += step )
+	{
+		step = nbytes - i < sizeof( ks ) ? nbytes - i : sizeof( ks );
+		for ( j = 0; j < step; j += 16, block++ )
+		{
+			memcpy( ks + j, iv, 16 );
+			rijn_hctr2_put64( ks + j, iv0 ^ block );
+		}
+		rijn_ecb_encrypt( ctx, ks, ks, ( step + 15 ) & ~( size_t )15 );
+		for ( j = 0; j < step; j++ )
+			output[i + j] = input[i + j] ^ ks[j];
+	}
+	memset( ks, 0, sizeof( ks ) );
+
+	return (0);
+}
+
+
+int rijn_hctr2_init( rijn_hctr2_key *hk, rijn_context *ctx )
+{
+	uint8_t b[32];
+
+	if ( ctx->blocklen != 16 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	hk->ctx = *ctx;
+	memset( b, 0, sizeof( b ) );
+	b[16] = 1;
+	rijn_ecb_encrypt( &hk->ctx, b, b, sizeof( b ) );
+	rijn_polyval_powers( b, hk->h );
+	memcpy( hk->L, b + 16, 16 );
+	memset( b, 0, sizeof( b ) );
+
+	return (0);
+}
+
+
+/* The hash of the tweak alone, the part H(T, N) and H(T, V) share: a
+   length block, then the tweak padded with zeros.  The length block also
+   says whether the message ends in a partial block. */
+static void rijn_hctr2_tweak( rijn_hctr2_key *hk, const uint8_t *tweak,
+							  size_t tweaklen, size_t nbytes, uint64_t *s )
+{
+	uint8_t len[16];
+
+	memset( len, 0, sizeof( len ) );
+	rijn_hctr2_put64( len, ( uint64_t )tweaklen * 16 + 2 +
+					  ( nbytes % 16 != 0 ) );
+	s[0] = s[1] = 0;
+	rijn_polyval_blocks( ( const uint64_t ( * )[2] )hk->h, s, len, 1 );
+	rijn_polyval_update( ( const uint64_t ( * )[2] )hk->h, s, tweak, tweaklen,
+						 0 );
+}
+
+
+/* x ^= H(T, m): the tweak hash continued over m, padded with 1 then zeros */
+static void rijn_hctr2_hash( rijn_hctr2_key *hk, const uint64_t *ts,
+							 const uint8_t *m, size_t nbytes, uint8_t *x )
+{
+	uint64_t s[2];
+	int i;
+
+	s[0] = ts[0];
+	s[1] = ts[1];
+	rijn_polyval_update( ( const uint64_t ( * )[2] )hk->h, s, m, nbytes, 1 );
+	for ( i = 0; i < 8; i++ )
+	{
+		x[i] ^= ( uint8_t )( s[0] >> ( 8 * i ) );
+		x[8 + i] ^= ( uint8_t )( s[1] >> ( 8 * i ) );
+	}
+}
+
+
+/* Both directions: the first block is whitened by the hash of the rest,
+   put through the block cipher, and whitened again by the hash of the
+   rest after the rest has been XCTR-encrypted under a value derived from
+   the block before and after the cipher. */
+static int rijn_hctr2_crypt( rijn_hctr2_key *hk, const uint8_t *tweak,
+							 size_t tweaklen, uint8_t *input, uint8_t *output,
+							 size_t nbytes, int decrypt )
+{
+	uint8_t x[16], y[16], s[16];
+	uint64_t ts[2];
+	size_t rest = nbytes - 16;
+	int i;
+
+	if ( nbytes < 16 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	rijn_hctr2_tweak( hk, tweak, tweaklen, rest, ts );
+	memcpy( x, input, 16 );
+	rijn_hctr2_hash( hk, ts, input + 16, rest, x );
+	if ( decrypt )
+		rijn_decrypt( &hk->ctx, x, y );
+	else
+		rijn_encrypt( &hk->ctx, x, y );
+	for ( i = 0; i < 16; i++ )
+		s[i] = x[i] ^ y[i] ^ hk->L[i];
+	rijn_xctr_crypt( &hk->ctx, s, 1, input + 16, output + 16, rest );
+	rijn_hctr2_hash( hk, ts, output + 16, rest, y );
+	memcpy( output, y, 16 );
+	memset( x, 0, sizeof( x ) );
+	memset( s, 0, sizeof( s ) );
+
+	return (0);
+}
+
+
+int rijn_hctr2_encrypt( rijn_hctr2_key *hk, const uint8_t *tweak,
+						size_t tweaklen, uint8_t *input, uint8_t *output,
+						size_t nbytes )
+{
+	return( rijn_hctr2_crypt( hk, tweak, tweaklen, input, output, nbytes,
+							  0 ) );
+}
+
+
+int rijn_hctr2_decrypt( rijn_hctr2_key *hk, const uint8_t *tweak,
+						size_t tweaklen, uint8_t *input, uint8_t *output,
+						size_t nbytes )
+{
+	return( rijn_hctr2_crypt( hk, tweak, tweaklen, input, output, nbytes,
+							  1 ) );
+}
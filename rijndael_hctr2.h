@@ -0,0 +1,42 @@
+#ifndef RIJNDAEL_HCTR2_H_
+#define RIJNDAEL_HCTR2_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RIJN_POLYVAL_POWERS	8	/* blocks hashed per reduction */
+
+typedef struct
+{
+	rijn_context ctx;
+	uint8_t L[16];
+	uint64_t h[RIJN_POLYVAL_POWERS][2];	/* hash key powers, h[0] = E(0) */
+} rijn_hctr2_key;
+
+int rijn_hctr2_init( rijn_hctr2_key *hk, rijn_context *ctx );
+
+int rijn_hctr2_encrypt( rijn_hctr2_key *hk, const uint8_t *tweak,
+						size_t tweaklen, uint8_t *input, uint8_t *output,
+						size_t nbytes );
+
+int rijn_hctr2_decrypt( rijn_hctr2_key *hk, const uint8_t *tweak,
+						size_t tweaklen, uint8_t *input, uint8_t *output,
+						size_t nbytes );
+
+void rijn_polyval( const uint8_t *h, const uint8_t *input, size_t nbytes,
+				   uint8_t *result );
+
+int rijn_xctr_crypt( rijn_context *ctx, const uint8_t *iv, uint64_t block,
+					 uint8_t *input, uint8_t *output, size_t nbytes );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_HCTR2_H_ */
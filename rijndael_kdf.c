@@ -0,0 +1,247 @@
+/*
+ *	SP 800-108 key derivation for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * USING rijndael_kdf.c/rijndael_kdf.h:
+ *
+ * The key derivation function in counter mode of NIST SP 800-108, with
+ * CMAC as the PRF.  Output block i (from 1) is the CMAC under the key in
+ * ctx of [i] || label || 0x00 || context || [L], where [i] and [L] are
+ * 32-bit big-endian and L is the output length in bits, so each output
+ * depends on how much was asked for.  This is the KBKDF of OpenSSL 3 with
+ * mac CMAC, mode counter and the default separator and length fields.
+ *
+ * int rijn_kdf_ctr( rijn_context *ctx, const uint8_t *label,
+ *					 size_t labellen, const uint8_t *context,
+ *					 size_t contextlen, uint8_t *output, size_t nbytes );
+ *
+ * writes nbytes of derived key material to output.  Returns 0, or 1 with
+ * errno EINVAL if nbytes is 2^29 or more.
+ *
+ * int rijn_kdf_ctr_keys( rijn_context *ctx, const uint8_t *label,
+ *						  size_t labellen, const uint8_t *context,
+ *						  size_t contextlen, rijn_context *keys,
+ *						  size_t nkeys, int nkeybits, int nblockbits );
+ *
+ * derives nkeys * nkeybits / 8 bytes the same way and sets up keys[0] ...
+ * keys[nkeys - 1] from them in turn, straight from the buffer the PRF
+ * wrote, which is wiped before returning.  Returns 0, or 1 with errno
+ * EINVAL on an invalid key or block size or too much output.
+ *
+ * The output blocks do not depend on one another, so up to RIJN_KDF_LANES
+ * of them are computed in lockstep: block j of every lane's CMAC is
+ * encrypted together through the bulk ECB kernels.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rijndael.h"
+#include "rijndael_kdf.h"
+
+#define RIJN_KDF_LANES	64	/* PRF outputs computed together */
+
+typedef struct
+{
+	const uint8_t *label;
+	size_t labellen;
+	const uint8_t *context;
+	size_t contextlen;
+	uint8_t bits[4];	/* [L] */
+	size_t msglen;		/* bytes of PRF input */
+	uint8_t k1[32];		/* CMAC subkeys */
+	uint8_t k2[32];
+} rijn_kdf_input;
+
+
+static void rijn_kdf_prepare( rijn_kdf_input *in, rijn_context *ctx,
+							  const uint8_t *label, size_t labellen,
+							  const uint8_t *context, size_t contextlen,
+							  size_t nbytes )
+{
+	uint32_t bits = ( uint32_t )nbytes * 8;
+
+	in->label = label;
+	in->labellen = labellen;
+	in->context = context;
+	in->contextlen = contextlen;
+	in->bits[0] = ( uint8_t )( bits >> 24 );
+	in->bits[1] = ( uint8_t )( bits >> 16 );
+	in->bits[2] = ( uint8_t )( bits >> 8 );
+	in->bits[3] = ( uint8_t )bits;
+	in->msglen = 4 + labellen + 1 + contextlen + 4;
+
+	memset( in->k1, 0, ctx->blocklen );
+	rijn_encrypt( ctx, in->k1, in->k1 );
+	rijn_cmac_double( in->k1, ctx->blocklen );
+	memcpy( in->k2, in->k1, ctx->blocklen );
+	rijn_cmac_double( in->k2, ctx->blocklen );
+}
+
+
+/* Bytes pos to pos + n - 1 of the PRF input with the counter left zero,
+   and zero past the end. */
+static void rijn_kdf_block( const rijn_kdf_input *in, size_t pos, uint8_t *out,
+							size_t n )
+{
+	static const uint8_t zero[4] = { 0 };
+	const uint8_t *seg[5] = { zero, in->label, zero, in->context, in->bits };
+	size_t segl[5] = { 4, in->labellen, 1, in->contextlen, 4 };
+	size_t start = 0, from, to;
+	int k;
+
+	memset( out, 0, n );
+	for ( k = 0; k < 5; start += segl[k], k++ )
+	{
+		from = pos > start ? pos : start;
+		to = pos + n < start + segl[k] ? pos + n : start + segl[k];
+		if ( from < to )
+			memcpy( out + from - pos, seg[k] + from - start, to - from );
+	}
+}
+
+
+/* PRF outputs for counter ... counter + lanes - 1 into out, block by block
+   of the input across all the lanes at once. */
+static void rijn_kdf_lanes( rijn_context *ctx, const rijn_kdf_input *in,
+							uint32_t counter, size_t lanes, uint8_t *out )
+{
+	uint8_t m[32];
+	size_t pos, lane, bl = ctx->blocklen, j;
+	uint32_t c;
+	int last;
+
+	memset( out, 0, lanes * bl );
+	for ( pos = 0; ; pos += bl )
+	{
+		last = pos + bl >= in->msglen;
+		rijn_kdf_block( in, pos, m, bl );
+		if ( last && in->msglen - pos < bl )
+		{
+			m[in->msglen - pos] = 0x80;
+			for ( j = 0; j < bl; j++ )
+				m[j] ^= in->k2[j];
+		}
+		else if ( last )
+		{
+			for ( j = 0; j < bl; j++ )
+				m[j] ^= in->k1[j];
+		}
+		for ( lane = 0; lane < lanes; lane++ )
+		{
+			for ( j = 0; j < bl; j++ )
+				out[lane * bl + j] ^= m[j];
+			if ( pos == 0 )
+			{
+				c = counter + ( uint32_t )lane;
+				out[lane * bl] ^= ( uint8_t )( c >> 24 );
+				out[lane * bl + 1] ^= ( uint8_t )( c >> 16 );
+				out[lane * bl + 2] ^= ( uint8_t )( c >> 8 );
+				out[lane * bl + 3] ^= ( uint8_t )c;
+			}
+		}
+		rijn_ecb_encrypt( ctx, out, out, lanes * bl );
+		if ( last )
+			break;
+	}
+	memset( m, 0, sizeof( m ) );
+}
+
+
+int rijn_kdf_ctr( rijn_context *ctx, const uint8_t *label, size_t labellen,
+				  const uint8_t *context, size_t contextlen, uint8_t *output,
+				  size_t nbytes )
+{
+	uint8_t buf[RIJN_KDF_LANES * 32];
+	rijn_kdf_input in;
+	size_t bl = ctx->blocklen, done, lanes;
+	uint32_t counter = 1;
+
+	if ( ctx->blocklen <= 0 || nbytes >= ( size_t )1 << 29 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	rijn_kdf_prepare( &in, ctx, label, labellen, context, contextlen, nbytes );
+	for ( done = 0; done < nbytes; done += lanes * bl, counter += lanes )
+	{
+		lanes = ( nbytes - done + bl - 1 ) / bl;
+		if ( lanes > RIJN_KDF_LANES )
+			lanes = RIJN_KDF_LANES;
+		if ( done + lanes * bl <= nbytes )
+			rijn_kdf_lanes( ctx, &in, counter, lanes, output + done );
+		else
+		{
+			/* only the last, partial block needs a copy */
+			rijn_kdf_lanes( ctx, &in, counter, lanes, buf );
+			memcpy( output + done, buf, nbytes - done );
+		}
+	}
+	memset( buf, 0, sizeof( buf ) );
+	memset( &in, 0, sizeof( in ) );
+
+	return (0);
+}
+
+
+int rijn_kdf_ctr_keys( rijn_context *ctx, const uint8_t *label,
+					   size_t labellen, const uint8_t *context,
+					   size_t contextlen, rijn_context *keys, size_t nkeys,
+					   int nkeybits, int nblockbits )
+{
+	uint8_t buf[RIJN_KDF_LANES * 32];
+	rijn_kdf_input in;
+	size_t bl = ctx->blocklen, keylen = nkeybits / 8, unit, batch, k, i;
+	size_t bytes, lanes;
+	uint32_t counter = 1;
+	int err = 0;
+
+	if ( ctx->blocklen <= 0 || nkeybits < 128 || nkeybits > 256 ||
+		 nkeybits % 32 || nblockbits < 128 || nblockbits > 256 ||
+		 nblockbits % 32 || nkeys >= ( ( size_t )1 << 29 ) / keylen )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	/* whole keys per batch, in whole PRF blocks: a multiple of the least
+	   common multiple of the key and block lengths */
+	for ( unit = keylen; unit % bl; unit += keylen )
+		;
+	batch = sizeof( buf ) / unit * unit / keylen;
+
+	rijn_kdf_prepare( &in, ctx, label, labellen, context, contextlen,
+					  nkeys * keylen );
+	for ( k = 0; k < nkeys && !err; k += batch )
+	{
+		bytes = ( nkeys - k < batch ? nkeys - k : batch ) * keylen;
+		lanes = ( bytes + bl - 1 ) / bl;
+		rijn_kdf_lanes( ctx, &in, counter, lanes, buf );
+		counter += ( uint32_t )lanes;
+		for ( i = 0; i * keylen < bytes && !err; i++ )
+			err = rijn_set_key( &keys[k + i], buf + i * keylen, nkeybits,
+								nblockbits );
+	}
+	memset( buf, 0, sizeof( buf ) );
+	memset( &in, 0, sizeof( in ) );
+
+	return( err ? 1 : 0 );
+}
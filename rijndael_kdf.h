@@ -0,0 +1,26 @@
+#ifndef RIJNDAEL_KDF_H_
+#define RIJNDAEL_KDF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int rijn_kdf_ctr( rijn_context *ctx, const uint8_t *label, size_t labellen,
+				  const uint8_t *context, size_t contextlen, uint8_t *output,
+				  size_t nbytes );
+
+int rijn_kdf_ctr_keys( rijn_context *ctx, const uint8_t *label,
+					   size_t labellen, const uint8_t *context,
+					   size_t contextlen, rijn_context *keys, size_t nkeys,
+					   int nkeybits, int nblockbits );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_KDF_H_ */
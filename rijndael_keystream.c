@@ -0,0 +1,335 @@
+/*
+ *	CTR keystream reservoir for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * USING rijndael_keystream.c/rijndael_keystream.h:
+ *
+ * A keystream reservoir computes counter-mode keystream ahead of need, so
+ * encrypting a message on the critical path is a single XOR with keystream
+ * already made.  It produces exactly what rijn_ctr_crypt would over all the
+ * messages passed to it, in order, as one stream.
+ *
+ * rijn_keystream *rijn_keystream_create( rijn_context *ctx,
+ *										  uint8_t *counter, size_t capacity,
+ *										  int background );
+ *
+ * makes a reservoir of capacity bytes (rounded up to whole blocks) for the
+ * key in ctx, which is copied, and the stream whose first counter block is
+ * counter.  If background is not 0 a thread keeps it full, refilling once
+ * it falls below half; otherwise it is filled only by
+ * rijn_keystream_refill.  Returns the reservoir, or NULL with errno set.
+ *
+ * int rijn_keystream_crypt( rijn_keystream *ks, uint8_t *input,
+ *							 uint8_t *output, size_t nbytes );
+ *
+ * encrypts or decrypts the next nbytes of the stream.  Keystream not ready
+ * yet is computed on the spot, as rijn_ctr_crypt would.  Returns 0.
+ *
+ * size_t rijn_keystream_refill( rijn_keystream *ks, size_t nbytes );
+ *
+ * computes up to nbytes more keystream (all that fits if nbytes is 0), for
+ * a caller with no background thread to use its idle time.  Returns the
+ * bytes added.
+ *
+ * size_t rijn_keystream_ready( rijn_keystream *ks );
+ *
+ * tells how many bytes of keystream are ready.
+ *
+ * void rijn_keystream_stats( rijn_keystream *ks, uint64_t *reserved,
+ *							  uint64_t *on_demand );
+ *
+ * tells how many bytes were encrypted with keystream from the reservoir and
+ * how many with keystream computed on demand.
+ *
+ * void rijn_keystream_destroy( rijn_keystream *ks );
+ *
+ * stops the thread and wipes and frees the reservoir.
+ *
+ * One thread at a time may call rijn_keystream_crypt; without a
+ * background thread, another may call rijn_keystream_refill meanwhile.
+ * As with any counter mode, never start two streams at the same counter
+ * under one key.  Link with -lpthread.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rijndael.h"
+#include "rijndael_keystream.h"
+
+#define RIJN_KEYSTREAM_BATCH	4096	/* bytes made between publishing */
+
+struct rijn_keystream
+{
+	rijn_context ctx;
+	uint8_t counter[32];	/* for the first block of the stream */
+	uint8_t *ring;			/* stream byte p is at ring[p % cap] */
+	size_t cap;				/* whole blocks */
+	uint64_t next;			/* the refiller's next byte to make */
+	uint64_t head;			/* stream bytes made, from the refiller */
+	char pad0[64 - sizeof( uint64_t )];
+	uint64_t tail;			/* stream bytes used, from rijn_keystream_crypt */
+	char pad1[64 - sizeof( uint64_t )];
+	uint64_t reserved, on_demand;
+	int background;
+	int waiting;			/* the thread sleeps until below half */
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+};
+
+
+/* Set ctr to the counter block for block k of the stream. */
+static void rijn_keystream_counter( rijn_keystream *ks, uint64_t k,
+									uint8_t *ctr )
+{
+	unsigned carry = 0;
+	int i, blocklen = ks->ctx.blocklen;
+
+	memcpy( ctr, ks->counter, blocklen );
+	for ( i = blocklen - 1; i >= 0 && ( k || carry ); i-- )
+	{
+		carry += ctr[i] + (unsigned) ( k & 0xff );
+		ctr[i] = (uint8_t) carry;
+		carry >>= 8;
+		k >>= 8;
+	}
+}
+
+
+/* Make up to limit bytes of keystream after the refiller's last, or after
+   what the consumer has used if it got ahead.  Returns the bytes made. */
+static size_t rijn_keystream_make( rijn_keystream *ks, size_t limit )
+{
+	uint8_t ctr[32];
+	uint64_t tail, pos, end;
+	size_t n, at, first, blocklen = ks->ctx.blocklen;
+
+	tail = __atomic_load_n( &ks->tail, __ATOMIC_SEQ_CST );
+	pos = ks->next;
+	if ( pos < tail )
+		pos = tail - tail % blocklen;	/* skip what was made on demand */
+	end = tail - tail % blocklen + ks->cap;
+	n = end - pos < limit ? (size_t) ( end - pos ) : limit;
+	n -= n % blocklen;
+	if ( n == 0 )
+		return 0;
+
+	/* counter-mode encrypt zeros, in up to two pieces around the ring */
+	rijn_keystream_counter( ks, pos / blocklen, ctr );
+	at = (size_t) ( pos % ks->cap );
+	first = ks->cap - at < n ? ks->cap - at : n;
+	memset( ks->ring + at, 0, first );
+	rijn_ctr_crypt( &ks->ctx, ctr, ks->ring + at, ks->ring + at, first );
+	if ( first < n )
+	{
+		memset( ks->ring, 0, n - first );
+		rijn_ctr_crypt( &ks->ctx, ctr, ks->ring, ks->ring, n - first );
+	}
+
+	ks->next = pos + n;
+	__atomic_store_n( &ks->head, pos + n, __ATOMIC_RELEASE );
+
+	return n;
+}
+
+
+/* Bytes of keystream ready past tail. */
+static size_t rijn_keystream_avail( rijn_keystream *ks, uint64_t tail )
+{
+	uint64_t head = __atomic_load_n( &ks->head, __ATOMIC_ACQUIRE );
+
+	return head > tail ? (size_t) ( head - tail ) : 0;
+}
+
+
+static void *rijn_keystream_thread( void *arg )
+{
+	rijn_keystream *ks = (rijn_keystream *) arg;
+
+	pthread_mutex_lock( &ks->lock );
+	while ( !ks->stop )
+	{
+		pthread_mutex_unlock( &ks->lock );
+		while ( rijn_keystream_make( ks, RIJN_KEYSTREAM_BATCH ) )
+			;
+		pthread_mutex_lock( &ks->lock );
+
+		/* full: sleep until a crypt takes it below half; say so first, so
+		   that crypt either sees the flag or we see its tail */
+		__atomic_store_n( &ks->waiting, 1, __ATOMIC_SEQ_CST );
+		if ( !ks->stop && rijn_keystream_avail( ks,
+				__atomic_load_n( &ks->tail, __ATOMIC_SEQ_CST ) ) >= ks->cap / 2 )
+			pthread_cond_wait( &ks->cond, &ks->lock );
+		__atomic_store_n( &ks->waiting, 0, __ATOMIC_SEQ_CST );
+	}
+	pthread_mutex_unlock( &ks->lock );
+
+	return NULL;
+}
+
+
+rijn_keystream *rijn_keystream_create( rijn_context *ctx, uint8_t *counter,
+									   size_t capacity, int background )
+{
+	rijn_keystream *ks;
+	int error;
+
+	if ( ctx->blocklen <= 0 || capacity == 0 )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ks = (rijn_keystream *) calloc( 1, sizeof( *ks ) );
+	if ( ks == NULL )
+		return NULL;
+	ks->ctx = *ctx;
+	memcpy( ks->counter, counter, ctx->blocklen );
+	ks->cap = ( capacity + ctx->blocklen - 1 ) / ctx->blocklen * ctx->blocklen;
+	ks->ring = (uint8_t *) malloc( ks->cap );
+	if ( ks->ring == NULL )
+	{
+		free( ks );
+		return NULL;
+	}
+	pthread_mutex_init( &ks->lock, NULL );
+	pthread_cond_init( &ks->cond, NULL );
+
+	if ( background )
+	{
+		error = pthread_create( &ks->thread, NULL, rijn_keystream_thread, ks );
+		if ( error )
+		{
+			ks->background = 0;
+			rijn_keystream_destroy( ks );
+			errno = error;
+			return NULL;
+		}
+		ks->background = 1;
+	}
+
+	return ks;
+}
+
+
+int rijn_keystream_crypt( rijn_keystream *ks, uint8_t *input,
+						  uint8_t *output, size_t nbytes )
+{
+	uint8_t ctr[32], block[32], *ring;
+	uint64_t tail = ks->tail;
+	size_t i, n, ready, at, off, blocklen = ks->ctx.blocklen;
+
+	/* the XOR with what is ready, in up to two pieces around the ring */
+	ready = rijn_keystream_avail( ks, tail );
+	ready = ready < nbytes ? ready : nbytes;
+	at = (size_t) ( tail % ks->cap );
+	n = ks->cap - at < ready ? ks->cap - at : ready;
+	ring = ks->ring + at;
+	for ( i = 0; i < n; i++ )
+		output[i] = input[i] ^ ring[i];
+	for ( ring = ks->ring; i < ready; i++ )
+		output[i] = input[i] ^ ring[i - n];
+	n = ready;
+
+	/* the rest on demand, starting inside a block if need be */
+	if ( n < nbytes )
+	{
+		rijn_keystream_counter( ks, ( tail + n ) / blocklen, ctr );
+		off = (size_t) ( ( tail + n ) % blocklen );
+		if ( off )
+		{
+			memset( block, 0, blocklen );
+			rijn_ctr_crypt( &ks->ctx, ctr, block, block, blocklen );
+			for ( ; off < blocklen && n < nbytes; off++, n++ )
+				output[n] = input[n] ^ block[off];
+		}
+		rijn_ctr_crypt( &ks->ctx, ctr, input + n, output + n, nbytes - n );
+		__atomic_add_fetch( &ks->on_demand, nbytes - i, __ATOMIC_RELAXED );
+	}
+	__atomic_add_fetch( &ks->reserved, i, __ATOMIC_RELAXED );
+
+	__atomic_store_n( &ks->tail, tail + nbytes, __ATOMIC_SEQ_CST );
+	if ( __atomic_load_n( &ks->waiting, __ATOMIC_SEQ_CST ) &&
+		 rijn_keystream_avail( ks, tail + nbytes ) < ks->cap / 2 )
+	{
+		pthread_mutex_lock( &ks->lock );
+		pthread_cond_signal( &ks->cond );
+		pthread_mutex_unlock( &ks->lock );
+	}
+
+	return (0);
+}
+
+
+size_t rijn_keystream_refill( rijn_keystream *ks, size_t nbytes )
+{
+	size_t made = 0, n;
+
+	if ( ks->background )
+		return 0;
+	do
+	{
+		n = rijn_keystream_make( ks, nbytes == 0 || nbytes - made >
+								 RIJN_KEYSTREAM_BATCH ? RIJN_KEYSTREAM_BATCH
+													  : nbytes - made );
+		made += n;
+	} while ( n && ( nbytes == 0 || made < nbytes ) );
+
+	return made;
+}
+
+
+size_t rijn_keystream_ready( rijn_keystream *ks )
+{
+	return rijn_keystream_avail( ks, __atomic_load_n( &ks->tail,
+													  __ATOMIC_SEQ_CST ) );
+}
+
+
+void rijn_keystream_stats( rijn_keystream *ks, uint64_t *reserved,
+						   uint64_t *on_demand )
+{
+	*reserved = __atomic_load_n( &ks->reserved, __ATOMIC_RELAXED );
+	*on_demand = __atomic_load_n( &ks->on_demand, __ATOMIC_RELAXED );
+}
+
+
+void rijn_keystream_destroy( rijn_keystream *ks )
+{
+	if ( ks == NULL )
+		return;
+	if ( ks->background )
+	{
+		pthread_mutex_lock( &ks->lock );
+		ks->stop = 1;
+		pthread_cond_signal( &ks->cond );
+		pthread_mutex_unlock( &ks->lock );
+		pthread_join( ks->thread, NULL );
+	}
+	pthread_cond_destroy( &ks->cond );
+	pthread_mutex_destroy( &ks->lock );
+	memset( ks->ring, 0, ks->cap );
+	free( ks->ring );
+	memset( ks, 0, sizeof( *ks ) );
+	free( ks );
+}
@@ -0,0 +1,34 @@
+#ifndef RIJNDAEL_KEYSTREAM_H_
+#define RIJNDAEL_KEYSTREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rijn_keystream rijn_keystream;
+
+rijn_keystream *rijn_keystream_create( rijn_context *ctx, uint8_t *counter,
+									   size_t capacity, int background );
+
+int rijn_keystream_crypt( rijn_keystream *ks, uint8_t *input,
+						  uint8_t *output, size_t nbytes );
+
+size_t rijn_keystream_refill( rijn_keystream *ks, size_t nbytes );
+
+size_t rijn_keystream_ready( rijn_keystream *ks );
+
+void rijn_keystream_stats( rijn_keystream *ks, uint64_t *reserved,
+						   uint64_t *on_demand );
+
+void rijn_keystream_destroy( rijn_keystream *ks );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_KEYSTREAM_H_ */
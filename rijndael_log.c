@@ -0,0 +1,622 @@
+/*
+ *	Encrypted append-only log for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USING rijndael_log.c/rijndael_log.h:
+ *
+ * A log is a file of records appended by any number of threads.  Records
+ * are not encrypted one by one: a committer thread gathers whatever records
+ * are waiting into a group, encrypts the group as one chunk with
+ * rijn_eax_encrypt, writes it and makes it durable with one fdatasync.
+ * Each record costs 4 bytes of length in its chunk; each chunk costs 32
+ * bytes of header and nonce and a tag of nblockbits/8 bytes.
+ *
+ * rijn_log *rijn_log_open( rijn_context *ctx, const char *path,
+ *							size_t group_bytes );
+ *
+ * opens or creates the log at path for appending and returns it, or NULL
+ * with errno set.  ctx must have been set up by rijn_set_key; the log keeps
+ * its own copy.  A chunk left incomplete by a crash is cut off; any other
+ * damage to the chunk headers makes it fail with errno EBADMSG rather than
+ * drop the chunks after the damage.  A group
+ * stops taking records at about group_bytes (0 means 1 megabyte) of
+ * records until the one before it has been written.
+ *
+ * int rijn_log_append( rijn_log *log, const uint8_t *record, size_t len,
+ *						uint64_t *chunk );
+ *
+ * adds a record and returns 0 once it is on disk, storing the index of its
+ * chunk in *chunk if chunk is not NULL.  It returns 1 with errno set if the
+ * record's group could not be written; the log then fails every append.
+ *
+ * uint64_t rijn_log_commits( rijn_log *log );
+ *
+ * tells how many group commits, and so fdatasyncs, there have been.
+ *
+ * int rijn_log_close( rijn_log *log );
+ *
+ * waits for the committer to finish and closes the log.  It returns 1 with
+ * errno set if any commit failed.
+ *
+ * rijn_log_reader *rijn_log_reader_open( rijn_context *ctx,
+ *										  const char *path );
+ * uint64_t rijn_log_chunks( rijn_log_reader *reader );
+ * int rijn_log_seek( rijn_log_reader *reader, uint64_t chunk );
+ * int rijn_log_next( rijn_log_reader *reader, const uint8_t **record,
+ *					  size_t *len );
+ * void rijn_log_reader_close( rijn_log_reader *reader );
+ *
+ * read a log: rijn_log_reader_open indexes the chunks present when it is
+ * called, without decrypting them (failing with EBADMSG as rijn_log_open
+ * does), and rijn_log_chunks tells how many there are.  rijn_log_seek moves to the first record of a chunk and
+ * rijn_log_next returns the next record, reading on into later chunks; the
+ * record stays valid until the next call.  Both return 0 on success, and 1
+ * with errno EBADMSG if a chunk fails its tag, ERANGE if there is no such
+ * chunk, or another errno value.  rijn_log_next returns 1 with errno 0 at
+ * the end of the log.
+ *
+ * A chunk is the magic "RJL1", the 32-bit length of the encrypted records,
+ * the 64-bit chunk index (all big-endian), a random 16-byte nonce, the
+ * records and the tag.  The first 16 bytes are authenticated as the EAX
+ * header, so a chunk cannot be altered, moved to another index or removed
+ * from the middle of the log unnoticed.  Nothing records how many chunks
+ * there should be, though: whole chunks dropped from the end leave a
+ * shorter log that is still valid, so keep the count elsewhere if that
+ * matters.  The nonce is random rather than the index so that a chunk cut
+ * off by a crash and then rewritten does not reuse a nonce.
+ *
+ * Link with -lpthread.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rijndael.h"
+#include "rijndael_log.h"
+
+#define RIJN_LOG_HEAD	32			/* magic, length, index and nonce */
+#define RIJN_LOG_GROUP	( 1 << 20 )	/* default group_bytes */
+
+#if defined( _POSIX_SYNCHRONIZED_IO ) && _POSIX_SYNCHRONIZED_IO > 0
+	#define rijn_log_sync	fdatasync
+#else
+	#define rijn_log_sync	fsync
+#endif
+
+typedef struct
+{
+	uint8_t *data;			/* header, records, then room for the tag */
+	size_t len;				/* header and records */
+	size_t cap;
+} rijn_log_buf;
+
+struct rijn_log
+{
+	rijn_context ctx;
+	int fd;
+	int random;				/* /dev/urandom, for nonces */
+	size_t group_bytes;
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* the committer waits here */
+	pthread_cond_t done;	/* appenders wait here */
+	rijn_log_buf buf[2];
+	int fill;				/* buf[fill] takes records */
+	uint64_t next;			/* index of the chunk buf[fill] will be */
+	uint64_t durable;		/* chunks before this one are on disk */
+	uint64_t commits;
+	int error;				/* first errno from a commit */
+	uint64_t failed;		/* index of the chunk it failed */
+	int stop;
+	pthread_t thread;
+};
+
+struct rijn_log_reader
+{
+	rijn_context ctx;
+	int fd;
+	off_t *offset;			/* of each chunk */
+	uint64_t nchunks;
+	uint64_t cur;			/* the chunk rijn_log_next reads after this one */
+	uint8_t *data;			/* the decrypted chunk */
+	size_t cap;
+	size_t pos, end;		/* records left in data */
+};
+
+
+static void rijn_log_put32( uint8_t *p, uint32_t v )
+{
+	p[0] = (uint8_t) ( v >> 24 );
+	p[1] = (uint8_t) ( v >> 16 );
+	p[2] = (uint8_t) ( v >> 8 );
+	p[3] = (uint8_t) v;
+}
+
+
+static uint32_t rijn_log_get32( const uint8_t *p )
+{
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+		   (uint32_t) p[2] << 8 | p[3];
+}
+
+
+/* read or write exactly n bytes at off; returns 0, or 1 with errno set */
+static int rijn_log_io( int fd, uint8_t *data, size_t n, off_t off,
+						int write )
+{
+	ssize_t got;
+
+	while ( n > 0 )
+	{
+		got = write ? pwrite( fd, data, n, off ) : pread( fd, data, n, off );
+		if ( got < 0 && errno == EINTR )
+			continue;
+		if ( got <= 0 )
+		{
+			if ( got == 0 )
+				errno = EIO;
+			return 1;
+		}
+		data += got;
+		n -= got;
+		off += got;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Walk the chunk headers from the start of the file, recording each chunk's
+ * offset if offset is not NULL, up to a torn tail: a header, or a chunk its
+ * header describes, that runs past the end of the file.  Returns the offset
+ * where the complete chunks end, or -1 with errno set, EBADMSG if a header
+ * is not a chunk's or is out of sequence.
+ */
+static off_t rijn_log_scan( int fd, int blocklen, off_t **offset,
+							uint64_t *nchunks )
+{
+	uint8_t head[RIJN_LOG_HEAD];
+	struct stat st;
+	off_t off = 0, *grown;
+	uint64_t n = 0, cap = 0, i;
+	size_t len;
+
+	if ( fstat( fd, &st ) )
+		return -1;
+
+	while ( off + RIJN_LOG_HEAD <= st.st_size )
+	{
+		if ( rijn_log_io( fd, head, RIJN_LOG_HEAD, off, 0 ) )
+			return -1;
+		len = rijn_log_get32( head + 4 );
+		i = (uint64_t) rijn_log_get32( head + 8 ) << 32 |
+			rijn_log_get32( head + 12 );
+		if ( memcmp( head, "RJL1", 4 ) || i != n )
+		{
+			errno = EBADMSG;
+			return -1;
+		}
+		if ( st.st_size - off < (off_t) ( RIJN_LOG_HEAD + len + blocklen ) )
+			break;
+
+		if ( offset != NULL )
+		{
+			if ( n == cap )
+			{
+				cap = cap ? 2 * cap : 64;
+				grown = (off_t *) realloc( *offset, cap * sizeof( off_t ) );
+				if ( grown == NULL )
+					return -1;
+				*offset = grown;
+			}
+			( *offset )[n] = off;
+		}
+		off += RIJN_LOG_HEAD + len + blocklen;
+		n++;
+	}
+	*nchunks = n;
+
+	return off;
+}
+
+
+/* Seal buf as chunk index and make it durable.  Returns 0 or an errno. */
+static int rijn_log_commit( rijn_log *log, rijn_log_buf *buf, uint64_t index,
+							off_t *end )
+{
+	uint8_t *head = buf->data;
+	size_t n = buf->len - RIJN_LOG_HEAD;
+
+	memcpy( head, "RJL1", 4 );
+	rijn_log_put32( head + 4, (uint32_t) n );
+	rijn_log_put32( head + 8, (uint32_t) ( index >> 32 ) );
+	rijn_log_put32( head + 12, (uint32_t) index );
+	if ( read( log->random, head + 16, 16 ) != 16 )
+		return errno ? errno : EIO;
+	rijn_eax_encrypt( &log->ctx, head + 16, 16, head, 16,
+					  head + RIJN_LOG_HEAD, head + RIJN_LOG_HEAD, n,
+					  head + buf->len );
+
+	if ( rijn_log_io( log->fd, head, buf->len + log->ctx.blocklen, *end, 1 ) ||
+		 rijn_log_sync( log->fd ) )
+		return errno;
+	*end += buf->len + log->ctx.blocklen;
+
+	return 0;
+}
+
+
+static void *rijn_log_committer( void *arg )
+{
+	rijn_log *log = (rijn_log *) arg;
+	rijn_log_buf *buf;
+	uint64_t index;
+	off_t end;
+	int error;
+
+	end = lseek( log->fd, 0, SEEK_END );
+	pthread_mutex_lock( &log->lock );
+	for ( ;; )
+	{
+		buf = &log->buf[log->fill];
+		while ( buf->len == RIJN_LOG_HEAD && !log->stop )
+			pthread_cond_wait( &log->work, &log->lock );
+		if ( buf->len == RIJN_LOG_HEAD )
+			break;
+
+		/* appenders fill the other buffer while this one is written */
+		log->fill ^= 1;
+		index = log->next++;
+		error = log->error;
+		pthread_cond_broadcast( &log->done );
+		pthread_mutex_unlock( &log->lock );
+
+		/* after a failure the file may end in a partial chunk */
+		if ( !error )
+			error = rijn_log_commit( log, buf, index, &end );
+
+		pthread_mutex_lock( &log->lock );
+		buf->len = RIJN_LOG_HEAD;
+		if ( error && !log->error )
+		{
+			log->error = error;
+			log->failed = index;
+		}
+		log->durable = index + 1;
+		log->commits++;
+		pthread_cond_broadcast( &log->done );
+	}
+	pthread_mutex_unlock( &log->lock );
+
+	return NULL;
+}
+
+
+rijn_log *rijn_log_open( rijn_context *ctx, const char *path,
+						 size_t group_bytes )
+{
+	rijn_log *log;
+	uint64_t nchunks;
+	off_t end;
+	int i, error;
+
+	if ( ctx->blocklen <= 0 )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	log = (rijn_log *) calloc( 1, sizeof( *log ) );
+	if ( log == NULL )
+		return NULL;
+	log->ctx = *ctx;
+	log->group_bytes = group_bytes ? group_bytes : RIJN_LOG_GROUP;
+	log->random = -1;
+	log->fd = open( path, O_RDWR | O_CREAT, 0600 );
+	if ( log->fd < 0 )
+		goto fail;
+	log->random = open( "/dev/urandom", O_RDONLY );
+	if ( log->random < 0 )
+		goto fail;
+
+	/* cut off a chunk a crash left incomplete */
+	end = rijn_log_scan( log->fd, ctx->blocklen, NULL, &nchunks );
+	if ( end < 0 || ftruncate( log->fd, end ) )
+		goto fail;
+	log->next = log->durable = nchunks;
+
+	for ( i = 0; i < 2; i++ )
+	{
+		log->buf[i].cap = RIJN_LOG_HEAD + 4096 + 32;
+		log->buf[i].data = (uint8_t *) malloc( log->buf[i].cap );
+		log->buf[i].len = RIJN_LOG_HEAD;
+		if ( log->buf[i].data == NULL )
+			goto fail;
+	}
+
+	pthread_mutex_init( &log->lock, NULL );
+	pthread_cond_init( &log->work, NULL );
+	pthread_cond_init( &log->done, NULL );
+	error = pthread_create( &log->thread, NULL, rijn_log_committer, log );
+	if ( error == 0 )
+		return log;
+
+	pthread_cond_destroy( &log->done );
+	pthread_cond_destroy( &log->work );
+	pthread_mutex_destroy( &log->lock );
+	errno = error;
+
+fail:
+	error = errno;
+	free( log->buf[0].data );
+	free( log->buf[1].data );
+	if ( log->random >= 0 )
+		close( log->random );
+	if ( log->fd >= 0 )
+		close( log->fd );
+	free( log );
+	errno = error;
+	return NULL;
+}
+
+
+int rijn_log_append( rijn_log *log, const uint8_t *record, size_t len,
+					 uint64_t *chunk )
+{
+	rijn_log_buf *buf;
+	uint64_t mine;
+	size_t need;
+	uint8_t *grown;
+	int error;
+
+	pthread_mutex_lock( &log->lock );
+
+	/* wait for room unless the group is empty */
+	for ( ;; )
+	{
+		buf = &log->buf[log->fill];
+		if ( log->error || buf->len == RIJN_LOG_HEAD ||
+			 buf->len + 4 + len <= RIJN_LOG_HEAD + log->group_bytes )
+			break;
+		pthread_cond_wait( &log->done, &log->lock );
+	}
+
+	error = log->error;
+	need = buf->len + 4 + len;
+	if ( !error && need - RIJN_LOG_HEAD > UINT32_MAX )
+		error = EINVAL;
+	if ( !error && need + 32 > buf->cap )
+	{
+		grown = (uint8_t *) realloc( buf->data, 2 * need + 32 );
+		if ( grown == NULL )
+			error = ENOMEM;
+		else
+		{
+			buf->data = grown;
+			buf->cap = 2 * need + 32;
+		}
+	}
+	if ( error )
+	{
+		pthread_mutex_unlock( &log->lock );
+		errno = error;
+		return (1);
+	}
+
+	rijn_log_put32( buf->data + buf->len, (uint32_t) len );
+	memcpy( buf->data + buf->len + 4, record, len );
+	buf->len = need;
+	mine = log->next;
+	pthread_cond_signal( &log->work );
+
+	while ( log->durable <= mine )
+		pthread_cond_wait( &log->done, &log->lock );
+	error = log->error && mine >= log->failed ? log->error : 0;
+	pthread_mutex_unlock( &log->lock );
+
+	if ( error )
+	{
+		errno = error;
+		return (1);
+	}
+	if ( chunk != NULL )
+		*chunk = mine;
+
+	return (0);
+}
+
+
+uint64_t rijn_log_commits( rijn_log *log )
+{
+	uint64_t commits;
+
+	pthread_mutex_lock( &log->lock );
+	commits = log->commits;
+	pthread_mutex_unlock( &log->lock );
+
+	return commits;
+}
+
+
+int rijn_log_close( rijn_log *log )
+{
+	int error;
+
+	pthread_mutex_lock( &log->lock );
+	log->stop = 1;
+	pthread_cond_signal( &log->work );
+	pthread_mutex_unlock( &log->lock );
+	pthread_join( log->thread, NULL );
+
+	error = log->error;
+	pthread_cond_destroy( &log->done );
+	pthread_cond_destroy( &log->work );
+	pthread_mutex_destroy( &log->lock );
+	if ( close( log->fd ) && !error )
+		error = errno;
+	close( log->random );
+	free( log->buf[0].data );
+	free( log->buf[1].data );
+	memset( &log->ctx, 0, sizeof( log->ctx ) );
+	free( log );
+
+	if ( error )
+	{
+		errno = error;
+		return (1);
+	}
+
+	return (0);
+}
+
+
+rijn_log_reader *rijn_log_reader_open( rijn_context *ctx, const char *path )
+{
+	rijn_log_reader *reader;
+	int error;
+
+	if ( ctx->blocklen <= 0 )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	reader = (rijn_log_reader *) calloc( 1, sizeof( *reader ) );
+	if ( reader == NULL )
+		return NULL;
+	reader->ctx = *ctx;
+	reader->fd = open( path, O_RDONLY );
+	if ( reader->fd >= 0 &&
+		 rijn_log_scan( reader->fd, ctx->blocklen, &reader->offset,
+						&reader->nchunks ) >= 0 )
+		return reader;
+
+	error = errno;
+	if ( reader->fd >= 0 )
+		close( reader->fd );
+	free( reader->offset );
+	free( reader );
+	errno = error;
+	return NULL;
+}
+
+
+uint64_t rijn_log_chunks( rijn_log_reader *reader )
+{
+	return reader->nchunks;
+}
+
+
+int rijn_log_seek( rijn_log_reader *reader, uint64_t chunk )
+{
+	size_t len, size;
+	uint8_t *data;
+
+	reader->pos = reader->end = 0;
+	if ( chunk > reader->nchunks )
+	{
+		errno = ERANGE;
+		return (1);
+	}
+	reader->cur = chunk;
+	if ( chunk == reader->nchunks )
+		return (0);
+
+	/* the scan checked that the whole chunk is there */
+	data = reader->data;
+	if ( reader->cap < RIJN_LOG_HEAD )
+	{
+		data = (uint8_t *) realloc( reader->data, 4096 );
+		if ( data == NULL )
+			return (1);
+		reader->data = data;
+		reader->cap = 4096;
+	}
+	if ( rijn_log_io( reader->fd, data, RIJN_LOG_HEAD,
+					  reader->offset[chunk], 0 ) )
+		return (1);
+	len = rijn_log_get32( data + 4 );
+	size = RIJN_LOG_HEAD + len + reader->ctx.blocklen;
+	if ( size > reader->cap )
+	{
+		data = (uint8_t *) realloc( reader->data, size );
+		if ( data == NULL )
+			return (1);
+		reader->data = data;
+		reader->cap = size;
+	}
+	if ( rijn_log_io( reader->fd, data, size, reader->offset[chunk], 0 ) ||
+		 rijn_eax_decrypt( &reader->ctx, data + 16, 16, data, 16,
+						   data + RIJN_LOG_HEAD, data + RIJN_LOG_HEAD, len,
+						   data + RIJN_LOG_HEAD + len ) )
+		return (1);
+
+	reader->pos = RIJN_LOG_HEAD;
+	reader->end = RIJN_LOG_HEAD + len;
+	reader->cur = chunk + 1;
+
+	return (0);
+}
+
+
+int rijn_log_next( rijn_log_reader *reader, const uint8_t **record,
+				   size_t *len )
+{
+	size_t n;
+
+	while ( reader->pos == reader->end )
+	{
+		if ( reader->cur >= reader->nchunks )
+		{
+			errno = 0;
+			return (1);
+		}
+		if ( rijn_log_seek( reader, reader->cur ) )
+			return (1);
+	}
+
+	n = reader->end - reader->pos < 4 ? (size_t) -1
+		: rijn_log_get32( reader->data + reader->pos );
+	if ( n > reader->end - reader->pos - 4 )
+	{
+		errno = EBADMSG;	/* authentic, so written by something else */
+		return (1);
+	}
+	*record = reader->data + reader->pos + 4;
+	*len = n;
+	reader->pos += 4 + n;
+
+	return (0);
+}
+
+
+void rijn_log_reader_close( rijn_log_reader *reader )
+{
+	if ( reader == NULL )
+		return;
+	close( reader->fd );
+	free( reader->offset );
+	free( reader->data );
+	memset( &reader->ctx, 0, sizeof( reader->ctx ) );
+	free( reader );
+}
@@ -0,0 +1,41 @@
+#ifndef RIJNDAEL_LOG_H_
+#define RIJNDAEL_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rijn_log rijn_log;
+typedef struct rijn_log_reader rijn_log_reader;
+
+rijn_log *rijn_log_open( rijn_context *ctx, const char *path,
+						 size_t group_bytes );
+
+int rijn_log_append( rijn_log *log, const uint8_t *record, size_t len,
+					 uint64_t *chunk );
+
+uint64_t rijn_log_commits( rijn_log *log );
+
+int rijn_log_close( rijn_log *log );
+
+rijn_log_reader *rijn_log_reader_open( rijn_context *ctx, const char *path );
+
+uint64_t rijn_log_chunks( rijn_log_reader *reader );
+
+int rijn_log_seek( rijn_log_reader *reader, uint64_t chunk );
+
+int rijn_log_next( rijn_log_reader *reader, const uint8_t **record,
+				   size_t *len );
+
+void rijn_log_reader_close( rijn_log_reader *reader );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_LOG_H_ */
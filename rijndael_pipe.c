@@ -0,0 +1,629 @@
+/*
+ *	Pipelined file descriptor encryption for the Rijndael Cipher functions in
+ *	rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USING rijndael_pipe.c/rijndael_pipe.h:
+ *
+ * int rijn_cbc_pipe( rijn_context *ctx, uint8_t *iv, int infd, int outfd,
+ *					  int flags, size_t bufsize, int nbufs );
+ *
+ * reads infd to end of file, CBC encrypts (flags RIJN_PIPE_ENCRYPT) or
+ * decrypts (RIJN_PIPE_DECRYPT) what it reads with ctx and iv, and writes
+ * the result to outfd.  infd and outfd may be pipes, sockets or files.
+ * With RIJN_PIPE_PAD, encryption adds PKCS #7 padding and decryption checks
+ * and removes it; without it the input length must be a multiple of the
+ * block length.  Like rijn_cbc_encrypt, it leaves iv set to continue the
+ * stream.  Returns 0 on success or 1 with errno set on a read, write or
+ * padding error.
+ *
+ * Reading, encryption and writing run at the same time on three threads,
+ * connected by lock-free single-producer/single-consumer rings that pass
+ * nbufs buffers of about bufsize bytes (0 for defaults of RIJN_PIPE_NBUFS
+ * and RIJN_PIPE_BUFSIZE) round from reader to cipher to writer and back.
+ * With RIJN_PIPE_PIN each thread is pinned to its own CPU from the
+ * caller's affinity mask.
+ *
+ * int rijn_cbc_splice( rijn_context *ctx, uint8_t *iv, int infd, int outfd,
+ *						int flags, size_t chunk );
+ *
+ * does the same as rijn_cbc_pipe on one thread, for Linux, without copying
+ * the output: each chunk (about chunk bytes, 0 for RIJN_SPLICE_CHUNK) is
+ * read into fresh anonymous pages, encrypted or decrypted in place, gifted
+ * to a pipe with vmsplice and spliced from there to outfd, or vmspliced
+ * straight into outfd if it is a pipe.  The pages are then unmapped rather
+ * than reused, because the kernel may still be sending from them.  outfd
+ * must accept splice, as pipes, sockets, regular files and /dev/null do.
+ * Elsewhere it fails with ENOSYS.  RIJN_PIPE_PIN is ignored.
+ *
+ * Link with -lpthread.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE			/* for CPU affinity */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/uio.h>
+#endif
+
+#include "rijndael.h"
+#include "rijndael_pipe.h"
+
+#define RIJN_PIPE_BUFSIZE	( 256 * 1024 )
+#define RIJN_PIPE_NBUFS		8
+#define RIJN_PIPE_ALIGN		4096	/* buffers start on a page */
+#define RIJN_PIPE_SPINS		64		/* polls of an empty ring before yielding */
+#define RIJN_SPLICE_CHUNK	( 64 * 1024 )	/* the default pipe capacity */
+
+typedef struct
+{
+	uint8_t *data;
+	size_t len;
+	int last;				/* nothing follows this buffer */
+} rijn_pipe_buf;
+
+/* A single-producer/single-consumer ring, its indexes on separate lines. */
+typedef struct
+{
+	unsigned head;			/* written only by the producer */
+	char pad0[64 - sizeof( unsigned )];
+	unsigned tail;			/* written only by the consumer */
+	char pad1[64 - sizeof( unsigned )];
+	unsigned mask;
+	rijn_pipe_buf **slot;
+} rijn_ring;
+
+typedef struct
+{
+	rijn_context *ctx;
+	uint8_t *iv;
+	int infd, outfd, flags;
+	size_t cap;				/* bytes read per buffer, whole blocks */
+	rijn_ring empty;		/* writer to reader */
+	rijn_ring filled;		/* reader to cipher */
+	rijn_ring ciphered;		/* cipher to writer */
+	int error;				/* first errno from any stage */
+	int cpu[3];				/* CPU per stage with RIJN_PIPE_PIN */
+} rijn_pipe;
+
+
+/* Record the first error; the other stages see it and stop. */
+static void rijn_pipe_fail( rijn_pipe *p, int error )
+{
+	int none = 0;
+
+	__atomic_compare_exchange_n( &p->error, &none, error ? error : EIO, 0,
+								 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+
+/* Pass a buffer on.  The rings hold every buffer, so this never waits. */
+static void rijn_ring_put( rijn_ring *r, rijn_pipe_buf *b )
+{
+	unsigned head = r->head;
+
+	r->slot[head & r->mask] = b;
+	__atomic_store_n( &r->head, head + 1, __ATOMIC_RELEASE );
+}
+
+
+/* Take the next buffer, or NULL once another stage has failed. */
+static rijn_pipe_buf *rijn_ring_get( rijn_pipe *p, rijn_ring *r )
+{
+	unsigned tail = r->tail;
+	rijn_pipe_buf *b;
+	int spins = 0;
+
+	while ( __atomic_load_n( &r->head, __ATOMIC_ACQUIRE ) == tail )
+	{
+		if ( __atomic_load_n( &p->error, __ATOMIC_RELAXED ) )
+			return NULL;
+		if ( ++spins > RIJN_PIPE_SPINS )
+			sched_yield();
+	}
+	b = r->slot[tail & r->mask];
+	__atomic_store_n( &r->tail, tail + 1, __ATOMIC_RELEASE );
+
+	return b;
+}
+
+
+static void rijn_pipe_pin( rijn_pipe *p, int stage )
+{
+#ifdef __linux__
+	cpu_set_t set;
+
+	if ( p->flags & RIJN_PIPE_PIN )
+	{
+		CPU_ZERO( &set );
+		CPU_SET( p->cpu[stage], &set );
+		pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+	}
+#else
+	(void) p;
+	(void) stage;
+#endif
+}
+
+
+/* Read until b is full or at end of file.  Returns 1 on a read error. */
+static int rijn_pipe_fill( rijn_pipe *p, rijn_pipe_buf *b )
+{
+	ssize_t n;
+
+	for ( b->len = 0; b->len < p->cap; b->len += n )
+	{
+		n = read( p->infd, b->data + b->len, p->cap - b->len );
+		if ( n == 0 )
+			break;
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				n = 0;
+				continue;
+			}
+			rijn_pipe_fail( p, errno );
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Read stage.  It reads one buffer ahead so that it can mark the last
+ * buffer holding data, which the cipher stage needs for the padding.
+ */
+static void *rijn_pipe_reader( void *arg )
+{
+	rijn_pipe *p = (rijn_pipe *) arg;
+	rijn_pipe_buf *cur, *next;
+
+	rijn_pipe_pin( p, 0 );
+	cur = rijn_ring_get( p, &p->empty );
+	if ( cur == NULL || rijn_pipe_fill( p, cur ) )
+		return NULL;
+
+	for ( ;; )
+	{
+		cur->last = 1;
+		if ( cur->len < p->cap )
+			break;
+		next = rijn_ring_get( p, &p->empty );
+		if ( next == NULL || rijn_pipe_fill( p, next ) )
+			return NULL;
+		if ( next->len == 0 )
+			break;
+		cur->last = 0;
+		rijn_ring_put( &p->filled, cur );
+		cur = next;
+	}
+	rijn_ring_put( &p->filled, cur );
+
+	return NULL;
+}
+
+
+/*
+ * Encrypt or decrypt *len bytes at data in place, adding or removing the
+ * padding if last and flags has RIJN_PIPE_PAD.  data must have room for a
+ * block more.  Returns 0 or an errno value.
+ */
+static int rijn_pipe_crypt( rijn_context *ctx, uint8_t *iv, int flags,
+							uint8_t *data, size_t *len, int last )
+{
+	int decrypt = flags & RIJN_PIPE_DECRYPT;
+	int pad = last && ( flags & RIJN_PIPE_PAD );
+	size_t blocklen = ctx->blocklen, n = *len, i;
+	uint8_t fill;
+	int status;
+
+	if ( pad && !decrypt )
+	{
+		fill = (uint8_t) ( blocklen - n % blocklen );
+		memset( data + n, fill, fill );
+		n += fill;
+	}
+	if ( n % blocklen || ( pad && decrypt && n == 0 ) )
+		return EINVAL;
+
+	if ( decrypt )
+		status = rijn_cbc_decrypt( ctx, iv, data, data, n );
+	else
+		status = rijn_cbc_encrypt( ctx, iv, data, data, n );
+	if ( status )
+		return errno;
+
+	if ( pad && decrypt )
+	{
+		fill = data[n - 1];
+		for ( i = 1; i <= fill && fill <= blocklen; i++ )
+			if ( data[n - i] != fill )
+				break;
+		if ( fill == 0 || fill > blocklen || i <= fill )
+			return EINVAL;
+		n -= fill;
+	}
+	*len = n;
+
+	return 0;
+}
+
+
+/* Cipher stage. */
+static void *rijn_pipe_cipher( void *arg )
+{
+	rijn_pipe *p = (rijn_pipe *) arg;
+	rijn_pipe_buf *b;
+	int error, last;
+
+	rijn_pipe_pin( p, 1 );
+	do
+	{
+		b = rijn_ring_get( p, &p->filled );
+		if ( b == NULL )
+			return NULL;
+		last = b->last;		/* b is not ours once passed on */
+		error = rijn_pipe_crypt( p->ctx, p->iv, p->flags, b->data, &b->len,
+								 last );
+		if ( error )
+		{
+			rijn_pipe_fail( p, error );
+			return NULL;
+		}
+		rijn_ring_put( &p->ciphered, b );
+	} while ( !last );
+
+	return NULL;
+}
+
+
+/* Write stage. */
+static void *rijn_pipe_writer( void *arg )
+{
+	rijn_pipe *p = (rijn_pipe *) arg;
+	rijn_pipe_buf *b;
+	size_t off;
+	ssize_t n;
+	int last;
+
+	rijn_pipe_pin( p, 2 );
+	do
+	{
+		b = rijn_ring_get( p, &p->ciphered );
+		if ( b == NULL )
+			return NULL;
+		last = b->last;
+		for ( off = 0; off < b->len; off += n )
+		{
+			n = write( p->outfd, b->data + off, b->len - off );
+			if ( n < 0 )
+			{
+				if ( errno == EINTR )
+				{
+					n = 0;
+					continue;
+				}
+				rijn_pipe_fail( p, errno );
+				return NULL;
+			}
+		}
+		rijn_ring_put( &p->empty, b );
+	} while ( !last );
+
+	return NULL;
+}
+
+
+/* Choose a CPU for each stage from the caller's affinity mask. */
+static void rijn_pipe_cpus( rijn_pipe *p )
+{
+#ifdef __linux__
+	cpu_set_t set;
+	int cpu, stage = 0;
+
+	p->cpu[0] = p->cpu[1] = p->cpu[2] = 0;
+	if ( sched_getaffinity( 0, sizeof( set ), &set ) )
+	{
+		p->flags &= ~RIJN_PIPE_PIN;
+		return;
+	}
+	for ( cpu = 0; cpu < CPU_SETSIZE && stage < 3; cpu++ )
+		if ( CPU_ISSET( cpu, &set ) )
+			p->cpu[stage++] = cpu;
+	for ( ; stage < 3 && stage > 0; stage++ )
+		p->cpu[stage] = p->cpu[stage - 1];
+#else
+	p->flags &= ~RIJN_PIPE_PIN;
+#endif
+}
+
+
+/* See the comments at the top of this file. */
+int rijn_cbc_pipe( rijn_context *ctx, uint8_t *iv, int infd, int outfd,
+				   int flags, size_t bufsize, int nbufs )
+{
+	static void *( *const stage[3] )( void * ) =
+		{ rijn_pipe_reader, rijn_pipe_cipher, rijn_pipe_writer };
+	rijn_pipe p;
+	rijn_pipe_buf *buf = NULL;
+	pthread_t thread[3];
+	unsigned size;
+	int i, nthreads = 0, error = 0;
+
+	if ( ctx->blocklen <= 0 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+	if ( bufsize == 0 )
+		bufsize = RIJN_PIPE_BUFSIZE;
+	if ( nbufs <= 0 )
+		nbufs = RIJN_PIPE_NBUFS;
+	if ( nbufs < 3 )
+		nbufs = 3;			/* the reader holds two */
+
+	memset( &p, 0, sizeof( p ) );
+	p.ctx = ctx;
+	p.iv = iv;
+	p.infd = infd;
+	p.outfd = outfd;
+	p.flags = flags;
+	p.cap = bufsize / ctx->blocklen * ctx->blocklen;
+	if ( p.cap == 0 )
+		p.cap = ctx->blocklen;
+	if ( flags & RIJN_PIPE_PIN )
+		rijn_pipe_cpus( &p );
+
+	for ( size = 1; size < (unsigned) nbufs; size <<= 1 )
+		;
+	p.empty.mask = p.filled.mask = p.ciphered.mask = size - 1;
+	p.empty.slot = (rijn_pipe_buf **) calloc( size, sizeof( *p.empty.slot ) );
+	p.filled.slot = (rijn_pipe_buf **) calloc( size, sizeof( *p.empty.slot ) );
+	p.ciphered.slot = (rijn_pipe_buf **) calloc( size,
+												 sizeof( *p.empty.slot ) );
+	buf = (rijn_pipe_buf *) calloc( nbufs, sizeof( *buf ) );
+	if ( !p.empty.slot || !p.filled.slot || !p.ciphered.slot || !buf )
+		error = ENOMEM;
+
+	/* room for a block of padding after the data */
+	for ( i = 0; i < nbufs && !error; i++ )
+	{
+		if ( posix_memalign( (void **) &buf[i].data, RIJN_PIPE_ALIGN,
+							 p.cap + 32 ) )
+			error = ENOMEM;
+		else
+			rijn_ring_put( &p.empty, &buf[i] );
+	}
+
+	for ( i = 0; i < 3 && !error; i++ )
+	{
+		error = pthread_create( &thread[i], NULL, stage[i], &p );
+		if ( error )
+			rijn_pipe_fail( &p, error );
+		else
+			nthreads++;
+	}
+	for ( i = 0; i < nthreads; i++ )
+		pthread_join( thread[i], NULL );
+	if ( !error )
+		error = p.error;
+
+	for ( i = 0; buf && i < nbufs; i++ )
+		free( buf[i].data );
+	free( buf );
+	free( p.ciphered.slot );
+	free( p.filled.slot );
+	free( p.empty.slot );
+
+	if ( error )
+	{
+		errno = error;
+		return (1);
+	}
+
+	return (0);
+}
+
+
+#ifdef __linux__
+
+/*
+ * Map a chunk of size bytes and read up to cap bytes into it, setting *len
+ * (0 at end of file).  Returns NULL with errno set on error.
+ */
+static uint8_t *rijn_splice_read( int fd, size_t size, size_t cap,
+								  size_t *len )
+{
+	uint8_t *chunk;
+	ssize_t n;
+
+	chunk = (uint8_t *) mmap( NULL, size, PROT_READ | PROT_WRITE,
+							  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if ( chunk == MAP_FAILED )
+		return NULL;
+
+	for ( *len = 0; *len < cap; *len += n )
+	{
+		n = read( fd, chunk + *len, cap - *len );
+		if ( n == 0 )
+			break;
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				n = 0;
+				continue;
+			}
+			n = errno;
+			munmap( chunk, size );
+			errno = (int) n;
+			return NULL;
+		}
+	}
+
+	return chunk;
+}
+
+
+/*
+ * Gift len bytes of chunk to pipefd[1] and splice them on to outfd, or
+ * vmsplice them straight to outfd if pipefd is NULL.  Returns 0 or an errno
+ * value.
+ */
+static int rijn_splice_write( uint8_t *chunk, size_t len, int outfd,
+							  int *pipefd )
+{
+	struct iovec iov;
+	ssize_t n, m, k;
+	size_t off;
+
+	for ( off = 0; off < len; off += n )
+	{
+		iov.iov_base = chunk + off;
+		iov.iov_len = len - off;
+		n = vmsplice( pipefd ? pipefd[1] : outfd, &iov, 1, SPLICE_F_GIFT );
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				n = 0;
+				continue;
+			}
+			return errno;
+		}
+		for ( m = n; pipefd && m > 0; m -= k )
+		{
+			k = splice( pipefd[0], NULL, outfd, NULL, m,
+						SPLICE_F_MOVE | SPLICE_F_MORE );
+			if ( k < 0 && errno == EINTR )
+				k = 0;
+			else if ( k <= 0 )
+				return k ? errno : EIO;
+		}
+	}
+
+	return 0;
+}
+
+#endif /* __linux__ */
+
+
+/* See the comments at the top of this file. */
+int rijn_cbc_splice( rijn_context *ctx, uint8_t *iv, int infd, int outfd,
+					 int flags, size_t chunk )
+{
+#ifdef __linux__
+	uint8_t *cur, *next = NULL;
+	size_t page, size, cap, len, nextlen = 0;
+	int pipefd[2], *through = NULL, last, error = 0;
+	struct stat st;
+
+	if ( ctx->blocklen <= 0 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	page = (size_t) sysconf( _SC_PAGESIZE );
+	if ( chunk == 0 )
+		chunk = RIJN_SPLICE_CHUNK;
+	size = ( chunk + 32 + page - 1 ) / page * page;
+	cap = ( size - 32 ) / ctx->blocklen * ctx->blocklen;
+
+	if ( fstat( outfd, &st ) )
+		return (1);
+	if ( !S_ISFIFO( st.st_mode ) )
+	{
+		if ( pipe( pipefd ) )
+			return (1);
+		fcntl( pipefd[1], F_SETPIPE_SZ, (int) size );
+		through = pipefd;
+	}
+
+	/* read a chunk ahead so that the last one is known for the padding */
+	cur = rijn_splice_read( infd, size, cap, &len );
+	if ( cur == NULL )
+		error = errno;
+	while ( !error )
+	{
+		last = len < cap;
+		if ( !last )
+		{
+			next = rijn_splice_read( infd, size, cap, &nextlen );
+			if ( next == NULL )
+			{
+				error = errno;
+				break;
+			}
+			if ( nextlen == 0 )
+			{
+				munmap( next, size );
+				next = NULL;
+				last = 1;
+			}
+		}
+
+		error = rijn_pipe_crypt( ctx, iv, flags, cur, &len, last );
+		if ( !error )
+			error = rijn_splice_write( cur, len, outfd, through );
+		munmap( cur, size );
+		cur = next;
+		len = nextlen;
+		next = NULL;
+		if ( last )
+			break;
+	}
+	if ( error && cur )
+		munmap( cur, size );
+
+	if ( through )
+	{
+		close( pipefd[0] );
+		close( pipefd[1] );
+	}
+	if ( error )
+	{
+		errno = error;
+		return (1);
+	}
+
+	return (0);
+#else
+	(void) ctx;
+	(void) iv;
+	(void) infd;
+	(void) outfd;
+	(void) flags;
+	(void) chunk;
+	errno = ENOSYS;
+	return (1);
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef RIJNDAEL_PIPE_H_
+#define RIJNDAEL_PIPE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* rijn_cbc_pipe flags */
+#define RIJN_PIPE_ENCRYPT	0
+#define RIJN_PIPE_DECRYPT	1
+#define RIJN_PIPE_PAD		2	/* add or remove PKCS #7 padding */
+#define RIJN_PIPE_PIN		4	/* pin each stage to its own CPU */
+
+int rijn_cbc_pipe( rijn_context *ctx, uint8_t *iv, int infd, int outfd,
+				   int flags, size_t bufsize, int nbufs );
+
+int rijn_cbc_splice( rijn_context *ctx, uint8_t *iv, int infd, int outfd,
+					 int flags, size_t chunk );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_PIPE_H_ */
@@ -0,0 +1,256 @@
+/*
+ *	PMAC for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * USING rijndael_pmac.c/rijndael_pmac.h:
+ *
+ * PMAC (PMAC1, Rogaway) is a message authentication code like CMAC, but
+ * each block is encrypted independently of the others, under an offset
+ * that depends only on its position.  So blocks can go through the bulk
+ * ECB kernels many at a time, and a large object can be split among
+ * threads whose partial sums combine into one tag by XOR.  For 128-bit
+ * blocks it is PMAC1 with AES; other block sizes use the same fields as
+ * rijn_cmac.
+ *
+ * int rijn_pmac_init( rijn_pmac_key *pk, rijn_context *ctx );
+ *
+ * prepares pk from a context set with rijn_set_key, which is copied: it
+ * holds the table of offsets L * x^i for every bit of a block index.
+ * Returns 0, or 1 with errno EINVAL if ctx has no key.
+ *
+ * int rijn_pmac( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+ *				  uint8_t *mac );
+ *
+ * writes the nblockbits/8-byte PMAC of nbytes of input, of any length, to
+ * mac, and returns 0.
+ *
+ * int rijn_pmac_parallel( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+ *						   uint8_t *mac, int nthreads );
+ *
+ * does the same with the input split among nthreads threads.
+ *
+ * int rijn_pmac_sum( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+ *					  uint64_t block, uint8_t *sum );
+ * int rijn_pmac_final( rijn_pmac_key *pk, uint8_t *sum, uint8_t *last,
+ *						size_t lastlen, uint8_t *mac );
+ *
+ * are the combinable form.  rijn_pmac_sum XORs into sum (nblockbits/8
+ * bytes, zeroed to start) the contribution of whole blocks input, the
+ * first of which is block number block of the message, counting from 0;
+ * nbytes must be a multiple of the block length.  Chunks may be summed in
+ * any order, on any thread, into sums that are then XORed together.
+ * rijn_pmac_final then takes the message's last block, lastlen bytes from
+ * 0 (for an empty message) to the block length, which must not have been
+ * summed, and writes the tag to mac.  They return 0, or 1 with errno EINVAL
+ * on an invalid length.  Link with -lpthread.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rijndael.h"
+#include "rijndael_pmac.h"
+
+#define RIJN_PMAC_BATCH		64		/* blocks per bulk encryption */
+#define RIJN_PMAC_THREADS	64		/* most ranges in parallel */
+#define RIJN_PMAC_MIN		65536	/* fewest bytes worth a thread */
+
+typedef struct
+{
+	rijn_pmac_key *pk;
+	uint8_t *input;
+	size_t nbytes;
+	uint64_t block;
+	uint8_t sum[32];
+} rijn_pmac_range;
+
+
+int rijn_pmac_init( rijn_pmac_key *pk, rijn_context *ctx )
+{
+	int i, blocklen = ctx->blocklen;
+
+	if ( blocklen <= 0 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	pk->ctx = *ctx;
+	memset( pk->L[0], 0, sizeof( pk->L[0] ) );
+	rijn_encrypt( ctx, pk->L[0], pk->L[0] );
+	for ( i = 1; i < RIJN_PMAC_OFFSETS; i++ )
+	{
+		memcpy( pk->L[i], pk->L[i - 1], sizeof( pk->L[i] ) );
+		rijn_cmac_double( pk->L[i], blocklen );
+	}
+	memcpy( pk->Linv, pk->L[0], sizeof( pk->Linv ) );
+	rijn_cmac_halve( pk->Linv, blocklen );
+
+	return (0);
+}
+
+
+int rijn_pmac_sum( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+				   uint64_t block, uint8_t *sum )
+{
+	uint8_t batch[RIJN_PMAC_BATCH * 32], offset[32];
+	uint64_t index = block + 1, gray;
+	int blocklen = pk->ctx.blocklen, i, j;
+	size_t k, n, step;
+
+	if ( nbytes % blocklen )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+	if ( nbytes == 0 )
+		return (0);
+
+	/* the offset for block index - 1 is L times its Gray code */
+	memset( offset, 0, sizeof( offset ) );
+	for ( gray = block ^ ( block >> 1 ), i = 0; gray; gray >>= 1, i++ )
+		if ( gray & 1 )
+			for ( j = 0; j < blocklen; j++ )
+				offset[j] ^= pk->L[i][j];
+
+	for ( k = 0; k < nbytes; k += step )
+	{
+		step = nbytes - k;
+		if ( step > ( size_t )RIJN_PMAC_BATCH * blocklen )
+			step = ( size_t )RIJN_PMAC_BATCH * blocklen;
+
+		/* each offset differs from the last by L * x^ntz(index) */
+		for ( n = 0; n < step; n += blocklen, index++ )
+		{
+			const uint8_t *l = pk->L[__builtin_ctzll( index )];
+
+			for ( j = 0; j < blocklen; j++ )
+			{
+				offset[j] ^= l[j];
+				batch[n + j] = input[k + n + j] ^ offset[j];
+			}
+		}
+		rijn_ecb_encrypt( &pk->ctx, batch, batch, step );
+		for ( n = 0; n < step; n += blocklen )
+			for ( j = 0; j < blocklen; j++ )
+				sum[j] ^= batch[n + j];
+	}
+
+	return (0);
+}
+
+
+int rijn_pmac_final( rijn_pmac_key *pk, uint8_t *sum, uint8_t *last,
+					 size_t lastlen, uint8_t *mac )
+{
+	int blocklen = pk->ctx.blocklen, j;
+
+	if ( lastlen > ( size_t )blocklen )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	memcpy( mac, sum, blocklen );
+	if ( lastlen == ( size_t )blocklen )
+		for ( j = 0; j < blocklen; j++ )
+			mac[j] ^= last[j] ^ pk->Linv[j];
+	else
+	{
+		for ( j = 0; j < ( int )lastlen; j++ )
+			mac[j] ^= last[j];
+		mac[lastlen] ^= 0x80;
+	}
+	rijn_encrypt( &pk->ctx, mac, mac );
+
+	return (0);
+}
+
+
+int rijn_pmac( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+			   uint8_t *mac )
+{
+	uint8_t sum[32];
+	size_t blocklen = pk->ctx.blocklen;
+	size_t head = nbytes ? ( nbytes - 1 ) / blocklen * blocklen : 0;
+
+	memset( sum, 0, sizeof( sum ) );
+	rijn_pmac_sum( pk, input, head, 0, sum );
+
+	return( rijn_pmac_final( pk, sum, input + head, nbytes - head, mac ) );
+}
+
+
+static void *rijn_pmac_thread( void *arg )
+{
+	rijn_pmac_range *r = ( rijn_pmac_range * )arg;
+
+	rijn_pmac_sum( r->pk, r->input, r->nbytes, r->block, r->sum );
+
+	return NULL;
+}
+
+
+int rijn_pmac_parallel( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+						uint8_t *mac, int nthreads )
+{
+	rijn_pmac_range range[RIJN_PMAC_THREADS];
+	pthread_t thread[RIJN_PMAC_THREADS];
+	int started[RIJN_PMAC_THREADS];
+	size_t blocklen = pk->ctx.blocklen;
+	size_t head = nbytes ? ( nbytes - 1 ) / blocklen * blocklen : 0;
+	size_t chunk, start;
+	int i, j, n;
+
+	if ( nthreads > RIJN_PMAC_THREADS )
+		nthreads = RIJN_PMAC_THREADS;
+	chunk = nthreads < 2 ? head : ( head / blocklen + nthreads - 1 ) /
+								  nthreads * blocklen;
+	if ( chunk >= head || chunk < RIJN_PMAC_MIN )
+		return( rijn_pmac( pk, input, nbytes, mac ) );
+
+	for ( n = 0, start = 0; start < head; n++, start += chunk )
+	{
+		range[n].pk = pk;
+		range[n].input = input + start;
+		range[n].nbytes = head - start < chunk ? head - start : chunk;
+		range[n].block = start / blocklen;
+		memset( range[n].sum, 0, sizeof( range[n].sum ) );
+	}
+
+	/* a range whose thread cannot start is summed here instead */
+	for ( i = 1; i < n; i++ )
+		started[i] = pthread_create( &thread[i], NULL, rijn_pmac_thread,
+									 &range[i] ) == 0;
+	rijn_pmac_thread( &range[0] );
+	for ( i = 1; i < n; i++ )
+	{
+		if ( started[i] )
+			pthread_join( thread[i], NULL );
+		else
+			rijn_pmac_thread( &range[i] );
+		for ( j = 0; j < ( int )blocklen; j++ )
+			range[0].sum[j] ^= range[i].sum[j];
+	}
+
+	return( rijn_pmac_final( pk, range[0].sum, input + head, nbytes - head,
+							 mac ) );
+}
@@ -0,0 +1,40 @@
+#ifndef RIJNDAEL_PMAC_H_
+#define RIJNDAEL_PMAC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RIJN_PMAC_OFFSETS	64	/* L * x^i for i < 64: any 64-bit block index */
+
+typedef struct
+{
+	rijn_context ctx;
+	uint8_t L[RIJN_PMAC_OFFSETS][32];	/* L * x^i, L the encryption of 0 */
+	uint8_t Linv[32];					/* L / x */
+} rijn_pmac_key;
+
+int rijn_pmac_init( rijn_pmac_key *pk, rijn_context *ctx );
+
+int rijn_pmac_sum( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+				   uint64_t block, uint8_t *sum );
+
+int rijn_pmac_final( rijn_pmac_key *pk, uint8_t *sum, uint8_t *last,
+					 size_t lastlen, uint8_t *mac );
+
+int rijn_pmac( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+			   uint8_t *mac );
+
+int rijn_pmac_parallel( rijn_pmac_key *pk, uint8_t *input, size_t nbytes,
+						uint8_t *mac, int nthreads );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_PMAC_H_ */
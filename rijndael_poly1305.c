@@ -0,0 +1,542 @@
+/*
+ *	Poly1305-AES for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * USING rijndael_poly1305.c/rijndael_poly1305.h:
+ *
+ * Poly1305 (D. J. Bernstein; RFC 8439) is a one-time authenticator: a
+ * 32-byte key r || s, used for one message only, gives a 16-byte tag from
+ * a polynomial in r over the message blocks, modulo 2^130 - 5, plus s.
+ * Poly1305-AES makes the one-time key from a lasting one: s is the AES
+ * encryption of a 16-byte nonce, so each message costs one block
+ * encryption and otherwise only multiplications.
+ *
+ * int rijn_poly1305( const uint8_t *key, const uint8_t *input,
+ *					  size_t nbytes, uint8_t *tag );
+ *
+ * writes the Poly1305 tag of nbytes of input under the one-time key (r is
+ * clamped as RFC 8439 requires) to tag.  Returns 0.
+ *
+ * int rijn_poly1305_aes( rijn_context *ctx, const uint8_t *r,
+ *						  const uint8_t *nonce, const uint8_t *input,
+ *						  size_t nbytes, uint8_t *tag );
+ *
+ * writes the Poly1305-AES tag of input to tag, where ctx holds the AES key
+ * k (128-bit blocks) and r is the 16-byte polynomial key.  Never use a
+ * nonce twice with the same k.  Returns 0, or 1 with errno EINVAL if ctx
+ * does not have 128-bit blocks.
+ *
+ * int rijn_poly1305_aes_batch( rijn_context *ctx, const uint8_t *r,
+ *								uint8_t *const *nonce,
+ *								const uint8_t *const *input,
+ *								const size_t *nbytes, uint8_t *const *tag,
+ *								size_t n );
+ *
+ * does the same for n messages, message i being nbytes[i] bytes of
+ * input[i] under nonce[i], with its tag written to tag[i].  The nonces are
+ * encrypted together through the bulk ECB kernels, which for many short
+ * messages is most of the work.
+ *
+ * The polynomial is evaluated with 44-bit limbs and 64x64-bit
+ * multiplications; on CPUs with AVX2, messages of RIJN_POLY1305_AVX2_MIN
+ * bytes or more are taken four blocks at a time in 26-bit limbs, each lane
+ * multiplying by r^4.  The code needs unsigned __int128 (GCC and Clang on
+ * 64-bit targets); elsewhere the functions fail with ENOSYS.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rijndael.h"
+#include "rijndael_poly1305.h"
+
+#ifdef __SIZEOF_INT128__
+
+#define RIJN_POLY1305_AVX2_MIN	256	/* bytes before the 4-way kernel pays */
+#define RIJN_POLY1305_BATCH		64	/* nonces per bulk encryption */
+
+#define RIJN_M26	0x3ffffffULL
+#define RIJN_M42	0x3ffffffffffULL
+#define RIJN_M44	0xfffffffffffULL
+
+typedef unsigned __int128 rijn_u128;
+
+typedef struct
+{
+	uint64_t r[3];		/* 44, 44 and 42 bits */
+	uint64_t s[2];
+	uint64_t h[3];		/* the accumulator, in the same limbs as r */
+} rijn_poly1305_state;
+
+
+static uint64_t rijn_poly1305_le64( const uint8_t *p )
+{
+	uint64_t v = 0;
+	int i;
+
+	for ( i = 7; i >= 0; i-- )
+		v = v << 8 | p[i];
+
+	return( v );
+}
+
+
+static void rijn_poly1305_init( rijn_poly1305_state *st, const uint8_t *key )
+{
+	uint64_t t0 = rijn_poly1305_le64( key ), t1 = rijn_poly1305_le64( key + 8 );
+
+	/* clamped */
+	st->r[0] = t0 & 0xffc0fffffffULL;
+	st->r[1] = ( ( t0 >> 44 ) | ( t1 << 20 ) ) & 0xfffffc0ffffULL;
+	st->r[2] = ( t1 >> 24 ) & 0x00ffffffc0fULL;
+	st->s[0] = rijn_poly1305_le64( key + 16 );
+	st->s[1] = rijn_poly1305_le64( key + 24 );
+	st->h[0] = st->h[1] = st->h[2] = 0;
+}
+
+
+/* h = h * r mod 2^130 - 5, partly reduced.  2^132 is 20 mod p, so the
+   products that reach past 2^130 come back in times 20. */
+static inline void rijn_poly1305_mulmod( uint64_t *h, const uint64_t *r )
+{
+	uint64_t s1 = r[1] * 20, s2 = r[2] * 20, c;
+	rijn_u128 d0, d1, d2;
+
+	d0 = ( rijn_u128 )h[0] * r[0] + ( rijn_u128 )h[1] * s2 +
+		 ( rijn_u128 )h[2] * s1;
+	d1 = ( rijn_u128 )h[0] * r[1] + ( rijn_u128 )h[1] * r[0] +
+		 ( rijn_u128 )h[2] * s2;
+	d2 = ( rijn_u128 )h[0] * r[2] + ( rijn_u128 )h[1] * r[1] +
+		 ( rijn_u128 )h[2] * r[0];
+
+	c = ( uint64_t )( d0 >> 44 );
+	h[0] = ( uint64_t )d0 & RIJN_M44;
+	d1 += c;
+	c = ( uint64_t )( d1 >> 44 );
+	h[1] = ( uint64_t )d1 & RIJN_M44;
+	d2 += c;
+	c = ( uint64_t )( d2 >> 42 );
+	h[2] = ( uint64_t )d2 & RIJN_M42;
+	h[0] += c * 5;
+	c = h[0] >> 44;
+	h[0] &= RIJN_M44;
+	h[1] += c;
+}
+
+
+/* Absorb whole 16-byte blocks; hibit is 2^128 in the top limb, or 0 for
+   the padded last block. */
+static void rijn_poly1305_blocks( rijn_poly1305_state *st, const uint8_t *m,
+								  size_t nbytes, uint64_t hibit )
+{
+	uint64_t t0, t1;
+
+	for ( ; nbytes >= 16; nbytes -= 16, m += 16 )
+	{
+		t0 = rijn_poly1305_le64( m );
+		t1 = rijn_poly1305_le64( m + 8 );
+		st->h[0] += t0 & RIJN_M44;
+		st->h[1] += ( ( t0 >> 44 ) | ( t1 << 20 ) ) & RIJN_M44;
+		st->h[2] += ( ( t1 >> 24 ) & RIJN_M42 ) | hibit;
+		rijn_poly1305_mulmod( st->h, st->r );
+	}
+}
+
+
+/* Reduce h fully, add s and write the low 128 bits. */
+static void rijn_poly1305_finish( rijn_poly1305_state *st, uint8_t *tag )
+{
+	uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+	uint64_t g0, g1, g2, c, t0 = st->s[0], t1 = st->s[1];
+	int i;
+
+	c = h1 >> 44;
+	h1 &= RIJN_M44;
+	h2 += c;
+	c = h2 >> 42;
+	h2 &= RIJN_M42;
+	h0 += c * 5;
+	c = h0 >> 44;
+	h0 &= RIJN_M44;
+	h1 += c;
+	c = h1 >> 44;
+	h1 &= RIJN_M44;
+	h2 += c;
+	c = h2 >> 42;
+	h2 &= RIJN_M42;
+	h0 += c * 5;
+	c = h0 >> 44;
+	h0 &= RIJN_M44;
+	h1 += c;
+
+	/* h - p, taken if it does not go negative, without branching */
+	g0 = h0 + 5;
+	c = g0 >> 44;
+	g0 &= RIJN_M44;
+	g1 = h1 + c;
+	c = g1 >> 44;
+	g1 &= RIJN_M44;
+	g2 = h2 + c - ( 1ULL << 42 );
+	c = ( g2 >> 63 ) - 1;
+	h0 = ( h0 & ~c ) | ( g0 & c );
+	h1 = ( h1 & ~c ) | ( g1 & c );
+	h2 = ( h2 & ~c ) | ( g2 & c );
+
+	h0 += t0 & RIJN_M44;
+	c = h0 >> 44;
+	h0 &= RIJN_M44;
+	h1 += ( ( ( t0 >> 44 ) | ( t1 << 20 ) ) & RIJN_M44 ) + c;
+	c = h1 >> 44;
+	h1 &= RIJN_M44;
+	h2 += ( ( t1 >> 24 ) & RIJN_M42 ) + c;
+
+	t0 = h0 | ( h1 << 44 );
+	t1 = ( h1 >> 20 ) | ( h2 << 24 );
+	for ( i = 0; i < 8; i++ )
+	{
+		tag[i] = ( uint8_t )( t0 >> ( 8 * i ) );
+		tag[8 + i] = ( uint8_t )( t1 >> ( 8 * i ) );
+	}
+	memset( st, 0, sizeof( *st ) );
+}
+
+
+#if !defined( RIJN_NO_AVX2 ) && defined( __GNUC__ ) && defined( __x86_64__ )
+	#define RIJN_POLY1305_AVX2
+#endif
+
+#ifdef RIJN_POLY1305_AVX2
+
+#include <immintrin.h>
+
+static int rijn_poly1305_have_avx2( void )
+{
+	static int have_avx2 = -1;
+
+	if ( have_avx2 < 0 )
+	{
+		__builtin_cpu_init();
+		have_avx2 = __builtin_cpu_supports( "avx2" ) ? 1 : 0;
+	}
+
+	return( have_avx2 );
+}
+
+
+/* 44/44/42-bit limbs, as rijn_poly1305_mulmod leaves them, to 26-bit
+   limbs.  h[1] can be a bit past 2^44, so h[0] and h[1] are carried
+   first: the bits above 44 would be lost in the OR into l[3]. */
+static void rijn_poly1305_to26( const uint64_t *h, uint64_t *l )
+{
+	uint64_t h0, h1, h2;
+
+	h1 = h[1] + ( h[0] >> 44 );
+	h0 = h[0] & RIJN_M44;
+	h2 = h[2] + ( h1 >> 44 );
+	h1 &= RIJN_M44;
+
+	l[0] = h0 & RIJN_M26;
+	l[1] = ( ( h0 >> 26 ) | ( h1 << 18 ) ) & RIJN_M26;
+	l[2] = ( h1 >> 8 ) & RIJN_M26;
+	l[3] = ( ( h1 >> 34 ) | ( h2 << 10 ) ) & RIJN_M26;
+	l[4] = h2 >> 16;
+}
+
+
+/* 26-bit limbs of any size below 2^63 back to 44/44/42-bit limbs */
+static void rijn_poly1305_from26( uint64_t *l, uint64_t *h )
+{
+	int i, pass;
+
+	for ( pass = 0; pass < 2; pass++ )
+	{
+		for ( i = 0; i < 4; i++ )
+		{
+			l[i + 1] += l[i] >> 26;
+			l[i] &= RIJN_M26;
+		}
+		if ( pass == 0 )
+		{
+			l[0] += ( l[4] >> 26 ) * 5;
+			l[4] &= RIJN_M26;
+		}
+	}
+	h[0] = ( l[0] | ( l[1] << 26 ) ) & RIJN_M44;
+	h[1] = ( ( l[1] >> 18 ) | ( l[2] << 8 ) | ( l[3] << 34 ) ) & RIJN_M44;
+	h[2] = ( l[3] >> 10 ) | ( l[4] << 16 );
+}
+
+
+/* Four blocks' 26-bit limbs, with 2^128 added: limb k of block j goes to
+   lane j of m[k]. */
+__attribute__(( target( "avx2" ) ))
+static inline void rijn_poly1305_load4( const uint8_t *p, __m256i *m )
+{
+	uint64_t l[5][4];
+	uint32_t t[4];
+	int j, k;
+
+	for ( j = 0; j < 4; j++, p += 16 )
+	{
+		for ( k = 0; k < 4; k++ )
+			memcpy( &t[k], p + 3 * k, 4 );
+		l[0][j] = t[0] & RIJN_M26;
+		l[1][j] = ( t[1] >> 2 ) & RIJN_M26;
+		l[2][j] = ( t[2] >> 4 ) & RIJN_M26;
+		l[3][j] = ( t[3] >> 6 ) & RIJN_M26;
+		memcpy( &t[0], p + 12, 4 );
+		l[4][j] = ( t[0] >> 8 ) | ( 1 << 24 );
+	}
+	for ( k = 0; k < 5; k++ )
+		m[k] = _mm256_loadu_si256( ( const __m256i * )l[k] );
+}
+
+
+/* h = h * r, lane by lane, in 26-bit limbs; s is 5 * r.  Every product is
+   below 2^56 and every sum of five below 2^59. */
+__attribute__(( target( "avx2" ) ))
+static inline void rijn_poly1305_vmul( __m256i *h, const __m256i *r,
+									   const __m256i *s )
+{
+	const __m256i mask = _mm256_set1_epi64x( RIJN_M26 );
+	__m256i d[5], c;
+	int k;
+
+#define RIJN_VMUL( a, b ) _mm256_mul_epu32( a, b )
+	d[0] = _mm256_add_epi64(
+		_mm256_add_epi64( RIJN_VMUL( h[0], r[0] ), RIJN_VMUL( h[1], s[4] ) ),
+		_mm256_add_epi64( _mm256_add_epi64( RIJN_VMUL( h[2], s[3] ),
+											RIJN_VMUL( h[3], s[2] ) ),
+						  RIJN_VMUL( h[4], s[1] ) ) );
+	d[1] = _mm256_add_epi64(
+		_mm256_add_epi64( RIJN_VMUL( h[0], r[1] ), RIJN_VMUL( h[1], r[0] ) ),
+		_mm256_add_epi64( _mm256_add_epi64( RIJN_VMUL( h[2], s[4] ),
+											RIJN_VMUL( h[3], s[3] ) ),
+						  RIJN_VMUL( h[4], s[2] ) ) );
+	d[2] = _mm256_add_epi64(
+		_mm256_add_epi64( RIJN_VMUL( h[0], r[2] ), RIJN_VMUL( h[1], r[1] ) ),
+		_mm256_add_epi64( _mm256_add_epi64( RIJN_VMUL( h[2], r[0] ),
+											RIJN_VMUL( h[3], s[4] ) ),
+						  RIJN_VMUL( h[4], s[3] ) ) );
+	d[3] = _mm256_add_epi64(
+		_mm256_add_epi64( RIJN_VMUL( h[0], r[3] ), RIJN_VMUL( h[1], r[2] ) ),
+		_mm256_add_epi64( _mm256_add_epi64( RIJN_VMUL( h[2], r[1] ),
+											RIJN_VMUL( h[3], r[0] ) ),
+						  RIJN_VMUL( h[4], s[4] ) ) );
+	d[4] = _mm256_add_epi64(
+		_mm256_add_epi64( RIJN_VMUL( h[0], r[4] ), RIJN_VMUL( h[1], r[3] ) ),
+		_mm256_add_epi64( _mm256_add_epi64( RIJN_VMUL( h[2], r[2] ),
+											RIJN_VMUL( h[3], r[1] ) ),
+						  RIJN_VMUL( h[4], r[0] ) ) );
+#undef RIJN_VMUL
+
+	for ( k = 0; k < 4; k++ )
+	{
+		c = _mm256_srli_epi64( d[k], 26 );
+		d[k] = _mm256_and_si256( d[k], mask );
+		d[k + 1] = _mm256_add_epi64( d[k + 1], c );
+	}
+	c = _mm256_srli_epi64( d[4], 26 );
+	d[4] = _mm256_and_si256( d[4], mask );
+	d[0] = _mm256_add_epi64( d[0], _mm256_add_epi64( c,
+							 _mm256_slli_epi64( c, 2 ) ) );
+	c = _mm256_srli_epi64( d[0], 26 );
+	d[0] = _mm256_and_si256( d[0], mask );
+	d[1] = _mm256_add_epi64( d[1], c );
+
+	for ( k = 0; k < 5; k++ )
+		h[k] = d[k];
+}
+
+
+/* Absorb nbytes / 64 groups of four blocks, with lane j taking blocks j,
+   j + 4, j + 8 ..., each step multiplying every lane by r^4.  At the end
+   lane j is multiplied by r^(4 - j) and the lanes are summed into st->h.
+   Returns the bytes absorbed. */
+__attribute__(( target( "avx2" ) ))
+static size_t rijn_poly1305_blocks_avx2( rijn_poly1305_state *st,
+										 const uint8_t *m, size_t nbytes )
+{
+	uint64_t pw[4][3], l[4][5], lanes[5][4], sum[5];
+	__m256i h[5], msg[5], r[5], s[5];
+	size_t i, groups = nbytes / 64;
+	int j, k;
+
+	/* r, r^2, r^3 and r^4 */
+	memcpy( pw[0], st->r, sizeof( pw[0] ) );
+	for ( j = 1; j < 4; j++ )
+	{
+		memcpy( pw[j], pw[j - 1], sizeof( pw[j] ) );
+		rijn_poly1305_mulmod( pw[j], st->r );
+	}
+	for ( j = 0; j < 4; j++ )
+		rijn_poly1305_to26( pw[j], l[j] );
+
+	/* the accumulator so far goes in with the first block */
+	rijn_poly1305_load4( m, h );
+	rijn_poly1305_to26( st->h, sum );
+	for ( k = 0; k < 5; k++ )
+		h[k] = _mm256_add_epi64( h[k], _mm256_set_epi64x( 0, 0, 0, sum[k] ) );
+
+	for ( k = 0; k < 5; k++ )
+	{
+		r[k] = _mm256_set1_epi64x( l[3][k] );
+		s[k] = _mm256_set1_epi64x( l[3][k] * 5 );
+	}
+	for ( i = 1; i < groups; i++ )
+	{
+		rijn_poly1305_vmul( h, r, s );
+		rijn_poly1305_load4( m + 64 * i, msg );
+		for ( k = 0; k < 5; k++ )
+			h[k] = _mm256_add_epi64( h[k], msg[k] );
+	}
+
+	/* lane 0 by r^4 ... lane 3 by r */
+	for ( k = 0; k < 5; k++ )
+	{
+		r[k] = _mm256_set_epi64x( l[0][k], l[1][k], l[2][k], l[3][k] );
+		s[k] = _mm256_set_epi64x( l[0][k] * 5, l[1][k] * 5, l[2][k] * 5,
+								  l[3][k] * 5 );
+	}
+	rijn_poly1305_vmul( h, r, s );
+	for ( k = 0; k < 5; k++ )
+	{
+		_mm256_storeu_si256( ( __m256i * )lanes[k], h[k] );
+		sum[k] = lanes[k][0] + lanes[k][1] + lanes[k][2] + lanes[k][3];
+	}
+	rijn_poly1305_from26( sum, st->h );
+
+	return( groups * 64 );
+}
+
+#endif	/* RIJN_POLY1305_AVX2 */
+
+
+int rijn_poly1305( const uint8_t *key, const uint8_t *input, size_t nbytes,
+				   uint8_t *tag )
+{
+	rijn_poly1305_state st;
+	uint8_t last[16];
+	size_t done = 0, rest;
+
+	rijn_poly1305_init( &st, key );
+#ifdef RIJN_POLY1305_AVX2
+	if ( nbytes >= RIJN_POLY1305_AVX2_MIN && rijn_poly1305_have_avx2() )
+		done = rijn_poly1305_blocks_avx2( &st, input, nbytes );
+#endif
+	rest = ( nbytes - done ) % 16;
+	rijn_poly1305_blocks( &st, input + done, nbytes - done - rest,
+						  1ULL << 40 );
+	if ( rest )
+	{
+		memset( last, 0, sizeof( last ) );
+		memcpy( last, input + nbytes - rest, rest );
+		last[rest] = 1;
+		rijn_poly1305_blocks( &st, last, 16, 0 );
+	}
+	rijn_poly1305_finish( &st, tag );
+
+	return (0);
+}
+
+
+int rijn_poly1305_aes( rijn_context *ctx, const uint8_t *r,
+					   const uint8_t *nonce, const uint8_t *input,
+					   size_t nbytes, uint8_t *tag )
+{
+	uint8_t key[32];
+
+	if ( ctx->blocklen != 16 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	memcpy( key, r, 16 );
+	rijn_encrypt( ctx, ( uint8_t * )nonce, key + 16 );
+	rijn_poly1305( key, input, nbytes, tag );
+	memset( key, 0, sizeof( key ) );
+
+	return (0);
+}
+
+
+int rijn_poly1305_aes_batch( rijn_context *ctx, const uint8_t *r,
+							 uint8_t *const *nonce,
+							 const uint8_t *const *input,
+							 const size_t *nbytes, uint8_t *const *tag,
+							 size_t n )
+{
+	uint8_t s[RIJN_POLY1305_BATCH * 16], key[32];
+	size_t i, j, step;
+
+	if ( ctx->blocklen != 16 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	memcpy( key, r, 16 );
+	for ( i = 0; i < n; i += step )
+	{
+		step = n - i < RIJN_POLY1305_BATCH ? n - i : RIJN_POLY1305_BATCH;
+		for ( j = 0; j < step; j++ )
+			memcpy( s + 16 * j, nonce[i + j], 16 );
+		rijn_ecb_encrypt( ctx, s, s, 16 * step );
+		for ( j = 0; j < step; j++ )
+		{
+			memcpy( key + 16, s + 16 * j, 16 );
+			rijn_poly1305( key, input[i + j], nbytes[i + j], tag[i + j] );
+		}
+	}
+	memset( s, 0, sizeof( s ) );
+	memset( key, 0, sizeof( key ) );
+
+	return (0);
+}
+
+#else	/* !__SIZEOF_INT128__ */
+
+int rijn_poly1305( const uint8_t *key, const uint8_t *input, size_t nbytes,
+				   uint8_t *tag )
+{
+	errno = ENOSYS;
+	return (1);
+}
+
+int rijn_poly1305_aes( rijn_context *ctx, const uint8_t *r,
+					   const uint8_t *nonce, const uint8_t *input,
+					   size_t nbytes, uint8_t *tag )
+{
+	errno = ENOSYS;
+	return (1);
+}
+
+int rijn_poly1305_aes_batch( rijn_context *ctx, const uint8_t *r,
+							 uint8_t *const *nonce,
+							 const uint8_t *const *input,
+							 const size_t *nbytes, uint8_t *const *tag,
+							 size_t n )
+{
+	errno = ENOSYS;
+	return (1);
+}
+
+#endif	/* __SIZEOF_INT128__ */
@@ -0,0 +1,30 @@
+#ifndef RIJNDAEL_POLY1305_H_
+#define RIJNDAEL_POLY1305_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int rijn_poly1305( const uint8_t *key, const uint8_t *input, size_t nbytes,
+				   uint8_t *tag );
+
+int rijn_poly1305_aes( rijn_context *ctx, const uint8_t *r,
+					   const uint8_t *nonce, const uint8_t *input,
+					   size_t nbytes, uint8_t *tag );
+
+int rijn_poly1305_aes_batch( rijn_context *ctx, const uint8_t *r,
+							 uint8_t *const *nonce,
+							 const uint8_t *const *input,
+							 const size_t *nbytes, uint8_t *const *tag,
+							 size_t n );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_POLY1305_H_ */
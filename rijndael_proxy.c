@@ -0,0 +1,821 @@
+/*
+ *	Encrypting TCP proxy for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * USING rijndael_proxy.c/rijndael_proxy.h:
+ *
+ * A pair of proxies makes an encrypted TCP tunnel: a sealing proxy takes
+ * plaintext connections and relays each to an opening proxy as a stream
+ * of records, which it turns back into plaintext for the target.  Replies
+ * travel back the same way, sealed by the opening proxy and opened by the
+ * sealing one.  Linux only.
+ *
+ * A stream starts with a random 16-byte salt and then carries records:
+ *
+ *	length (4 bytes, big-endian, at most 16384) | ciphertext | tag
+ *
+ * each sealed with rijn_eax_encrypt, with the direction (one byte, 0 for
+ * the stream from the sealing proxy and 1 for the replies) and the length
+ * as header and salt || record number (8 bytes, big-endian) as nonce, so
+ * records cannot be altered, dropped, reordered or sent back the way they
+ * came without the connection being reset.  The direction is not sent.
+ * The tag is a block long.  A stream ends with an empty record; one that
+ * ends without it, or goes on after it, is reset too, so it cannot be cut
+ * short at a record boundary either.
+ *
+ * rijn_proxy *rijn_proxy_start( rijn_context *ctx, int mode,
+ *								 const char *host, const char *port,
+ *								 const char *target_host,
+ *								 const char *target_port );
+ *
+ * listens at host and port (port "0" picks a free one) and relays each
+ * connection to the target, sealing (RIJN_PROXY_SEAL) or opening
+ * (RIJN_PROXY_OPEN) what clients send, with the key in ctx, which is
+ * copied.  One thread serves every connection with epoll.  Returns the
+ * proxy, or NULL with errno set.
+ *
+ * int rijn_proxy_port( rijn_proxy *proxy );
+ *
+ * tells the port the proxy listens on.
+ *
+ * void rijn_proxy_stats( rijn_proxy *proxy, uint64_t *connections,
+ *						  uint64_t *bytes );
+ *
+ * tells how many connections have been accepted, and how many bytes of
+ * plaintext sealed or opened in both directions.
+ *
+ * void rijn_proxy_stop( rijn_proxy *proxy );
+ *
+ * closes every connection and frees the proxy.
+ *
+ * Each wakeup reads from every ready connection first, then seals or
+ * opens everything read, then writes, so the records of many connections
+ * are made together while their data is warm.  Buffers come from a pool
+ * the proxy keeps rather than from malloc for each connection.
+ *
+ * Compile with -DRIJN_PROXY_MAIN, along with rijndael.c, for a program that
+ * runs a proxy:
+ *
+ *	rijndael_proxy seal|open keyfile host port target-host target-port
+ *
+ * keyfile holding a 16, 24 or 32-byte key; blocks are 128 bits.  Link with
+ * -lpthread.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE			/* for accept4 */
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <fcntl.h>
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <sys/socket.h>
+#endif
+
+#include "rijndael.h"
+#include "rijndael_proxy.h"
+
+#define RIJN_PROXY_RECORD	16384	/* the most plaintext in a record */
+#define RIJN_PROXY_SALT		16
+#define RIJN_PROXY_BUFSIZE	65536
+#define RIJN_PROXY_POOL		256		/* free buffers kept */
+#define RIJN_PROXY_EVENTS	64		/* epoll events per wakeup */
+
+#ifdef __linux__
+
+typedef struct rijn_proxy_buf
+{
+	struct rijn_proxy_buf *next;	/* in the pool */
+	size_t start, end;				/* the bytes waiting */
+	uint8_t data[RIJN_PROXY_BUFSIZE];
+} rijn_proxy_buf;
+
+struct rijn_proxy_link;
+
+/* One end of a relayed connection, and the stream read from it. */
+typedef struct
+{
+	struct rijn_proxy_link *link;
+	int fd;
+	int connecting;			/* a connect is in progress */
+	int eof;				/* the stream read from fd has ended */
+	int shut;				/* writing to fd has been shut down */
+	int unwatched;			/* fd is no longer in the epoll set */
+	uint32_t events;		/* what epoll watches for */
+	rijn_proxy_buf *in;		/* read, not yet sealed or opened */
+	rijn_proxy_buf *out;	/* to be written */
+	int seal;				/* seal what is read, else open it */
+	int salted;				/* its salt is sent or received */
+	int partial;			/* in ends inside a record */
+	int ended;				/* the end record is sent or received */
+	uint8_t salt[RIJN_PROXY_SALT];
+	uint64_t seq;			/* records so far */
+} rijn_proxy_side;
+
+typedef struct rijn_proxy_link
+{
+	rijn_proxy_side side[2];	/* accepted, and to the target */
+	int dead;					/* reset both ends */
+	int touched;				/* on this wakeup's list */
+	struct rijn_proxy_link *tnext;
+	struct rijn_proxy_link *prev, *next;	/* every link */
+} rijn_proxy_link;
+
+struct rijn_proxy
+{
+	rijn_context ctx;
+	int mode;
+	int listenfd;
+	int epfd;
+	int stopfd;				/* an eventfd rijn_proxy_stop signals */
+	int random;				/* /dev/urandom, for salts */
+	struct sockaddr_storage target;
+	socklen_t targetlen;
+	rijn_proxy_link *links;
+	rijn_proxy_buf *pool;
+	int npool;
+	uint64_t connections, bytes;
+	pthread_t thread;
+};
+
+
+static rijn_proxy_buf *rijn_proxy_buf_get( rijn_proxy *p )
+{
+	rijn_proxy_buf *b = p->pool;
+
+	if ( b != NULL )
+	{
+		p->pool = b->next;
+		p->npool--;
+	}
+	else
+	{
+		b = (rijn_proxy_buf *) malloc( sizeof( *b ) );
+		if ( b == NULL )
+			return NULL;
+	}
+	b->start = b->end = 0;
+
+	return b;
+}
+
+
+static void rijn_proxy_buf_put( rijn_proxy *p, rijn_proxy_buf *b )
+{
+	if ( b == NULL )
+		return;
+	if ( p->npool >= RIJN_PROXY_POOL )
+	{
+		free( b );
+		return;
+	}
+	b->next = p->pool;
+	p->pool = b;
+	p->npool++;
+}
+
+
+/* Move the waiting bytes to the start of b; returns the room after them. */
+static size_t rijn_proxy_room( rijn_proxy_buf *b )
+{
+	if ( b->start == b->end )
+		b->start = b->end = 0;
+	else if ( b->start > 0 && b->end > RIJN_PROXY_BUFSIZE / 2 )
+	{
+		memmove( b->data, b->data + b->start, b->end - b->start );
+		b->end -= b->start;
+		b->start = 0;
+	}
+
+	return RIJN_PROXY_BUFSIZE - b->end;
+}
+
+
+static void rijn_proxy_nonce( rijn_proxy_side *s, uint8_t *nonce )
+{
+	int i;
+
+	memcpy( nonce, s->salt, RIJN_PROXY_SALT );
+	for ( i = 0; i < 8; i++ )
+		nonce[RIJN_PROXY_SALT + i] = (uint8_t) ( s->seq >> ( 56 - 8 * i ) );
+}
+
+
+/* Seal or open what has been read from side i into the other side's out.
+   The stream read from side 0 goes from the sealing proxy to the opening
+   one, so i is also its direction.  Returns 0, or 1 if the stream is
+   corrupt. */
+static int rijn_proxy_pump( rijn_proxy *p, rijn_proxy_link *link, int i )
+{
+	rijn_proxy_side *src = &link->side[i];
+	rijn_proxy_buf *in = src->in, *out = link->side[!i].out;
+	uint8_t nonce[RIJN_PROXY_SALT + 8], aad[5], *head;
+	size_t n, tag = p->ctx.blocklen, moved = 0;
+
+	aad[0] = (uint8_t) i;
+
+	src->partial = 0;
+	while ( in->start < in->end || ( src->seal && src->eof && !src->ended ) )
+	{
+		if ( src->seal )
+		{
+			/* with nothing left after the end of the stream, the end record */
+			n = in->end - in->start;
+			n = n < RIJN_PROXY_RECORD ? n : RIJN_PROXY_RECORD;
+			if ( rijn_proxy_room( out ) < 4 + n + tag )
+				break;
+			src->ended = n == 0;
+			head = out->data + out->end;
+			head[0] = (uint8_t) ( n >> 24 );
+			head[1] = (uint8_t) ( n >> 16 );
+			head[2] = (uint8_t) ( n >> 8 );
+			head[3] = (uint8_t) n;
+			memcpy( aad + 1, head, 4 );
+			rijn_proxy_nonce( src, nonce );
+			rijn_eax_encrypt( &p->ctx, nonce, sizeof( nonce ), aad, 5,
+							  in->data + in->start, head + 4, n, head + 4 + n );
+			out->end += 4 + n + tag;
+			in->start += n;
+		}
+		else if ( !src->salted )
+		{
+			if ( in->end - in->start < RIJN_PROXY_SALT )
+			{
+				src->partial = 1;
+				break;
+			}
+			memcpy( src->salt, in->data + in->start, RIJN_PROXY_SALT );
+			in->start += RIJN_PROXY_SALT;
+			src->salted = 1;
+			continue;
+		}
+		else
+		{
+			if ( src->ended )
+				return 1;
+			if ( in->end - in->start < 4 )
+			{
+				src->partial = 1;
+				break;
+			}
+			head = in->data + in->start;
+			n = (size_t) head[0] << 24 | (size_t) head[1] << 16 |
+				(size_t) head[2] << 8 | head[3];
+			if ( n > RIJN_PROXY_RECORD )
+				return 1;
+			src->partial = in->end - in->start < 4 + n + tag;
+			if ( src->partial || rijn_proxy_room( out ) < n )
+				break;
+			memcpy( aad + 1, head, 4 );
+			rijn_proxy_nonce( src, nonce );
+			if ( rijn_eax_decrypt( &p->ctx, nonce, sizeof( nonce ), aad, 5,
+								   head + 4, out->data + out->end, n,
+								   head + 4 + n ) )
+				return 1;
+			src->ended = n == 0;
+			out->end += n;
+			in->start += 4 + n + tag;
+		}
+		src->seq++;
+		moved += n;
+	}
+
+	rijn_proxy_room( in );
+	if ( moved )
+		__atomic_add_fetch( &p->bytes, moved, __ATOMIC_RELAXED );
+
+	return 0;
+}
+
+
+/* Write what is waiting for side s.  Returns 0, or 1 on error. */
+static int rijn_proxy_flush( rijn_proxy_side *s )
+{
+	rijn_proxy_buf *out = s->out;
+	ssize_t n;
+
+	while ( !s->connecting && out->start < out->end )
+	{
+		n = send( s->fd, out->data + out->start, out->end - out->start,
+				  MSG_NOSIGNAL );
+		if ( n < 0 )
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ?
+				   0 : 1;
+		out->start += n;
+	}
+
+	return 0;
+}
+
+
+/* Act on what epoll reported for side s: finish a connect, or read.  An
+   error, or a hangup after the stream read from s has ended while there
+   is still a stream to write to it, fails the link. */
+static void rijn_proxy_event( rijn_proxy_side *s, uint32_t events )
+{
+	rijn_proxy_buf *in = s->in;
+	socklen_t len = sizeof( int );
+	ssize_t n;
+	size_t room;
+	int error = 0;
+
+	if ( s->connecting && ( events & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) ) )
+	{
+		if ( getsockopt( s->fd, SOL_SOCKET, SO_ERROR, &error, &len ) || error )
+		{
+			s->link->dead = 1;
+			return;
+		}
+		s->connecting = 0;
+	}
+
+	room = rijn_proxy_room( in );
+	if ( !s->eof && room > 0 && ( events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) )
+	{
+		n = recv( s->fd, in->data + in->end, room, 0 );
+		if ( n > 0 )
+			in->end += n;
+		else if ( n == 0 )
+			s->eof = 1;
+		else if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+			s->link->dead = 1;
+	}
+
+	if ( ( events & EPOLLERR ) ||
+		 ( ( events & EPOLLHUP ) && s->eof && !s->shut ) )
+	{
+		getsockopt( s->fd, SOL_SOCKET, SO_ERROR, &error, &len );
+		s->link->dead = 1;
+	}
+}
+
+
+static void rijn_proxy_close( rijn_proxy *p, rijn_proxy_link *link )
+{
+	struct linger lg;
+	int i;
+
+	for ( i = 0; i < 2; i++ )
+	{
+		rijn_proxy_buf_put( p, link->side[i].in );
+		rijn_proxy_buf_put( p, link->side[i].out );
+		if ( link->side[i].fd < 0 )
+			continue;
+		if ( link->dead )
+		{
+			/* reset, so the other end knows the stream did not finish */
+			lg.l_onoff = 1;
+			lg.l_linger = 0;
+			setsockopt( link->side[i].fd, SOL_SOCKET, SO_LINGER, &lg,
+						sizeof( lg ) );
+		}
+		close( link->side[i].fd );
+	}
+	if ( link->prev != NULL )
+		link->prev->next = link->next;
+	else
+		p->links = link->next;
+	if ( link->next != NULL )
+		link->next->prev = link->prev;
+	free( link );
+}
+
+
+/* Watch for what side s can use: room to read into, or bytes to write.
+   Once both its streams are finished it is taken out of the epoll set,
+   which would otherwise report its hangup on every wakeup. */
+static int rijn_proxy_arm( rijn_proxy *p, rijn_proxy_side *s, int add )
+{
+	struct epoll_event ev;
+
+	if ( s->unwatched )
+		return 0;
+	if ( !add && s->eof && s->shut )
+	{
+		s->unwatched = 1;
+		return epoll_ctl( p->epfd, EPOLL_CTL_DEL, s->fd, NULL );
+	}
+
+	ev.events = 0;
+	if ( !s->eof && rijn_proxy_room( s->in ) > 0 )
+		ev.events |= EPOLLIN;
+	if ( s->connecting || s->out->start < s->out->end )
+		ev.events |= EPOLLOUT;
+	if ( !add && ev.events == s->events )
+		return 0;
+	ev.data.ptr = s;
+	s->events = ev.events;
+
+	return epoll_ctl( p->epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, s->fd, &ev );
+}
+
+
+/* Move everything a wakeup read on through link, then close it if both
+   streams are finished or it failed. */
+static void rijn_proxy_service( rijn_proxy *p, rijn_proxy_link *link )
+{
+	rijn_proxy_side *src, *dst;
+	int i, round;
+
+	for ( round = 0; round < 2 && !link->dead; round++ )
+		for ( i = 0; i < 2; i++ )
+			if ( rijn_proxy_pump( p, link, i ) ||
+				 rijn_proxy_flush( &link->side[!i] ) )
+				link->dead = 1;
+
+	for ( i = 0; i < 2 && !link->dead; i++ )
+	{
+		src = &link->side[i];
+		dst = &link->side[!i];
+		if ( src->eof && ( src->partial || ( !src->seal && !src->ended ) ) )
+			link->dead = 1;		/* it ended inside or without the end record */
+		if ( !src->eof || !src->ended || link->dead || dst->shut ||
+			 dst->connecting ||
+			 src->in->start < src->in->end ||
+			 dst->out->start < dst->out->end )
+			continue;
+		if ( shutdown( dst->fd, SHUT_WR ) )
+			link->dead = 1;
+		else
+			dst->shut = 1;
+	}
+
+	if ( link->dead || ( link->side[0].shut && link->side[1].shut ) ||
+		 rijn_proxy_arm( p, &link->side[0], 0 ) ||
+		 rijn_proxy_arm( p, &link->side[1], 0 ) )
+		rijn_proxy_close( p, link );
+}
+
+
+/* Accept every waiting connection and start connecting each to the
+   target. */
+static void rijn_proxy_accept( rijn_proxy *p )
+{
+	rijn_proxy_link *link;
+	rijn_proxy_side *s;
+	int fd, i, one = 1;
+
+	while ( ( fd = accept4( p->listenfd, NULL, NULL,
+							SOCK_NONBLOCK | SOCK_CLOEXEC ) ) >= 0 )
+	{
+		__atomic_add_fetch( &p->connections, 1, __ATOMIC_RELAXED );
+		link = (rijn_proxy_link *) calloc( 1, sizeof( *link ) );
+		if ( link == NULL )
+		{
+			close( fd );
+			continue;
+		}
+		link->next = p->links;
+		if ( p->links != NULL )
+			p->links->prev = link;
+		p->links = link;
+
+		link->side[0].fd = fd;
+		link->side[1].fd = socket( p->target.ss_family,
+								   SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+								   0 );
+		for ( i = 0; i < 2; i++ )
+		{
+			s = &link->side[i];
+			s->link = link;
+			s->seal = ( p->mode == RIJN_PROXY_SEAL ) == ( i == 0 );
+			s->in = rijn_proxy_buf_get( p );
+			s->out = rijn_proxy_buf_get( p );
+			if ( s->fd < 0 || s->in == NULL || s->out == NULL )
+				link->dead = 1;
+			else
+				setsockopt( s->fd, IPPROTO_TCP, TCP_NODELAY, &one,
+							sizeof( one ) );
+		}
+
+		/* a sealed stream starts with its salt */
+		for ( i = 0; i < 2 && !link->dead; i++ )
+		{
+			s = &link->side[i];
+			if ( !s->seal )
+				continue;
+			if ( read( p->random, s->salt, RIJN_PROXY_SALT ) !=
+				 RIJN_PROXY_SALT )
+				link->dead = 1;
+			s->salted = 1;
+			memcpy( link->side[!i].out->data, s->salt, RIJN_PROXY_SALT );
+			link->side[!i].out->end = RIJN_PROXY_SALT;
+		}
+
+		if ( !link->dead &&
+			 connect( link->side[1].fd, (struct sockaddr *) &p->target,
+					  p->targetlen ) && errno != EINPROGRESS )
+			link->dead = 1;
+		link->side[1].connecting = 1;	/* writable once connected */
+		if ( link->dead || rijn_proxy_arm( p, &link->side[0], 1 ) ||
+			 rijn_proxy_arm( p, &link->side[1], 1 ) )
+		{
+			link->dead = 1;
+			rijn_proxy_close( p, link );
+		}
+	}
+}
+
+
+static void *rijn_proxy_thread( void *arg )
+{
+	rijn_proxy *p = (rijn_proxy *) arg;
+	struct epoll_event ev[RIJN_PROXY_EVENTS];
+	rijn_proxy_link *touched, *link;
+	rijn_proxy_side *s;
+	int i, n;
+
+	for ( ;; )
+	{
+		n = epoll_wait( p->epfd, ev, RIJN_PROXY_EVENTS, -1 );
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			break;
+		}
+
+		/* read from every connection first ... */
+		touched = NULL;
+		for ( i = 0; i < n; i++ )
+		{
+			if ( ev[i].data.ptr == &p->stopfd )
+				return NULL;
+			if ( ev[i].data.ptr == p )
+			{
+				rijn_proxy_accept( p );
+				continue;
+			}
+			s = (rijn_proxy_side *) ev[i].data.ptr;
+			rijn_proxy_event( s, ev[i].events );
+			if ( !s->link->touched )
+			{
+				s->link->touched = 1;
+				s->link->tnext = touched;
+				touched = s->link;
+			}
+		}
+
+		/* ... then seal or open and write for all of them */
+		while ( touched != NULL )
+		{
+			link = touched;
+			touched = link->tnext;
+			link->touched = 0;
+			rijn_proxy_service( p, link );
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Resolve host and port to the first address getaddrinfo gives. */
+static int rijn_proxy_resolve( const char *host, const char *port, int passive,
+							   struct sockaddr_storage *addr, socklen_t *len )
+{
+	struct addrinfo hints, *res;
+	int error;
+
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	error = getaddrinfo( host, port, &hints, &res );
+	if ( error )
+	{
+		errno = error == EAI_SYSTEM ? errno : EINVAL;
+		return (1);
+	}
+	memcpy( addr, res->ai_addr, res->ai_addrlen );
+	*len = res->ai_addrlen;
+	freeaddrinfo( res );
+
+	return (0);
+}
+
+#endif /* __linux__ */
+
+
+rijn_proxy *rijn_proxy_start( rijn_context *ctx, int mode, const char *host,
+							  const char *port, const char *target_host,
+							  const char *target_port )
+{
+#ifdef __linux__
+	struct sockaddr_storage addr;
+	struct epoll_event ev;
+	socklen_t len;
+	rijn_proxy *p;
+	int error, one = 1;
+
+	if ( mode != RIJN_PROXY_SEAL && mode != RIJN_PROXY_OPEN )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	p = (rijn_proxy *) calloc( 1, sizeof( *p ) );
+	if ( p == NULL )
+		return NULL;
+	p->ctx = *ctx;
+	p->mode = mode;
+	p->listenfd = p->epfd = p->stopfd = p->random = -1;
+
+	if ( rijn_proxy_resolve( host, port, 1, &addr, &len ) ||
+		 rijn_proxy_resolve( target_host, target_port, 0, &p->target,
+							 &p->targetlen ) ||
+		 ( p->random = open( "/dev/urandom", O_RDONLY | O_CLOEXEC ) ) < 0 ||
+		 ( p->listenfd = socket( addr.ss_family, SOCK_STREAM |
+								 SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ) < 0 ||
+		 setsockopt( p->listenfd, SOL_SOCKET, SO_REUSEADDR, &one,
+					 sizeof( one ) ) ||
+		 bind( p->listenfd, (struct sockaddr *) &addr, len ) ||
+		 listen( p->listenfd, 1024 ) ||
+		 ( p->epfd = epoll_create1( EPOLL_CLOEXEC ) ) < 0 ||
+		 ( p->stopfd = eventfd( 0, EFD_CLOEXEC ) ) < 0 )
+		goto fail;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = p;
+	if ( epoll_ctl( p->epfd, EPOLL_CTL_ADD, p->listenfd, &ev ) )
+		goto fail;
+	ev.data.ptr = &p->stopfd;
+	if ( epoll_ctl( p->epfd, EPOLL_CTL_ADD, p->stopfd, &ev ) )
+		goto fail;
+
+	error = pthread_create( &p->thread, NULL, rijn_proxy_thread, p );
+	if ( error == 0 )
+		return p;
+	errno = error;
+
+fail:
+	error = errno;
+	if ( p->stopfd >= 0 )
+		close( p->stopfd );
+	if ( p->epfd >= 0 )
+		close( p->epfd );
+	if ( p->listenfd >= 0 )
+		close( p->listenfd );
+	if ( p->random >= 0 )
+		close( p->random );
+	memset( &p->ctx, 0, sizeof( p->ctx ) );
+	free( p );
+	errno = error;
+	return NULL;
+#else
+	(void) ctx;
+	(void) mode;
+	(void) host;
+	(void) port;
+	(void) target_host;
+	(void) target_port;
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+
+int rijn_proxy_port( rijn_proxy *proxy )
+{
+#ifdef __linux__
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof( addr );
+
+	if ( getsockname( proxy->listenfd, (struct sockaddr *) &addr, &len ) )
+		return -1;
+	if ( addr.ss_family == AF_INET6 )
+		return ntohs( ( (struct sockaddr_in6 *) &addr )->sin6_port );
+	return ntohs( ( (struct sockaddr_in *) &addr )->sin_port );
+#else
+	(void) proxy;
+	return -1;
+#endif
+}
+
+
+void rijn_proxy_stats( rijn_proxy *proxy, uint64_t *connections,
+					   uint64_t *bytes )
+{
+#ifdef __linux__
+	*connections = __atomic_load_n( &proxy->connections, __ATOMIC_RELAXED );
+	*bytes = __atomic_load_n( &proxy->bytes, __ATOMIC_RELAXED );
+#else
+	(void) proxy;
+	*connections = *bytes = 0;
+#endif
+}
+
+
+void rijn_proxy_stop( rijn_proxy *proxy )
+{
+#ifdef __linux__
+	rijn_proxy_buf *b;
+	uint64_t one = 1;
+
+	if ( proxy == NULL )
+		return;
+	if ( write( proxy->stopfd, &one, sizeof( one ) ) == sizeof( one ) )
+		pthread_join( proxy->thread, NULL );
+
+	while ( proxy->links != NULL )
+		rijn_proxy_close( proxy, proxy->links );
+	while ( ( b = proxy->pool ) != NULL )
+	{
+		proxy->pool = b->next;
+		free( b );
+	}
+	close( proxy->stopfd );
+	close( proxy->epfd );
+	close( proxy->listenfd );
+	close( proxy->random );
+	memset( &proxy->ctx, 0, sizeof( proxy->ctx ) );
+	free( proxy );
+#else
+	(void) proxy;
+#endif
+}
+
+
+#ifdef RIJN_PROXY_MAIN
+
+#include <signal.h>
+#include <stdio.h>
+
+int main( int argc, char *argv[] )
+{
+	rijn_context ctx;
+	rijn_proxy *proxy;
+	uint8_t key[33];
+	sigset_t set;
+	FILE *f;
+	size_t n = 0;
+	int sig;
+
+	if ( argc != 7 || ( strcmp( argv[1], "seal" ) && strcmp( argv[1], "open" ) ) )
+	{
+		fprintf( stderr, "usage: %s seal|open keyfile host port target-host "
+				 "target-port\n", argv[0] );
+		return EXIT_FAILURE;
+	}
+	f = fopen( argv[2], "rb" );
+	if ( f != NULL )
+	{
+		n = fread( key, 1, sizeof( key ), f );
+		fclose( f );
+	}
+	if ( ( n != 16 && n != 24 && n != 32 ) ||
+		 rijn_set_key( &ctx, key, (int) n * 8, 128 ) )
+	{
+		fprintf( stderr, "%s: %s: need a 16, 24 or 32-byte key\n", argv[0],
+				 argv[2] );
+		return EXIT_FAILURE;
+	}
+	memset( key, 0, sizeof( key ) );
+
+	/* block the signals before the proxy's thread starts, then wait */
+	sigemptyset( &set );
+	sigaddset( &set, SIGINT );
+	sigaddset( &set, SIGTERM );
+	pthread_sigmask( SIG_BLOCK, &set, NULL );
+
+	proxy = rijn_proxy_start( &ctx, strcmp( argv[1], "seal" ) ?
+							  RIJN_PROXY_OPEN : RIJN_PROXY_SEAL, argv[3],
+							  argv[4], argv[5], argv[6] );
+	memset( &ctx, 0, sizeof( ctx ) );
+	if ( proxy == NULL )
+	{
+		fprintf( stderr, "%s: %s\n", argv[0], strerror( errno ) );
+		return EXIT_FAILURE;
+	}
+	sigwait( &set, &sig );
+	rijn_proxy_stop( proxy );
+
+	return EXIT_SUCCESS;
+}
+
+#endif /* RIJN_PROXY_MAIN */
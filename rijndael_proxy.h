@@ -0,0 +1,32 @@
+#ifndef RIJNDAEL_PROXY_H_
+#define RIJNDAEL_PROXY_H_
+
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RIJN_PROXY_SEAL		0	/* clients send plaintext, target gets records */
+#define RIJN_PROXY_OPEN		1	/* clients send records, target gets plaintext */
+
+typedef struct rijn_proxy rijn_proxy;
+
+rijn_proxy *rijn_proxy_start( rijn_context *ctx, int mode, const char *host,
+							  const char *port, const char *target_host,
+							  const char *target_port );
+
+int rijn_proxy_port( rijn_proxy *proxy );
+
+void rijn_proxy_stats( rijn_proxy *proxy, uint64_t *connections,
+					   uint64_t *bytes );
+
+void rijn_proxy_stop( rijn_proxy *proxy );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_PROXY_H_ */
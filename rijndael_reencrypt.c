@@ -0,0 +1,271 @@
+/*
+ *	Fused re-encryption for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * USING rijndael_reencrypt.c/rijndael_reencrypt.h:
+ *
+ * Re-encryption (key rotation) decrypts data under one key and mode and
+ * encrypts it under another.  Doing that as two calls over the whole
+ * buffer reads and writes all of it twice from memory; these functions
+ * instead go through it a tile at a time (RIJN_REENCRYPT_TILE bytes), so
+ * each tile is still in cache when it is encrypted again.
+ *
+ * int rijn_reencrypt( int from_mode, rijn_context *from, uint8_t *from_iv,
+ *					   int to_mode, rijn_context *to, uint8_t *to_iv,
+ *					   uint8_t *input, uint8_t *output, size_t nbytes );
+ *
+ * decrypts nbytes of input with from in from_mode and encrypts the result
+ * to output with to in to_mode, where each mode is RIJN_REENCRYPT_ECB,
+ * RIJN_REENCRYPT_CBC or RIJN_REENCRYPT_CTR.  from_iv and to_iv are the CBC
+ * initialization vectors or CTR counters (ignored for ECB), and are left
+ * as the matching rijn_cbc_decrypt, rijn_cbc_encrypt or rijn_ctr_crypt call
+ * would leave them.  The two block lengths may differ; nbytes must be a
+ * multiple of the block length of each side in ECB or CBC mode.  input and
+ * output may be the same.  Returns 0 on success or 1 with errno EINVAL on
+ * an invalid mode or length.
+ *
+ * int rijn_reencrypt_parallel( int from_mode, rijn_context *from,
+ *								uint8_t *from_iv, int to_mode,
+ *								rijn_context *to, uint8_t *to_iv,
+ *								uint8_t *input, uint8_t *output,
+ *								size_t nbytes, int nthreads );
+ *
+ * does the same with input split into nthreads contiguous ranges, each
+ * re-encrypted by rijn_reencrypt on a thread of its own.  A CBC
+ * destination chains each block to the one before it, so it runs on the
+ * calling thread alone.  Link with -lpthread.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rijndael.h"
+#include "rijndael_reencrypt.h"
+
+#define RIJN_REENCRYPT_TILE		( 16 * 1024 )	/* bytes per fused step */
+#define RIJN_REENCRYPT_THREADS	64				/* most ranges in parallel */
+
+typedef struct
+{
+	int from_mode, to_mode;
+	rijn_context *from, *to;
+	uint8_t from_iv[32], to_iv[32];
+	uint8_t *input, *output;
+	size_t nbytes;
+} rijn_reencrypt_range;
+
+
+static int rijn_reencrypt_check( int mode, rijn_context *ctx, size_t nbytes )
+{
+	if ( mode < RIJN_REENCRYPT_ECB || mode > RIJN_REENCRYPT_CTR ||
+		 ctx->blocklen <= 0 ||
+		 ( mode != RIJN_REENCRYPT_CTR && nbytes % ctx->blocklen ) )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	return (0);
+}
+
+
+/* Least common multiple of the two block lengths, so tiles and ranges
+   break on block boundaries of both sides. */
+static size_t rijn_reencrypt_unit( rijn_context *from, rijn_context *to )
+{
+	size_t a = from->blocklen, b = to->blocklen, t;
+
+	while ( b )
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return (size_t) from->blocklen / a * to->blocklen;
+}
+
+
+/* Add k to a big-endian counter block. */
+static void rijn_reencrypt_advance( uint8_t *counter, int blocklen,
+									uint64_t k )
+{
+	unsigned carry = 0;
+	int i;
+
+	for ( i = blocklen - 1; i >= 0 && ( k || carry ); i-- )
+	{
+		carry += counter[i] + (unsigned) ( k & 0xff );
+		counter[i] = (uint8_t) carry;
+		carry >>= 8;
+		k >>= 8;
+	}
+}
+
+
+static void rijn_reencrypt_pass( int mode, int decrypt, rijn_context *ctx,
+								 uint8_t *iv, uint8_t *input,
+								 uint8_t *output, size_t nbytes )
+{
+	switch ( mode )
+	{
+	case RIJN_REENCRYPT_ECB:
+		if ( decrypt )
+			rijn_ecb_decrypt( ctx, input, output, nbytes );
+		else
+			rijn_ecb_encrypt( ctx, input, output, nbytes );
+		break;
+	case RIJN_REENCRYPT_CBC:
+		if ( decrypt )
+			rijn_cbc_decrypt( ctx, iv, input, output, nbytes );
+		else
+			rijn_cbc_encrypt( ctx, iv, input, output, nbytes );
+		break;
+	default:
+		rijn_ctr_crypt( ctx, iv, input, output, nbytes );
+		break;
+	}
+}
+
+
+int rijn_reencrypt( int from_mode, rijn_context *from, uint8_t *from_iv,
+					int to_mode, rijn_context *to, uint8_t *to_iv,
+					uint8_t *input, uint8_t *output, size_t nbytes )
+{
+	size_t i, n, tile;
+
+	if ( rijn_reencrypt_check( from_mode, from, nbytes ) ||
+		 rijn_reencrypt_check( to_mode, to, nbytes ) )
+		return (1);
+
+	tile = rijn_reencrypt_unit( from, to );
+	tile = RIJN_REENCRYPT_TILE < tile ? tile
+									  : RIJN_REENCRYPT_TILE -
+										RIJN_REENCRYPT_TILE % tile;
+
+	/* the tile's plaintext exists only in output, and only while cached */
+	for ( i = 0; i < nbytes; i += n )
+	{
+		n = nbytes - i < tile ? nbytes - i : tile;
+		rijn_reencrypt_pass( from_mode, 1, from, from_iv, input + i,
+							 output + i, n );
+		rijn_reencrypt_pass( to_mode, 0, to, to_iv, output + i, output + i,
+							 n );
+	}
+
+	return (0);
+}
+
+
+static void *rijn_reencrypt_thread( void *arg )
+{
+	rijn_reencrypt_range *r = (rijn_reencrypt_range *) arg;
+
+	rijn_reencrypt( r->from_mode, r->from, r->from_iv, r->to_mode, r->to,
+					r->to_iv, r->input, r->output, r->nbytes );
+
+	return NULL;
+}
+
+
+int rijn_reencrypt_parallel( int from_mode, rijn_context *from,
+							 uint8_t *from_iv, int to_mode, rijn_context *to,
+							 uint8_t *to_iv, uint8_t *input, uint8_t *output,
+							 size_t nbytes, int nthreads )
+{
+	rijn_reencrypt_range range[RIJN_REENCRYPT_THREADS];
+	pthread_t thread[RIJN_REENCRYPT_THREADS];
+	int started[RIJN_REENCRYPT_THREADS];
+	uint8_t last[32];
+	size_t unit, chunk, start;
+	int i, n;
+
+	if ( rijn_reencrypt_check( from_mode, from, nbytes ) ||
+		 rijn_reencrypt_check( to_mode, to, nbytes ) )
+		return (1);
+
+	if ( nthreads > RIJN_REENCRYPT_THREADS )
+		nthreads = RIJN_REENCRYPT_THREADS;
+	unit = rijn_reencrypt_unit( from, to );
+	chunk = nthreads < 2 ? nbytes : ( ( nbytes + nthreads - 1 ) / nthreads +
+									  unit - 1 ) / unit * unit;
+	if ( to_mode == RIJN_REENCRYPT_CBC || chunk >= nbytes ||
+		 chunk < RIJN_REENCRYPT_TILE )
+		return rijn_reencrypt( from_mode, from, from_iv, to_mode, to, to_iv,
+							   input, output, nbytes );
+
+	/* each range's starting state, taken before any of input is
+	   overwritten, since output may be input */
+	if ( from_mode == RIJN_REENCRYPT_CBC )
+		memcpy( last, input + nbytes - from->blocklen, from->blocklen );
+	for ( n = 0, start = 0; start < nbytes; n++, start += chunk )
+	{
+		rijn_reencrypt_range *r = &range[n];
+
+		r->from_mode = from_mode;
+		r->to_mode = to_mode;
+		r->from = from;
+		r->to = to;
+		r->input = input + start;
+		r->output = output + start;
+		r->nbytes = nbytes - start < chunk ? nbytes - start : chunk;
+		if ( from_mode == RIJN_REENCRYPT_CBC )
+			memcpy( r->from_iv, start ? input + start - from->blocklen
+									  : from_iv, from->blocklen );
+		else if ( from_mode == RIJN_REENCRYPT_CTR )
+		{
+			memcpy( r->from_iv, from_iv, from->blocklen );
+			rijn_reencrypt_advance( r->from_iv, from->blocklen,
+									start / from->blocklen );
+		}
+		if ( to_mode == RIJN_REENCRYPT_CTR )
+		{
+			memcpy( r->to_iv, to_iv, to->blocklen );
+			rijn_reencrypt_advance( r->to_iv, to->blocklen,
+									start / to->blocklen );
+		}
+	}
+
+	/* a range whose thread cannot start runs here instead */
+	for ( i = 1; i < n; i++ )
+		started[i] = pthread_create( &thread[i], NULL, rijn_reencrypt_thread,
+									 &range[i] ) == 0;
+	rijn_reencrypt_thread( &range[0] );
+	for ( i = 1; i < n; i++ )
+	{
+		if ( started[i] )
+			pthread_join( thread[i], NULL );
+		else
+			rijn_reencrypt_thread( &range[i] );
+	}
+
+	if ( from_mode == RIJN_REENCRYPT_CBC )
+		memcpy( from_iv, last, from->blocklen );
+	else if ( from_mode == RIJN_REENCRYPT_CTR )
+		rijn_reencrypt_advance( from_iv, from->blocklen,
+								( nbytes + from->blocklen - 1 ) /
+								from->blocklen );
+	if ( to_mode == RIJN_REENCRYPT_CTR )
+		rijn_reencrypt_advance( to_iv, to->blocklen,
+								( nbytes + to->blocklen - 1 ) / to->blocklen );
+
+	return (0);
+}
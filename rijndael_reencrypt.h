@@ -0,0 +1,30 @@
+#ifndef RIJNDAEL_REENCRYPT_H_
+#define RIJNDAEL_REENCRYPT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RIJN_REENCRYPT_ECB	0
+#define RIJN_REENCRYPT_CBC	1
+#define RIJN_REENCRYPT_CTR	2
+
+int rijn_reencrypt( int from_mode, rijn_context *from, uint8_t *from_iv,
+					int to_mode, rijn_context *to, uint8_t *to_iv,
+					uint8_t *input, uint8_t *output, size_t nbytes );
+
+int rijn_reencrypt_parallel( int from_mode, rijn_context *from,
+							 uint8_t *from_iv, int to_mode, rijn_context *to,
+							 uint8_t *to_iv, uint8_t *input, uint8_t *output,
+							 size_t nbytes, int nthreads );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_REENCRYPT_H_ */
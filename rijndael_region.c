@@ -0,0 +1,530 @@
+/*
+ *	Encrypted memory regions for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USING rijndael_region.c/rijndael_region.h:
+ *
+ * A region is memory whose pages are kept encrypted except while they are
+ * in use, so that only the working set is ever in plaintext.  Linux only.
+ *
+ * rijn_region *rijn_region_create( rijn_context *ctx, size_t size,
+ *									unsigned interval_ms );
+ *
+ * maps size bytes (rounded up to whole pages) of zeroed memory and returns
+ * the region, or NULL with errno set.  ctx must have been set up by
+ * rijn_set_key with 128-bit blocks; the region keeps its own copy.  Every
+ * interval_ms milliseconds a background thread calls rijn_region_scan;
+ * with 0 there is no thread and the caller scans.
+ *
+ * void *rijn_region_base( rijn_region *region );
+ * size_t rijn_region_size( rijn_region *region );
+ *
+ * give the address and size of the memory, which is used like any other.
+ *
+ * size_t rijn_region_scan( rijn_region *region );
+ *
+ * is one sweep of a clock: a plaintext page is made inaccessible, and a
+ * page still untouched since the previous sweep is encrypted.  Returns the
+ * number of pages encrypted.
+ *
+ * size_t rijn_region_seal( rijn_region *region );
+ *
+ * encrypts every plaintext page now and returns how many there were.
+ *
+ * size_t rijn_region_plain( rijn_region *region );
+ *
+ * returns the number of pages now held in plaintext.
+ *
+ * void rijn_region_destroy( rijn_region *region );
+ *
+ * stops the thread and unmaps the memory.  No thread may be using it.  It
+ * first waits for any fault handler still looking through the regions, so
+ * a fault elsewhere never reads a freed one.
+ *
+ * The pages live in a memfd mapped shared twice: the region itself, whose
+ * page protections are switched with mprotect, and an always read-write
+ * alias, not handed out, through which pages are encrypted and decrypted
+ * while the region's view of them is inaccessible.  A SIGSEGV handler,
+ * installed with the first region, catches the first touch of an
+ * inaccessible page, decrypts the page if needed and opens it.  A fault
+ * outside every region is passed on as the handler that was there before
+ * would have taken it: that handler is called, an ignored signal that was
+ * sent rather than caused by a fault is ignored, and otherwise the default
+ * action ends the process.  The handler holds off shadow verification
+ * (rijndael_shadow.c), whose hooks are not safe in a signal handler.  A
+ * thread touching a page that is being encrypted or decrypted sleeps until
+ * that is finished.
+ *
+ * Pages are encrypted with XEX (the tweakable mode underlying XTS) under
+ * the region's key: block j of page p is E(P ^ T) ^ T with T = E(p) * x^j
+ * in GF(2^128), so equal plaintext encrypts differently on every page and
+ * at every offset within a page.
+ *
+ * Link with -lpthread.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE			/* for memfd_create */
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <linux/futex.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+#endif
+
+#include "rijndael.h"
+#include "rijndael_region.h"
+
+/* page states */
+#define RIJN_PAGE_EMPTY		0	/* never touched: zero, inaccessible */
+#define RIJN_PAGE_CIPHER	1	/* encrypted, inaccessible */
+#define RIJN_PAGE_COOL		2	/* plaintext, inaccessible until touched */
+#define RIJN_PAGE_PLAIN		3	/* plaintext, accessible */
+#define RIJN_PAGE_BUSY		4	/* being changed; wait */
+#define RIJN_PAGE_WAITED	8	/* with BUSY: a thread sleeps on the change */
+
+struct rijn_region
+{
+	rijn_context ctx;
+	uint8_t *base;			/* the caller's view */
+	uint8_t *alias;			/* always read-write */
+	size_t size;
+	size_t pagesize;
+	size_t npages;
+	int fd;					/* memfd backing both views */
+	uint32_t *state;		/* RIJN_PAGE_* per page, futex words */
+	unsigned interval_ms;
+	int stop;
+	pthread_t thread;
+	rijn_region *next;		/* in the list the fault handler searches */
+};
+
+#ifdef __linux__
+
+static rijn_region *rijn_regions;	/* read lock-free by the handler */
+static pthread_mutex_t rijn_regions_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned rijn_region_epoch;			/* handlers count in its parity */
+static unsigned rijn_region_readers[2];	/* handlers in, by epoch parity */
+static struct sigaction rijn_region_oldact;
+static int rijn_region_installed;
+
+
+/* Multiply a little-endian GF(2^128) element by x, as XTS does. */
+static void rijn_region_double( uint8_t *t )
+{
+	int i, carry = t[15] >> 7;
+
+	for ( i = 15; i > 0; i-- )
+		t[i] = (uint8_t) ( ( t[i] << 1 ) | ( t[i - 1] >> 7 ) );
+	t[0] = (uint8_t) ( ( t[0] << 1 ) ^ ( carry ? 0x87 : 0 ) );
+}
+
+
+/* XOR the tweak of every block of page p into data. */
+static void rijn_region_tweak( rijn_region *r, size_t p, uint8_t *data )
+{
+	uint8_t t[16];
+	size_t j;
+	int i;
+
+	memset( t, 0, sizeof( t ) );
+	for ( i = 0; i < 8; i++ )
+		t[i] = (uint8_t) ( (uint64_t) p >> ( 8 * i ) );
+	rijn_encrypt( &r->ctx, t, t );
+
+	for ( j = 0; j < r->pagesize; j += 16 )
+	{
+		for ( i = 0; i < 16; i++ )
+			data[j + i] ^= t[i];
+		rijn_region_double( t );
+	}
+}
+
+
+/* Encrypt or decrypt page p in place through the alias. */
+static void rijn_region_xex( rijn_region *r, size_t p, int decrypt )
+{
+	uint8_t *data = r->alias + p * r->pagesize;
+
+	rijn_region_tweak( r, p, data );
+	if ( decrypt )
+		rijn_ecb_decrypt( &r->ctx, data, data, r->pagesize );
+	else
+		rijn_ecb_encrypt( &r->ctx, data, data, r->pagesize );
+	rijn_region_tweak( r, p, data );
+}
+
+
+/* Take page p for a change, sleeping through another thread's (a futex
+   wait is safe in the fault handler).  Returns the state it was in. */
+static int rijn_region_take( rijn_region *r, size_t p )
+{
+	uint32_t s;
+
+	for ( ;; )
+	{
+		s = __atomic_load_n( &r->state[p], __ATOMIC_ACQUIRE );
+		if ( s == RIJN_PAGE_BUSY &&
+			 !__atomic_compare_exchange_n( &r->state[p], &s,
+					RIJN_PAGE_BUSY | RIJN_PAGE_WAITED, 0, __ATOMIC_ACQUIRE,
+					__ATOMIC_RELAXED ) )
+			continue;
+		if ( s & RIJN_PAGE_BUSY )
+			syscall( SYS_futex, &r->state[p], FUTEX_WAIT_PRIVATE,
+					 RIJN_PAGE_BUSY | RIJN_PAGE_WAITED, NULL, NULL, 0 );
+		else if ( __atomic_compare_exchange_n( &r->state[p], &s,
+					RIJN_PAGE_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+			return (int) s;
+	}
+}
+
+
+/* Leave page p in state s, waking whoever waited for it. */
+static void rijn_region_give( rijn_region *r, size_t p, int s )
+{
+	if ( __atomic_exchange_n( &r->state[p], (uint32_t) s, __ATOMIC_RELEASE ) &
+		 RIJN_PAGE_WAITED )
+		syscall( SYS_futex, &r->state[p], FUTEX_WAKE_PRIVATE, INT_MAX,
+				 NULL, NULL, 0 );
+}
+
+
+/* Open page p to the caller, decrypting it first if it is encrypted. */
+static void rijn_region_open( rijn_region *r, size_t p )
+{
+	int s = rijn_region_take( r, p );
+
+	if ( s == RIJN_PAGE_CIPHER )
+		rijn_region_xex( r, p, 1 );
+	if ( s != RIJN_PAGE_PLAIN )
+		mprotect( r->base + p * r->pagesize, r->pagesize,
+				  PROT_READ | PROT_WRITE );
+	rijn_region_give( r, p, RIJN_PAGE_PLAIN );
+}
+
+
+static void rijn_region_fault( int sig, siginfo_t *info, void *uctx )
+{
+	uint8_t *addr = (uint8_t *) info->si_addr;
+	struct sigaction dfl, ours;
+	int saved = errno;
+	unsigned e;
+	rijn_region *r;
+
+	/* counted in, so rijn_region_destroy waits before freeing a region
+	   this may be looking at */
+	e = __atomic_load_n( &rijn_region_epoch, __ATOMIC_SEQ_CST ) & 1;
+	__atomic_add_fetch( &rijn_region_readers[e], 1, __ATOMIC_SEQ_CST );
+	for ( r = __atomic_load_n( &rijn_regions, __ATOMIC_SEQ_CST ); r;
+		  r = r->next )
+	{
+		if ( addr >= r->base && addr < r->base + r->size )
+		{
+			rijn_hold_shadow( 1 );
+			rijn_region_open( r, ( addr - r->base ) / r->pagesize );
+			rijn_hold_shadow( 0 );
+			break;
+		}
+	}
+	__atomic_sub_fetch( &rijn_region_readers[e], 1, __ATOMIC_RELEASE );
+	if ( r != NULL )
+	{
+		errno = saved;
+		return;
+	}
+
+	/* not ours */
+	if ( rijn_region_oldact.sa_flags & SA_SIGINFO )
+		rijn_region_oldact.sa_sigaction( sig, info, uctx );
+	else if ( rijn_region_oldact.sa_handler != SIG_DFL &&
+			  rijn_region_oldact.sa_handler != SIG_IGN )
+		rijn_region_oldact.sa_handler( sig );
+	else if ( rijn_region_oldact.sa_handler == SIG_DFL || info->si_code > 0 )
+	{
+		/* the default action, which a fault gets even when ignored; this
+		   handler is put back should the signal be blocked and raise
+		   return */
+		memset( &dfl, 0, sizeof( dfl ) );
+		dfl.sa_handler = SIG_DFL;
+		sigemptyset( &dfl.sa_mask );
+		sigaction( sig, &dfl, &ours );
+		raise( sig );
+		sigaction( sig, &ours, NULL );
+	}
+	errno = saved;
+}
+
+
+static void *rijn_region_thread( void *arg )
+{
+	rijn_region *r = (rijn_region *) arg;
+	struct timespec pause;
+
+	pause.tv_sec = r->interval_ms / 1000;
+	pause.tv_nsec = ( r->interval_ms % 1000 ) * 1000000L;
+	while ( !__atomic_load_n( &r->stop, __ATOMIC_ACQUIRE ) )
+	{
+		nanosleep( &pause, NULL );
+		rijn_region_scan( r );
+	}
+
+	return NULL;
+}
+
+#endif /* __linux__ */
+
+
+rijn_region *rijn_region_create( rijn_context *ctx, size_t size,
+								 unsigned interval_ms )
+{
+#ifdef __linux__
+	struct sigaction act;
+	rijn_region *r;
+
+	if ( ctx->blocklen != 16 || size == 0 )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	r = (rijn_region *) calloc( 1, sizeof( *r ) );
+	if ( r == NULL )
+		return NULL;
+	r->ctx = *ctx;
+	r->pagesize = (size_t) sysconf( _SC_PAGESIZE );
+	r->npages = ( size + r->pagesize - 1 ) / r->pagesize;
+	r->size = r->npages * r->pagesize;
+	r->interval_ms = interval_ms;
+	r->base = r->alias = (uint8_t *) MAP_FAILED;
+	r->state = (uint32_t *) calloc( r->npages, sizeof( *r->state ) );
+	r->fd = memfd_create( "rijn_region", MFD_CLOEXEC );
+	if ( r->state == NULL || r->fd < 0 ||
+		 ftruncate( r->fd, (off_t) r->size ) )
+		goto fail;
+	r->base = (uint8_t *) mmap( NULL, r->size, PROT_NONE, MAP_SHARED,
+								r->fd, 0 );
+	r->alias = (uint8_t *) mmap( NULL, r->size, PROT_READ | PROT_WRITE,
+								 MAP_SHARED, r->fd, 0 );
+	if ( r->base == MAP_FAILED || r->alias == MAP_FAILED )
+		goto fail;
+	madvise( r->base, r->size, MADV_DONTDUMP );
+	madvise( r->alias, r->size, MADV_DONTDUMP );
+
+	pthread_mutex_lock( &rijn_regions_lock );
+	if ( !rijn_region_installed )
+	{
+		memset( &act, 0, sizeof( act ) );
+		act.sa_sigaction = rijn_region_fault;
+		act.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigemptyset( &act.sa_mask );
+		if ( sigaction( SIGSEGV, &act, &rijn_region_oldact ) )
+		{
+			pthread_mutex_unlock( &rijn_regions_lock );
+			goto fail;
+		}
+		rijn_region_installed = 1;
+	}
+	r->next = rijn_regions;
+	__atomic_store_n( &rijn_regions, r, __ATOMIC_RELEASE );
+	pthread_mutex_unlock( &rijn_regions_lock );
+
+	if ( interval_ms && pthread_create( &r->thread, NULL,
+										rijn_region_thread, r ) )
+	{
+		r->interval_ms = 0;
+		rijn_region_destroy( r );
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	return r;
+
+fail:
+	size = errno;
+	if ( r->alias != MAP_FAILED )
+		munmap( r->alias, r->size );
+	if ( r->base != MAP_FAILED )
+		munmap( r->base, r->size );
+	if ( r->fd >= 0 )
+		close( r->fd );
+	free( r->state );
+	free( r );
+	errno = (int) size;
+	return NULL;
+#else
+	(void) ctx;
+	(void) size;
+	(void) interval_ms;
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+
+void *rijn_region_base( rijn_region *region )
+{
+	return region->base;
+}
+
+
+size_t rijn_region_size( rijn_region *region )
+{
+	return region->size;
+}
+
+
+size_t rijn_region_scan( rijn_region *region )
+{
+	size_t p, count = 0;
+#ifdef __linux__
+	rijn_region *r = region;
+	uint32_t s;
+
+	for ( p = 0; p < r->npages; p++ )
+	{
+		s = __atomic_load_n( &r->state[p], __ATOMIC_RELAXED );
+		if ( s != RIJN_PAGE_PLAIN && s != RIJN_PAGE_COOL )
+			continue;
+		s = rijn_region_take( r, p );
+		if ( s == RIJN_PAGE_PLAIN )
+		{
+			/* close it; a touch before the next sweep reopens it */
+			mprotect( r->base + p * r->pagesize, r->pagesize, PROT_NONE );
+			s = RIJN_PAGE_COOL;
+		}
+		else if ( s == RIJN_PAGE_COOL )
+		{
+			rijn_region_xex( r, p, 0 );
+			s = RIJN_PAGE_CIPHER;
+			count++;
+		}
+		rijn_region_give( r, p, s );
+	}
+#else
+	(void) region;
+	(void) p;
+#endif
+
+	return count;
+}
+
+
+size_t rijn_region_seal( rijn_region *region )
+{
+	size_t p, count = 0;
+#ifdef __linux__
+	rijn_region *r = region;
+	uint32_t s;
+
+	for ( p = 0; p < r->npages; p++ )
+	{
+		s = __atomic_load_n( &r->state[p], __ATOMIC_RELAXED );
+		if ( s != RIJN_PAGE_PLAIN && s != RIJN_PAGE_COOL )
+			continue;
+		s = rijn_region_take( r, p );
+		if ( s == RIJN_PAGE_PLAIN )
+			mprotect( r->base + p * r->pagesize, r->pagesize, PROT_NONE );
+		if ( s == RIJN_PAGE_PLAIN || s == RIJN_PAGE_COOL )
+		{
+			rijn_region_xex( r, p, 0 );
+			s = RIJN_PAGE_CIPHER;
+			count++;
+		}
+		rijn_region_give( r, p, s );
+	}
+#else
+	(void) region;
+	(void) p;
+#endif
+
+	return count;
+}
+
+
+size_t rijn_region_plain( rijn_region *region )
+{
+	size_t p, count = 0;
+	uint32_t s;
+
+	for ( p = 0; p < region->npages; p++ )
+	{
+		s = __atomic_load_n( &region->state[p], __ATOMIC_RELAXED );
+		count += s == RIJN_PAGE_PLAIN || s == RIJN_PAGE_COOL;
+	}
+
+	return count;
+}
+
+
+void rijn_region_destroy( rijn_region *region )
+{
+#ifdef __linux__
+	rijn_region **link;
+	unsigned e;
+	int i;
+
+	if ( region == NULL )
+		return;
+
+	if ( region->interval_ms )
+	{
+		__atomic_store_n( &region->stop, 1, __ATOMIC_RELEASE );
+		pthread_join( region->thread, NULL );
+	}
+
+	/* unlink it, then wait out every handler that may have found it: one
+	   that counted itself in before the unlink did so under the current
+	   epoch or, if it read the epoch before the last destroy moved it on,
+	   under the one before, so each parity is moved past and drained */
+	pthread_mutex_lock( &rijn_regions_lock );
+	for ( link = &rijn_regions; *link; link = &( *link )->next )
+	{
+		if ( *link == region )
+		{
+			__atomic_store_n( link, region->next, __ATOMIC_SEQ_CST );
+			break;
+		}
+	}
+	for ( i = 0; i < 2; i++ )
+	{
+		e = __atomic_fetch_add( &rijn_region_epoch, 1, __ATOMIC_SEQ_CST ) & 1;
+		while ( __atomic_load_n( &rijn_region_readers[e], __ATOMIC_SEQ_CST ) )
+			sched_yield();
+	}
+	pthread_mutex_unlock( &rijn_regions_lock );
+
+	munmap( region->alias, region->size );
+	munmap( region->base, region->size );
+	close( region->fd );
+	memset( &region->ctx, 0, sizeof( region->ctx ) );
+	free( region->state );
+	free( region );
+#else
+	(void) region;
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef RIJNDAEL_REGION_H_
+#define RIJNDAEL_REGION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rijn_region rijn_region;
+
+rijn_region *rijn_region_create( rijn_context *ctx, size_t size,
+								 unsigned interval_ms );
+
+void *rijn_region_base( rijn_region *region );
+
+size_t rijn_region_size( rijn_region *region );
+
+size_t rijn_region_scan( rijn_region *region );
+
+size_t rijn_region_seal( rijn_region *region );
+
+size_t rijn_region_plain( rijn_region *region );
+
+void rijn_region_destroy( rijn_region *region );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_REGION_H_ */
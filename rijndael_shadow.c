@@ -0,0 +1,359 @@
+/*
+ *	Shadow verification for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * USING rijndael_shadow.c/rijndael_shadow.h:
+ *
+ * Shadow verification checks a build's kernels in production: one call in
+ * rate to rijn_ecb_encrypt, rijn_ecb_decrypt, rijn_cbc_encrypt,
+ * rijn_cbc_decrypt or rijn_ctr_crypt (and so to everything built on them)
+ * has its input and output copied, and a background thread works the same
+ * result out again with the reference kernel, the generated T-tables one
+ * block at a time, and compares.  Whatever backend, table variant or
+ * compiler flags made the original, a difference is counted and reported.
+ *
+ * int rijn_shadow_start( unsigned rate, rijn_shadow_callback callback,
+ *						  void *arg );
+ *
+ * starts checking one call in rate on each thread.  On a mismatch, callback
+ * (if not NULL) is called on the shadow thread as callback( op, nbytes,
+ * arg ), op being one of the RIJN_SHADOW_ constants in rijndael.h and
+ * nbytes the bytes compared.  Returns 0, or 1 with errno EINVAL if rate is
+ * 0, EBUSY if checking is already on, or as pthread_create sets it.
+ *
+ * void rijn_shadow_get_stats( rijn_shadow_stats *stats );
+ *
+ * fills in the counts since rijn_shadow_start, including the time the
+ * sampled calls spent taking their samples, which is all the checking adds
+ * to the calling threads, and the time spent recomputing.
+ *
+ * void rijn_shadow_stop( void );
+ *
+ * turns the hooks off, lets the thread check what is queued and stops it.
+ *
+ * At most RIJN_SHADOW_MAXBYTES of a call are kept and checked, and at
+ * most RIJN_SHADOW_QUEUE samples wait; when the thread falls behind,
+ * samples are dropped rather than making callers wait.  Calls made under
+ * rijn_hold_shadow, as in rijndael_region.c's fault handler, are never
+ * sampled.  Link with -lpthread.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rijndael.h"
+#include "rijndael_shadow.h"
+
+#define RIJN_SHADOW_MAXBYTES	65536	/* most bytes of a call checked */
+#define RIJN_SHADOW_QUEUE		64		/* most samples waiting */
+
+typedef struct rijn_shadow_sample
+{
+	struct rijn_shadow_sample *next;
+	int op;
+	rijn_context ctx;
+	uint8_t iv[32];
+	size_t nbytes;		/* bytes kept, of input and then of output */
+	uint64_t start;		/* when the sample was begun, in ns */
+	uint8_t data[];
+} rijn_shadow_sample;
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int running;
+	unsigned rate;
+	rijn_shadow_sample *head, *tail;
+	int queued;
+	rijn_shadow_callback callback;
+	void *arg;
+	rijn_shadow_stats stats;
+} rijn_shadow_state =
+{
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
+
+static __thread unsigned rijn_shadow_calls;	/* calls on this thread */
+
+
+static uint64_t rijn_shadow_now( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return( ( uint64_t )ts.tv_sec * 1000000000 + ts.tv_nsec );
+}
+
+
+static void rijn_shadow_add( uint64_t *counter, uint64_t n )
+{
+	__atomic_add_fetch( counter, n, __ATOMIC_RELAXED );
+}
+
+
+static void *rijn_shadow_begin_hook( int op, rijn_context *ctx,
+									 const uint8_t *iv, const uint8_t *input,
+									 size_t nbytes )
+{
+	rijn_shadow_sample *s;
+	uint64_t start;
+	size_t n = nbytes;
+
+	if ( rijn_shadow_calls++ %
+		 __atomic_load_n( &rijn_shadow_state.rate, __ATOMIC_RELAXED ) )
+		return( NULL );
+
+	start = rijn_shadow_now();
+	if ( n > RIJN_SHADOW_MAXBYTES )
+		n = RIJN_SHADOW_MAXBYTES;
+	if ( op != RIJN_SHADOW_CTR )
+		n -= n % ctx->blocklen;
+	s = ( rijn_shadow_sample * )malloc( sizeof( *s ) + 2 * n );
+	if ( s == NULL )
+	{
+		rijn_shadow_add( &rijn_shadow_state.stats.dropped, 1 );
+		return( NULL );
+	}
+	s->op = op;
+	s->ctx = *ctx;
+	if ( iv )
+		memcpy( s->iv, iv, ctx->blocklen );
+	s->nbytes = n;
+	s->start = start;
+	memcpy( s->data, input, n );
+
+	return( s );
+}
+
+
+static void rijn_shadow_end_hook( void *sample, const uint8_t *output )
+{
+	rijn_shadow_sample *s = ( rijn_shadow_sample * )sample;
+	uint64_t start = s->start;
+
+	memcpy( s->data + s->nbytes, output, s->nbytes );
+	s->next = NULL;
+
+	pthread_mutex_lock( &rijn_shadow_state.lock );
+	if ( rijn_shadow_state.running &&
+		 rijn_shadow_state.queued < RIJN_SHADOW_QUEUE )
+	{
+		if ( rijn_shadow_state.tail )
+			rijn_shadow_state.tail->next = s;
+		else
+			rijn_shadow_state.head = s;
+		rijn_shadow_state.tail = s;
+		rijn_shadow_state.queued++;
+		rijn_shadow_add( &rijn_shadow_state.stats.sampled, 1 );
+		pthread_cond_signal( &rijn_shadow_state.cond );
+		s = NULL;
+	}
+	else
+		rijn_shadow_add( &rijn_shadow_state.stats.dropped, 1 );
+	pthread_mutex_unlock( &rijn_shadow_state.lock );
+
+	if ( s )
+	{
+		memset( s, 0, sizeof( *s ) );
+		free( s );
+	}
+	rijn_shadow_add( &rijn_shadow_state.stats.caller_ns,
+					 rijn_shadow_now() - start );
+}
+
+
+static const rijn_shadow_hooks rijn_shadow_hooks_on =
+{
+	rijn_shadow_begin_hook, rijn_shadow_end_hook
+};
+
+
+/* Work a sample out again with the reference kernel, a block at a time,
+   comparing as it goes; returns 0 if every byte matches. */
+static int rijn_shadow_check( rijn_shadow_sample *s )
+{
+	rijn_context *ref = &s->ctx;
+	const uint8_t *in = s->data, *out = s->data + s->nbytes, *prev;
+	uint8_t block[32], counter[32];
+	size_t i, j, bl = ref->blocklen, n = s->nbytes;
+	int k, diff = 0;
+
+	rijn_set_backend( ref, "ttable-generated" );
+	memcpy( counter, s->iv, bl );
+	for ( i = 0; i < n; i += bl )
+	{
+		switch ( s->op )
+		{
+			case RIJN_SHADOW_ECB_ENCRYPT:
+				rijn_encrypt( ref, ( uint8_t * )in + i, block );
+				break;
+			case RIJN_SHADOW_ECB_DECRYPT:
+				rijn_decrypt( ref, ( uint8_t * )in + i, block );
+				break;
+			case RIJN_SHADOW_CBC_ENCRYPT:
+				prev = i ? out + i - bl : s->iv;
+				for ( j = 0; j < bl; j++ )
+					block[j] = in[i + j] ^ prev[j];
+				rijn_encrypt( ref, block, block );
+				break;
+			case RIJN_SHADOW_CBC_DECRYPT:
+				prev = i ? in + i - bl : s->iv;
+				rijn_decrypt( ref, ( uint8_t * )in + i, block );
+				for ( j = 0; j < bl; j++ )
+					block[j] ^= prev[j];
+				break;
+			default:
+				rijn_encrypt( ref, counter, block );
+				for ( k = ( int )bl - 1; k >= 0 && ++counter[k] == 0; k-- )
+					;
+				for ( j = 0; j < bl && i + j < n; j++ )
+					block[j] ^= in[i + j];
+				break;
+		}
+		for ( j = 0; j < bl && i + j < n; j++ )
+			diff |= block[j] ^ out[i + j];
+	}
+	memset( block, 0, sizeof( block ) );
+	memset( counter, 0, sizeof( counter ) );
+
+	return( diff != 0 );
+}
+
+
+static void *rijn_shadow_thread( void *arg )
+{
+	rijn_shadow_sample *s;
+	uint64_t start;
+
+	pthread_mutex_lock( &rijn_shadow_state.lock );
+	for ( ;; )
+	{
+		while ( rijn_shadow_state.running && !rijn_shadow_state.head )
+			pthread_cond_wait( &rijn_shadow_state.cond,
+							   &rijn_shadow_state.lock );
+		if ( ( s = rijn_shadow_state.head ) == NULL )
+			break;
+		if ( ( rijn_shadow_state.head = s->next ) == NULL )
+			rijn_shadow_state.tail = NULL;
+		rijn_shadow_state.queued--;
+		pthread_mutex_unlock( &rijn_shadow_state.lock );
+
+		start = rijn_shadow_now();
+		if ( rijn_shadow_check( s ) )
+		{
+			rijn_shadow_add( &rijn_shadow_state.stats.mismatches, 1 );
+			if ( rijn_shadow_state.callback )
+				rijn_shadow_state.callback( s->op, s->nbytes,
+											rijn_shadow_state.arg );
+		}
+		rijn_shadow_add( &rijn_shadow_state.stats.checked, 1 );
+		rijn_shadow_add( &rijn_shadow_state.stats.bytes, s->nbytes );
+		rijn_shadow_add( &rijn_shadow_state.stats.shadow_ns,
+						 rijn_shadow_now() - start );
+		memset( s, 0, sizeof( *s ) + 2 * s->nbytes );
+		free( s );
+
+		pthread_mutex_lock( &rijn_shadow_state.lock );
+	}
+	pthread_mutex_unlock( &rijn_shadow_state.lock );
+
+	return( arg );
+}
+
+
+int rijn_shadow_start( unsigned rate, rijn_shadow_callback callback,
+					   void *arg )
+{
+	rijn_context warm;
+	uint8_t zero[16] = { 0 };
+	int error;
+
+	if ( rate == 0 )
+	{
+		errno = EINVAL;
+		return (1);
+	}
+
+	/* the reference tables, made before the thread needs them */
+	rijn_set_key( &warm, zero, 128, 128 );
+	rijn_set_backend( &warm, "ttable-generated" );
+
+	pthread_mutex_lock( &rijn_shadow_state.lock );
+	if ( rijn_shadow_state.running )
+	{
+		pthread_mutex_unlock( &rijn_shadow_state.lock );
+		errno = EBUSY;
+		return (1);
+	}
+	memset( &rijn_shadow_state.stats, 0, sizeof( rijn_shadow_state.stats ) );
+	rijn_shadow_state.callback = callback;
+	rijn_shadow_state.arg = arg;
+	__atomic_store_n( &rijn_shadow_state.rate, rate, __ATOMIC_RELAXED );
+	rijn_shadow_state.running = 1;
+	error = pthread_create( &rijn_shadow_state.thread, NULL,
+							rijn_shadow_thread, NULL );
+	if ( error )
+		rijn_shadow_state.running = 0;
+	pthread_mutex_unlock( &rijn_shadow_state.lock );
+
+	if ( error )
+	{
+		errno = error;
+		return (1);
+	}
+	rijn_set_shadow( &rijn_shadow_hooks_on );
+
+	return (0);
+}
+
+
+void rijn_shadow_get_stats( rijn_shadow_stats *stats )
+{
+	uint64_t *from = ( uint64_t * )&rijn_shadow_state.stats;
+	uint64_t *to = ( uint64_t * )stats;
+	size_t i;
+
+	for ( i = 0; i < sizeof( *stats ) / sizeof( uint64_t ); i++ )
+		to[i] = __atomic_load_n( &from[i], __ATOMIC_RELAXED );
+}
+
+
+void rijn_shadow_stop( void )
+{
+	int running;
+
+	rijn_set_shadow( NULL );
+
+	pthread_mutex_lock( &rijn_shadow_state.lock );
+	running = rijn_shadow_state.running;
+	rijn_shadow_state.running = 0;
+	pthread_cond_signal( &rijn_shadow_state.cond );
+	pthread_mutex_unlock( &rijn_shadow_state.lock );
+
+	if ( running )
+		pthread_join( rijn_shadow_state.thread, NULL );
+}
@@ -0,0 +1,37 @@
+#ifndef RIJNDAEL_SHADOW_H_
+#define RIJNDAEL_SHADOW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rijndael.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+	uint64_t sampled;		/* calls copied for checking */
+	uint64_t dropped;		/* samples skipped: queue full or out of memory */
+	uint64_t checked;		/* samples recomputed */
+	uint64_t mismatches;	/* samples whose results differed */
+	uint64_t bytes;			/* bytes recomputed */
+	uint64_t caller_ns;		/* time sampled calls spent taking samples */
+	uint64_t shadow_ns;		/* time spent recomputing, on the shadow thread */
+} rijn_shadow_stats;
+
+typedef void ( *rijn_shadow_callback )( int op, size_t nbytes, void *arg );
+
+int rijn_shadow_start( unsigned rate, rijn_shadow_callback callback,
+					   void *arg );
+
+void rijn_shadow_get_stats( rijn_shadow_stats *stats );
+
+void rijn_shadow_stop( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RIJNDAEL_SHADOW_H_ */
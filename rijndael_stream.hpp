@@ -0,0 +1,293 @@
+/*
+ *	C++20 coroutine streams for the Rijndael Cipher functions in rijndael.c.
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USING rijndael_stream.hpp:
+ *
+ * rijn::stream<Executor> wraps a rijn_context and a CBC chaining value so
+ * that a coroutine can encrypt or decrypt a long buffer without holding its
+ * event loop for the whole call:
+ *
+ *	rijn::stream<my_loop> s( &ctx, iv, loop );
+ *	int status = co_await s.encrypt( input, output, nbytes );
+ *
+ * encrypt and decrypt return a rijn::task<int> that yields the same 0 or 1
+ * as rijn_cbc_encrypt and rijn_cbc_decrypt.  Successive calls continue the
+ * same CBC stream, as successive rijn_cbc_* calls with the same iv would.
+ *
+ * The work is done in slices sized to take about the time budget given to
+ * the constructor (default 200 microseconds); the slice size adapts to the
+ * speed measured on earlier slices.  Between slices the coroutine suspends
+ * and hands itself to executor.post( std::coroutine_handle<> ), which must
+ * resume it later, e.g. from the event loop's queue of ready work.
+ *
+ * If an engine from rijndael_engine.h is given, what remains of a call
+ * once it is offload_bytes or more goes to the engine as one RIJN_JOB_BULK
+ * job; the coroutine suspends until an engine thread posts it back through
+ * executor.post, which must then be safe to call from any thread.  If the
+ * engine refuses the job (it is being destroyed), the call yields 1 and
+ * leaves errno as rijn_engine_submit set it.
+ *
+ * A stream may be used by one coroutine at a time, and its buffers must
+ * stay valid until the task completes.
+ */
+
+#ifndef RIJNDAEL_STREAM_HPP_
+#define RIJNDAEL_STREAM_HPP_
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <utility>
+
+#include "rijndael.h"
+#include "rijndael_engine.h"
+
+namespace rijn
+{
+
+/* A lazily started coroutine that resumes its awaiter when it finishes. */
+template< typename T >
+class task
+{
+public:
+	struct promise_type
+	{
+		T value{};
+		std::exception_ptr error;
+		std::coroutine_handle<> continuation;
+
+		task get_return_object()
+		{
+			return task( std::coroutine_handle< promise_type >::
+						 from_promise( *this ) );
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		auto final_suspend() noexcept
+		{
+			struct final_awaiter
+			{
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(
+						std::coroutine_handle< promise_type > h ) noexcept
+				{
+					if ( h.promise().continuation )
+						return h.promise().continuation;
+					return std::noop_coroutine();
+				}
+				void await_resume() noexcept {}
+			};
+			return final_awaiter{};
+		}
+		void return_value( T v ) { value = std::move( v ); }
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	task( task &&other ) noexcept : h_( std::exchange( other.h_, {} ) ) {}
+	task( const task & ) = delete;
+	task &operator=( const task & ) = delete;
+	~task()
+	{
+		if ( h_ )
+			h_.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiter )
+	{
+		h_.promise().continuation = awaiter;
+		return h_;
+	}
+	T await_resume()
+	{
+		if ( h_.promise().error )
+			std::rethrow_exception( h_.promise().error );
+		return std::move( h_.promise().value );
+	}
+
+	/* For callers outside a coroutine: start the task, then test done(). */
+	void start() { h_.resume(); }
+	bool done() const { return h_.done(); }
+	T result() { return await_resume(); }
+
+private:
+	explicit task( std::coroutine_handle< promise_type > h ) : h_( h ) {}
+
+	std::coroutine_handle< promise_type > h_;
+};
+
+
+template< typename Executor >
+class stream
+{
+public:
+	stream( rijn_context *ctx, const uint8_t *iv, Executor &executor,
+			std::chrono::microseconds budget = std::chrono::microseconds( 200 ),
+			rijn_engine *engine = nullptr, size_t offload_bytes = 1 << 20 )
+		: ctx_( ctx ), executor_( executor ), budget_( budget ),
+		  engine_( engine ), offload_bytes_( offload_bytes ),
+		  slice_bytes_( 4096 )
+	{
+		std::memcpy( iv_, iv, ctx->blocklen > 0 ? ctx->blocklen : 0 );
+	}
+
+	stream( const stream & ) = delete;
+	stream &operator=( const stream & ) = delete;
+
+	task< int > encrypt( uint8_t *input, uint8_t *output, size_t nbytes )
+	{
+		return run( RIJN_JOB_CBC_ENCRYPT, input, output, nbytes );
+	}
+
+	task< int > decrypt( uint8_t *input, uint8_t *output, size_t nbytes )
+	{
+		return run( RIJN_JOB_CBC_DECRYPT, input, output, nbytes );
+	}
+
+	/* the chaining value to continue the stream with */
+	const uint8_t *iv() const { return iv_; }
+
+	/* bytes per slice, as adapted so far */
+	size_t slice_bytes() const { return slice_bytes_; }
+
+private:
+	/* Suspend and let the executor resume us later. */
+	struct yield_awaiter
+	{
+		Executor &executor;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend( std::coroutine_handle<> h ) { executor.post( h ); }
+		void await_resume() const noexcept {}
+	};
+
+	/* Run a job on the engine and resume through the executor. */
+	struct offload_awaiter
+	{
+		rijn_engine *engine;
+		Executor &executor;
+		rijn_job job;
+		std::coroutine_handle<> h;
+
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend( std::coroutine_handle<> handle )
+		{
+			h = handle;
+			job.callback = &offload_awaiter::done;
+			job.arg = this;
+			job.priority = RIJN_JOB_BULK;
+			/* nothing here may touch *this once the job is submitted */
+			if ( rijn_engine_submit( engine, &job ) == 0 )
+				return true;
+			job.status = 1;		/* not run: resume now with the failure */
+			job.error = errno;
+			return false;
+		}
+		int await_resume() const noexcept
+		{
+			return job.status == RIJN_JOB_PENDING ? 1 : job.status;
+		}
+		static void done( rijn_job *job )
+		{
+			offload_awaiter *self = static_cast< offload_awaiter * >( job->arg );
+			self->executor.post( self->h );
+		}
+	};
+
+	int call( int op, uint8_t *input, uint8_t *output, size_t nbytes )
+	{
+		return op == RIJN_JOB_CBC_ENCRYPT
+			   ? rijn_cbc_encrypt( ctx_, iv_, input, output, nbytes )
+			   : rijn_cbc_decrypt( ctx_, iv_, input, output, nbytes );
+	}
+
+	task< int > run( int op, uint8_t *input, uint8_t *output, size_t nbytes )
+	{
+		using clock = std::chrono::steady_clock;
+		size_t blocklen = ctx_->blocklen > 0 ? ctx_->blocklen : 0;
+		size_t off = 0, n, slice;
+		int status;
+
+		if ( blocklen == 0 || nbytes % blocklen )
+			co_return call( op, input, output, nbytes );
+
+		while ( off < nbytes )
+		{
+			if ( engine_ && nbytes - off >= offload_bytes_ )
+			{
+				offload_awaiter offload{ engine_, executor_, {}, {} };
+
+				offload.job.op = op;
+				offload.job.ctx = ctx_;
+				offload.job.iv = iv_;
+				offload.job.input = input + off;
+				offload.job.output = output + off;
+				offload.job.nbytes = nbytes - off;
+				co_return co_await offload;
+			}
+
+			slice = slice_bytes_ / blocklen * blocklen;
+			if ( slice == 0 )
+				slice = blocklen;
+			n = nbytes - off < slice ? nbytes - off : slice;
+
+			auto start = clock::now();
+			status = call( op, input + off, output + off, n );
+			auto elapsed = clock::now() - start;
+			if ( status )
+				co_return status;
+			off += n;
+			adapt( n, elapsed );
+
+			if ( off < nbytes )
+				co_await yield_awaiter{ executor_ };
+		}
+
+		co_return 0;
+	}
+
+	/* Aim the next slice at the time budget, changing by at most 2x. */
+	void adapt( size_t n, std::chrono::steady_clock::duration elapsed )
+	{
+		double took = std::chrono::duration< double >( elapsed ).count();
+		double want = std::chrono::duration< double >( budget_ ).count();
+		size_t next = took > 0 ? ( size_t )( n * want / took )
+							   : slice_bytes_ * 2;
+
+		if ( next > slice_bytes_ * 2 )
+			next = slice_bytes_ * 2;
+		if ( next < slice_bytes_ / 2 )
+			next = slice_bytes_ / 2;
+		slice_bytes_ = next < 256 ? 256 : next;
+	}
+
+	rijn_context *ctx_;
+	uint8_t iv_[32];
+	Executor &executor_;
+	std::chrono::microseconds budget_;
+	rijn_engine *engine_;
+	size_t offload_bytes_;
+	size_t slice_bytes_;
+};
+
+} /* namespace rijn */
+
+#endif /* RIJNDAEL_STREAM_HPP_ */
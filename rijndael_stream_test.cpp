@@ -0,0 +1,159 @@
+/* This file contains public domain test routines for rijndael_stream.hpp.
+ * Public domain is per CC0 1.0; see
+ * https://creativecommons.org/publicdomain/zero/1.0/ for information.
+ *
+ * Build with a C++20 compiler, e.g.
+ *
+ *	g++ -std=c++20 -O2 -o rijndael_stream_test rijndael_stream_test.cpp \
+ *		-lpthread
+ *
+ * It #includes rijndael.c and rijndael_engine.c, which compile as C++, so
+ * do not link with them.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+/* before rijndael.c, whose min and max macros <chrono> cannot take */
+#include "rijndael_stream.hpp"
+#include "rijndael.c"
+#include "rijndael_engine.c"
+
+#define TEST_BYTES	( 3360 * 312 )	/* about 1 MB, whole blocks of any size */
+
+/* An event loop's queue of ready coroutines; engine threads post to it. */
+struct test_loop
+{
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque< std::coroutine_handle<> > queue;
+
+	void post( std::coroutine_handle<> h )
+	{
+		std::lock_guard< std::mutex > hold( lock );
+		queue.push_back( h );
+		ready.notify_one();
+	}
+
+	/* Run t to the end, resuming whatever is posted meanwhile. */
+	int run( rijn::task< int > &t )
+	{
+		std::coroutine_handle<> h;
+
+		t.start();
+		while ( !t.done() )
+		{
+			{
+				std::unique_lock< std::mutex > hold( lock );
+				ready.wait( hold, [this] { return !queue.empty(); } );
+				h = queue.front();
+				queue.pop_front();
+			}
+			h.resume();
+		}
+
+		return t.result();
+	}
+};
+
+
+/* Encrypt and decrypt TEST_BYTES through a stream, sliced or offloaded to
+   engine, and compare with one rijn_cbc_encrypt call.  Returns 1 if they
+   differ. */
+static int
+stream_test( test_loop &loop, rijn_engine *engine, int blockbits,
+			 uint8_t *pt, uint8_t *want, uint8_t *got )
+{
+	uint8_t key[32], iv[32], chain[32];
+	rijn_context ctx;
+	int i, bad;
+
+	for ( i = 0; i < 32; i++ )
+	{
+		key[i] = ( uint8_t )( 3 * i );
+		iv[i] = ( uint8_t )( 255 - i );
+	}
+	rijn_set_key( &ctx, key, 128, blockbits );
+	memcpy( chain, iv, sizeof( chain ) );
+	rijn_cbc_encrypt( &ctx, chain, pt, want, TEST_BYTES );
+
+	rijn::stream< test_loop > enc( &ctx, iv, loop,
+								   std::chrono::microseconds( 200 ), engine,
+								   65536 );
+	auto e = enc.encrypt( pt, got, TEST_BYTES );
+	bad = loop.run( e ) != 0 || memcmp( got, want, TEST_BYTES ) != 0 ||
+		  memcmp( enc.iv(), chain, ctx.blocklen ) != 0;
+
+	rijn::stream< test_loop > dec( &ctx, iv, loop,
+								   std::chrono::microseconds( 200 ), engine,
+								   65536 );
+	auto d = dec.decrypt( got, got, TEST_BYTES );
+	bad |= loop.run( d ) != 0 || memcmp( got, pt, TEST_BYTES ) != 0;
+
+	return bad;
+}
+
+
+int
+main( void )
+{
+	uint8_t *pt = ( uint8_t * )malloc( TEST_BYTES );
+	uint8_t *want = ( uint8_t * )malloc( TEST_BYTES );
+	uint8_t *got = ( uint8_t * )malloc( TEST_BYTES );
+	uint8_t key[16] = { 0 }, iv[16] = { 0 };
+	rijn_engine *engine;
+	rijn_context ctx;
+	test_loop loop;
+	int blockbits, i, status, bad = 0;
+
+	if ( pt == NULL || want == NULL || got == NULL ||
+		 ( engine = rijn_engine_create( 2 ) ) == NULL )
+	{
+		printf( "Coroutine stream setup: failed!\n" );
+		return EXIT_FAILURE;
+	}
+	for ( i = 0; i < TEST_BYTES; i++ )
+		pt[i] = ( uint8_t )( i * 7 + ( i >> 8 ) );
+
+	/* sliced on the loop, then offloaded, at every block size */
+	for ( blockbits = 128; !bad && blockbits <= 256; blockbits += 32 )
+		bad = stream_test( loop, NULL, blockbits, pt, want, got ) ||
+			  stream_test( loop, engine, blockbits, pt, want, got );
+	printf( "Coroutine stream, sliced and offloaded: %s\n",
+			bad ? "failed!" : "passed." );
+
+	/* an engine that refuses the job makes the call fail, not succeed
+	   with nothing written */
+	rijn_set_key( &ctx, key, 128, 128 );
+	memset( got, 0, 65536 );
+	__atomic_store_n( &engine->stop, 1, __ATOMIC_RELEASE );
+	{
+		rijn::stream< test_loop > s( &ctx, iv, loop,
+									 std::chrono::microseconds( 200 ),
+									 engine, 4096 );
+		auto t = s.encrypt( pt, got, 65536 );
+		errno = 0;
+		status = loop.run( t );
+		i = status != 1 || errno != EINVAL;
+	}
+	__atomic_store_n( &engine->stop, 0, __ATOMIC_RELEASE );
+	printf( "Coroutine stream, refused offload: %s\n",
+			i ? "failed!" : "passed." );
+	bad |= i;
+
+	rijn_engine_destroy( engine );
+	free( pt );
+	free( want );
+	free( got );
+
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -8,15 +8,23 @@
  * Runtime for all CBC blocksizes and keysizes: 13.0 seconds.
  * Both on iBUYPOWER P700 PRO with 3.60 GHz Intel Core i7-3820 and 667 MHz
  * memory.
+ * Option -p runs those 100 Monte Carlo chains at once on all CPUs, and
+ * NIST CAVP .rsp files named on the command line are run on every backend.
  */
 
+#define _GNU_SOURCE		/* for rijndael_pipe.c */
+
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 char rcs_id_rijndael_test[] =
 		"$Id: rijndael_test.c 1.43 2020-03-26 13:16:57-05 Ron Exp $";
@@ -32,6 +40,19 @@ void printValue( char *label, uint8_t *value, int len, FILE *out );
 #define TEST
 #include "rijndael.c"
 #undef TEST
+#include "rijndael_engine.c"
+#include "rijndael_pipe.c"
+#include "rijndael_region.c"
+#include "rijndael_log.c"
+#include "rijndael_daemon.c"
+#include "rijndael_proxy.c"
+#include "rijndael_keystream.c"
+#include "rijndael_reencrypt.c"
+#include "rijndael_pmac.c"
+#include "rijndael_poly1305.c"
+#include "rijndael_hctr2.c"
+#include "rijndael_kdf.c"
+#include "rijndael_shadow.c"
 
 #ifdef __cplusplus
 extern "C" {
@@ -101,17 +122,21 @@ usage( FILE *stream, char *message, ... )
 
 		fprintf(stream,
 			"%s validates Rijndael cipher source code in rijndael.c.\n"
-			"Usage: %s [-ec[V]]\n"
+			"Usage: %s [-ec[pV]] [file.rsp ...]\n"
 			"       %s -h|-t\n"
 			"Options:\n"
 			"  -e test Electronic CodeBook (ECB) mode\n"
 			"  -c test Cipher Block Chaining (CBC) mode\n"
+			"  -p run the -e and -c test chains in parallel threads\n"
 			"  -t show timing speeds for CBC mode\n"
 			"  -V write verbose output to appropriately named files\n"
 			"  -h shows this help message\n"
 			"If no option is supplied, a short, random-data test will be run "
 			"using all\n"
-			"Rijndael functions.\n", progName, progName, progName );
+			"Rijndael functions.  Each file.rsp, a NIST CAVP AES ECB or CBC "
+			"vector file\n"
+			"(KAT, MMT or MCT), is run on every available backend.\n",
+			progName, progName, progName );
 	}
 
 	exit( stream == stderr ? EXIT_FAILURE : EXIT_SUCCESS );
@@ -188,6 +213,577 @@ seconds( void )
 }
 
 
+#define MULTIKEYS	200	/* contexts in the multi-key ECB test */
+#define ENGINEJOBS	500	/* jobs in the job engine test */
+#define LOGWRITERS	4	/* threads in the encrypted log test */
+#define LOGRECORDS	300	/* records per thread */
+#define POOLTHREADS	64	/* most threads in a test pool */
+#define RSP_MAXDATA	1024	/* bytes in the longest .rsp PLAINTEXT */
+
+/* read() until count bytes or end of file; returns the bytes read */
+static size_t
+read_all( int fd, uint8_t *buf, size_t count )
+{
+	size_t got = 0;
+	ssize_t n;
+
+	while ( got < count && ( n = read( fd, buf + got, count - got ) ) > 0 )
+		got += n;
+
+	return got;
+}
+
+
+static int engine_test_callbacks;
+
+static void
+engine_test_callback( rijn_job *job )
+{
+	if ( job->status == 0 )
+		__atomic_add_fetch( &engine_test_callbacks, 1, __ATOMIC_SEQ_CST );
+}
+
+
+static rijn_log *log_test_log;
+static uint64_t log_test_chunk[LOGWRITERS][LOGRECORDS];
+
+/* Append records "w i" padded to a length that varies with i. */
+static void *
+log_test_writer( void *arg )
+{
+	uint8_t record[200];
+	int w = ( int )( intptr_t )arg, i;
+
+	for ( i = 0; i < LOGRECORDS; i++ )
+	{
+		memset( record, w + i, sizeof( record ) );
+		record[0] = ( uint8_t )w;
+		record[1] = ( uint8_t )( i >> 8 );
+		record[2] = ( uint8_t )i;
+		if ( rijn_log_append( log_test_log, record, 3 + i % 150,
+							  &log_test_chunk[w][i] ) )
+			return arg;
+	}
+
+	return NULL;
+}
+
+
+static int shadow_test_op = -1;
+
+/* Note the operation of the last mismatch. */
+static void
+shadow_test_callback( int op, size_t nbytes, void *arg )
+{
+	( void )nbytes;
+	( void )arg;
+	shadow_test_op = op;
+}
+
+
+/* Offer the daemon at path a buffer (type RIJN_MSG_HELLO) or a ring of 8
+   entries (RIJN_MSG_RING) that is not sealed; return 0 if it is refused. */
+static int
+daemon_test_unsealed( const char *path, uint32_t type )
+{
+	struct sockaddr_un addr;
+	rijn_msg msg;
+	int s = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+	int fd = memfd_create( "daemon_test", MFD_CLOEXEC ), got = -1, bad;
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+	memset( &msg, 0, sizeof( msg ) );
+	msg.type = type;
+	msg.nbytes = 8;
+	bad = s < 0 || fd < 0 ||
+		  ftruncate( fd, ( off_t )rijn_daemon_ring_size( 8 ) ) ||
+		  connect( s, ( struct sockaddr * )&addr, sizeof( addr ) ) ||
+		  rijn_msg_send( s, &msg, fd ) ||
+		  rijn_msg_recv( s, &msg, &got, 0 ) != ( ssize_t )sizeof( msg ) ||
+		  msg.status == 0 || msg.error != EINVAL;
+	if ( got >= 0 )
+		close( got );
+	if ( fd >= 0 )
+		close( fd );
+	if ( s >= 0 )
+		close( s );
+
+	return bad;
+}
+
+
+static int proxy_test_listen;
+
+/* Echo each connection to proxy_test_listen until it is shut down. */
+static void *
+proxy_test_echo( void *arg )
+{
+	uint8_t buf[8192];
+	ssize_t n;
+	int fd;
+
+	while ( ( fd = accept( proxy_test_listen, NULL, NULL ) ) >= 0 )
+	{
+		while ( ( n = read( fd, buf, sizeof( buf ) ) ) > 0 )
+			if ( write( fd, buf, n ) != n )
+				break;
+		close( fd );
+	}
+
+	return arg;
+}
+
+
+/* Send the opening proxy at addr a salt of zeros and a 256-byte record
+   sealed for direction dir, then the end record if end is set, and read
+   until the connection closes.  Returns 1 if it was reset, 0 if not, or -1
+   if it could not be made. */
+static int
+proxy_test_raw( rijn_context *ctx, struct sockaddr_in *addr, int dir, int end )
+{
+	static const uint8_t zero[256];
+	uint8_t buf[16 + 2 * ( 4 + 16 ) + 256], nonce[24], aad[5];
+	size_t len = 16, n;
+	ssize_t got = 0;
+	int fd, i;
+
+	memset( buf, 0, sizeof( buf ) );
+	memset( nonce, 0, sizeof( nonce ) );
+	memset( aad, 0, sizeof( aad ) );
+	aad[0] = (uint8_t) dir;
+	for ( i = 0; i <= end; i++ )
+	{
+		n = i ? 0 : 256;
+		nonce[23] = (uint8_t) i;
+		aad[3] = (uint8_t) ( n >> 8 );
+		memcpy( buf + len, aad + 1, 4 );
+		rijn_eax_encrypt( ctx, nonce, sizeof( nonce ), aad, 5, ( uint8_t * )zero,
+						  buf + len + 4, n, buf + len + 4 + n );
+		len += 4 + n + 16;
+	}
+
+	fd = socket( AF_INET, SOCK_STREAM, 0 );
+	if ( fd < 0 || connect( fd, ( struct sockaddr * )addr, sizeof( *addr ) ) ||
+		 write( fd, buf, len ) != ( ssize_t )len || shutdown( fd, SHUT_WR ) )
+	{
+		if ( fd >= 0 )
+			close( fd );
+		return -1;
+	}
+	while ( ( got = read( fd, buf, sizeof( buf ) ) ) > 0 )
+		;
+	close( fd );
+
+	return got < 0 && errno == ECONNRESET;
+}
+
+
+/* A pool of threads calling fn( i, arg ) for i from 0 to count - 1, each
+ * taking the next index nobody has; the calling thread works too, so a
+ * thread that cannot be created only makes the pool smaller.
+ */
+typedef struct
+{
+	void ( *fn )( int i, void *arg );
+	void *arg;
+	int count;
+	int next;
+} test_pool;
+
+static void *
+test_pool_worker( void *arg )
+{
+	test_pool *pool = arg;
+	int i;
+
+	while ( ( i = __atomic_fetch_add( &pool->next, 1, __ATOMIC_SEQ_CST ) ) <
+			pool->count )
+		pool->fn( i, pool->arg );
+
+	return NULL;
+}
+
+
+/* Run the pool on up to nthreads threads; returns the number used. */
+static int
+test_pool_run( void ( *fn )( int, void * ), void *arg, int count,
+			   int nthreads )
+{
+	test_pool pool = { fn, arg, count, 0 };
+	pthread_t thread[POOLTHREADS];
+	int t, started = 0;
+
+	if ( nthreads > POOLTHREADS )
+		nthreads = POOLTHREADS;
+	if ( nthreads > count )
+		nthreads = count;
+	for ( t = 1; t < nthreads; t++ )
+		if ( pthread_create( &thread[started], NULL, test_pool_worker,
+							 &pool ) == 0 )
+			started++;
+	test_pool_worker( &pool );
+	for ( t = 0; t < started; t++ )
+		pthread_join( thread[t], NULL );
+
+	return started + 1;
+}
+
+
+static int
+test_cpus( void )
+{
+	long n = sysconf( _SC_NPROCESSORS_ONLN );
+
+	return n < 1 ? 1 : n > POOLTHREADS ? POOLTHREADS : ( int )n;
+}
+
+
+static double
+wall_seconds( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int mct_passed[100];
+
+static void
+mct_worker( int i, void *arg )
+{
+	uint8_t buf[32];
+	int chain = i + *( int * )arg;
+
+	mct_passed[chain] = mct_chain( chain, buf );
+}
+
+
+/* The ECB chains of ecb_test, the CBC chains of cbc_test or both, every
+ * chain on its own thread as far as the CPUs go, reported in the usual
+ * order once all have finished.  Returns the number that failed.
+ */
+static int
+mct_parallel_test( int test_ecb, int test_cbc )
+{
+	int first = test_ecb ? 0 : 50;
+	int count = ( test_ecb + test_cbc ) * 50;
+	int chain, p, n, threads, failed = 0;
+	double start = wall_seconds();
+	uint8_t zero[32] = { 0 };
+	rijn_context warm;
+
+	/* set up the default backend's tables before the threads share them */
+	rijn_set_key( &warm, zero, 128, 128 );
+
+	printf( "\n Rijndael Monte Carlo Tests, %d chains on %d CPUs...\n",
+			count, test_cpus() );
+	fflush( stdout );
+	threads = test_pool_run( mct_worker, &first, count, test_cpus() );
+
+	for ( chain = first; chain < first + count; chain++ )
+	{
+		p = chain % 50 / 10;
+		n = chain % 5;
+		if ( chain % 5 == 0 )
+			printf( "\n Rijndael Monte Carlo Test (%s mode) - %s\n\n",
+					chain < 50 ? "ECB" : "CBC",
+					chain % 10 < 5 ? "encryption" : "decryption" );
+		printf( "  Test %2d, block size = %3d, key size = %3d bits: %s\n",
+				chain % 50 + 1, params[p][n][0], params[p][n][1],
+				mct_passed[chain] ? "passed." : "failed!" );
+		failed += !mct_passed[chain];
+	}
+	printf( "\n %d chains in %d threads: %.2f seconds\n\n", count, threads,
+			wall_seconds() - start );
+
+	return failed;
+}
+
+
+/* One vector of a NIST CAVP .rsp file: each field is the hex digits in the
+ * mapped file, never copied, and hexlen[f] digits long.
+ */
+enum { RSP_KEY, RSP_IV, RSP_PT, RSP_CT, RSP_FIELDS };
+
+typedef struct
+{
+	const char *hex[RSP_FIELDS];
+	int hexlen[RSP_FIELDS];
+	int decrypt;
+	int line;
+} rsp_vector;
+
+typedef struct
+{
+	const char *path;
+	int cbc;			/* CBC, else ECB */
+	int mct;			/* AESAVS Monte Carlo vectors */
+	rsp_vector *v;
+	int count;
+	const char *backend;
+	int *failed;		/* per vector */
+} rsp_file;
+
+
+/* hexlen digits to bytes; returns the byte count, or -1 if too many */
+static int
+rsp_bytes( const char *hex, int hexlen, uint8_t *buf, int maxbytes )
+{
+	int i;
+
+	if ( hexlen % 2 || hexlen / 2 > maxbytes )
+		return -1;
+	for ( i = 0; i < hexlen / 2; i++ )
+		buf[i] = ( uint8_t )( test_hexdigit( hex[2 * i] ) << 4 |
+							  test_hexdigit( hex[2 * i + 1] ) );
+
+	return i;
+}
+
+
+/* Check vector v of f on backend f->backend; returns 1 if it passes.
+ * A Monte Carlo vector is one outer step of the AESAVS test: 1000
+ * encryptions, each output feeding the next input (in CBC, the first
+ * input after the IV is the IV and then each is the output before last).
+ */
+static int
+rsp_check( const rsp_file *f, const rsp_vector *v )
+{
+	uint8_t key[32], iv[16], iv0[16], in[RSP_MAXDATA], want[RSP_MAXDATA];
+	uint8_t out[RSP_MAXDATA], prev[16];
+	rijn_context ctx;
+	int keylen, ivlen = 16, n, j;
+
+	memset( out, 0, sizeof( out ) );
+
+	keylen = rsp_bytes( v->hex[RSP_KEY], v->hexlen[RSP_KEY], key,
+						sizeof( key ) );
+	n = rsp_bytes( v->hex[v->decrypt ? RSP_CT : RSP_PT],
+				   v->hexlen[v->decrypt ? RSP_CT : RSP_PT], in, sizeof( in ) );
+	if ( f->cbc )
+		ivlen = rsp_bytes( v->hex[RSP_IV], v->hexlen[RSP_IV], iv0,
+						   sizeof( iv0 ) );
+	if ( n <= 0 || n % 16 || ivlen != 16 ||
+		 rsp_bytes( v->hex[v->decrypt ? RSP_PT : RSP_CT],
+					v->hexlen[v->decrypt ? RSP_PT : RSP_CT], want,
+					sizeof( want ) ) != n ||
+		 ( f->mct && n != 16 ) ||
+		 rijn_set_key( &ctx, key, keylen * 8, 128 ) ||
+		 rijn_set_backend( &ctx, f->backend ) )
+		return 0;
+
+	memcpy( iv, iv0, sizeof( iv ) );
+	for ( j = 0; j < ( f->mct ? 1000 : 1 ); j++ )
+	{
+		memcpy( prev, out, sizeof( prev ) );
+		if ( f->cbc && v->decrypt )
+			rijn_cbc_decrypt( &ctx, iv, in, out, n );
+		else if ( f->cbc )
+			rijn_cbc_encrypt( &ctx, iv, in, out, n );
+		else if ( v->decrypt )
+			rijn_ecb_decrypt( &ctx, in, out, n );
+		else
+			rijn_ecb_encrypt( &ctx, in, out, n );
+		if ( f->cbc )
+			memcpy( in, j == 0 ? iv0 : prev, 16 );
+		else
+			memcpy( in, out, 16 );
+	}
+
+	return memcmp( out, want, n ) == 0;
+}
+
+
+static void
+rsp_worker( int i, void *arg )
+{
+	rsp_file *f = arg;
+
+	f->failed[i] = !rsp_check( f, &f->v[i] );
+}
+
+
+/* Parse len bytes of .rsp text into f's vectors; returns 0 or 1 on a
+ * vector without all its fields or out of memory.
+ */
+static int
+rsp_parse( rsp_file *f, const char *text, size_t len )
+{
+	static const char *names[RSP_FIELDS] = {
+		"KEY", "IV", "PLAINTEXT", "CIPHERTEXT"
+	};
+	const char *p = text, *end = text + len, *eol, *val;
+	rsp_vector *v = NULL, *grown;
+	int k, line = 0, decrypt = 0, size = 0;
+
+	f->v = NULL;
+	f->count = 0;
+	for ( ; p < end; p = eol + 1 )
+	{
+		line++;
+		if ( !( eol = memchr( p, '\n', end - p ) ) )
+			eol = end;
+		while ( p < eol && isspace( ( unsigned char )*p ) )
+			p++;
+		if ( p < eol && *p == '#' )
+		{
+			if ( memmem( p, eol - p, "MCT", 3 ) )
+				f->mct = 1;
+			if ( memmem( p, eol - p, "CBC", 3 ) )
+				f->cbc = 1;
+			continue;
+		}
+		if ( eol - p >= 9 && !memcmp( p, "[ENCRYPT]", 9 ) )
+			decrypt = 0;
+		if ( eol - p >= 9 && !memcmp( p, "[DECRYPT]", 9 ) )
+			decrypt = 1;
+		if ( eol - p >= 5 && !memcmp( p, "COUNT", 5 ) )
+		{
+			if ( f->count == size )
+			{
+				size = size ? 2 * size : 256;
+				grown = realloc( f->v, size * sizeof( *v ) );
+				if ( !grown )
+					return 1;
+				f->v = grown;
+			}
+			v = &f->v[f->count++];
+			memset( v, 0, sizeof( *v ) );
+			v->decrypt = decrypt;
+			v->line = line;
+			continue;
+		}
+		for ( k = 0; v && k < RSP_FIELDS; k++ )
+		{
+			size_t nl = strlen( names[k] );
+
+			if ( ( size_t )( eol - p ) > nl && !memcmp( p, names[k], nl ) &&
+				 ( p[nl] == ' ' || p[nl] == '=' ) &&
+				 ( val = memchr( p, '=', eol - p ) ) )
+			{
+				for ( val++; val < eol && *val == ' '; val++ )
+					;
+				v->hex[k] = val;
+				while ( val < eol && isxdigit( ( unsigned char )*val ) )
+					val++;
+				v->hexlen[k] = ( int )( val - v->hex[k] );
+			}
+		}
+	}
+
+	for ( k = 0; k < f->count; k++ )
+		if ( !f->v[k].hex[RSP_KEY] || !f->v[k].hex[RSP_PT] ||
+			 !f->v[k].hex[RSP_CT] || ( f->cbc && !f->v[k].hex[RSP_IV] ) )
+		{
+			fprintf( stderr, "%s:%d: vector is missing a field\n", f->path,
+					 f->v[k].line );
+			return 1;
+		}
+
+	return 0;
+}
+
+
+/* Run every vector in each NIST CAVP AES ECB or CBC .rsp file (KAT, MMT
+ * and MCT) on every available backend, the vectors of a file spread over
+ * all the CPUs.  The file is mapped, not read.  Returns the number of
+ * failures, counting a file that cannot be used as one.
+ */
+static int
+rsp_test( char **paths, int npaths )
+{
+	rsp_file f;
+	rijn_context warm;
+	uint8_t zero[32] = { 0 };
+	struct stat st;
+	const char *why;
+	char *text;
+	double start;
+	int fd, b, i, bad, failures = 0;
+
+	for ( ; npaths > 0; npaths--, paths++ )
+	{
+		memset( &f, 0, sizeof( f ) );
+		f.path = *paths;
+		fd = open( f.path, O_RDONLY );
+		text = MAP_FAILED;
+		if ( fd < 0 || fstat( fd, &st ) )
+			why = strerror( errno );
+		else if ( st.st_size == 0 )
+			why = "empty";
+		else if ( ( text = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd,
+								 0 ) ) == MAP_FAILED )
+			why = strerror( errno );
+		if ( text == MAP_FAILED )
+		{
+			fprintf( stderr, "%s: cannot map: %s\n", f.path, why );
+			if ( fd >= 0 )
+				close( fd );
+			failures++;
+			continue;
+		}
+		close( fd );
+
+		if ( !strstr( f.path, "ECB" ) && !strstr( f.path, "CBC" ) &&
+			 !memmem( text, st.st_size, "ECB", 3 ) &&
+			 !memmem( text, st.st_size, "CBC", 3 ) )
+		{
+			printf( "%s: not an ECB or CBC vector file; skipped.\n", f.path );
+			munmap( text, st.st_size );
+			continue;
+		}
+		if ( strstr( f.path, "CBC" ) )
+			f.cbc = 1;
+		if ( strstr( f.path, "MCT" ) )
+			f.mct = 1;
+		if ( rsp_parse( &f, text, st.st_size ) ||
+			 !( f.failed = calloc( f.count + 1, sizeof( int ) ) ) )
+		{
+			failures++;
+			free( f.v );
+			munmap( text, st.st_size );
+			continue;
+		}
+
+		for ( b = 0; b < rijn_backend_count(); b++ )
+		{
+			f.backend = rijn_backend_name( b );
+			if ( !rijn_backend_available( f.backend ) )
+				continue;
+
+			/* set up the backend's tables before the threads share them */
+			rijn_set_key( &warm, zero, 128, 128 );
+			rijn_set_backend( &warm, f.backend );
+
+			start = wall_seconds();
+			test_pool_run( rsp_worker, &f, f.count, test_cpus() );
+			for ( i = bad = 0; i < f.count; i++ )
+				if ( f.failed[i] )
+				{
+					if ( bad++ < 5 )
+						printf( "%s:%d: %s failed\n", f.path, f.v[i].line,
+								f.backend );
+				}
+			printf( "%s: %d %s%s vectors on %s: %s (%.3f seconds)\n",
+					f.path, f.count, f.cbc ? "CBC" : "ECB",
+					f.mct ? " Monte Carlo" : "", f.backend,
+					bad ? "failed!" : "passed.", wall_seconds() - start );
+			failures += bad;
+		}
+
+		free( f.failed );
+		free( f.v );
+		munmap( text, st.st_size );
+	}
+
+	return failures;
+}
+
+
 /* Brief test using all of the Rijndael functions implemented in rijndael.c. */
 static void
 brief_test( int time_brief )
@@ -196,11 +792,17 @@ brief_test( int time_brief )
 	int blockbits, keybits;
 	static rijn_context ctx;
 	static uint8_t key[32];
-	static uint8_t IV[32], IV_DEC[sizeof( IV )];
-	static uint8_t PT[32 * 480000];	/* integer multiple of 16, 24 & 32 */
+	static uint8_t IV[32], IV_DEC[sizeof( IV )], IV_SAVE[sizeof( IV )];
+	static uint8_t PT[3360 * 4572];	/* integer multiple of 16, 20, 24, 28 & 32 */
 	static uint8_t CT[sizeof( PT )];
 	static uint8_t result[sizeof( PT )];
-	size_t i, chunkcount, chunkbytes, blocklen, blockbytes;
+	size_t i, chunkcount, chunkbytes, blocklen, blockbytes, ecbbytes;
+	static rijn_context mctx[MULTIKEYS];
+	static rijn_context *mptr[MULTIKEYS];
+	static uint8_t *mins[MULTIKEYS], *mout[MULTIKEYS];
+	static rijn_job job[ENGINEJOBS];
+	static uint8_t jobiv[ENGINEJOBS][32], directiv[ENGINEJOBS][32];
+	rijn_engine *engine;
 	double start;
 
 	printf( "Rijndael Cipher Block Chaining (CBC mode) %ld-byte Random "
@@ -215,9 +817,9 @@ brief_test( int time_brief )
 
 	chunkcount = 2;
 
-	for ( blockbits = 128; blockbits <= 256; blockbits += 64 )
+	for ( blockbits = 128; blockbits <= 256; blockbits += 32 )
 	{
-		for ( keybits = 128; keybits <= 256; keybits += 64 )
+		for ( keybits = 128; keybits <= 256; keybits += 32 )
 		{
 			if ( time_brief ) {
 				printf("blockbits=%d keybits=%d ", blockbits, keybits);
@@ -256,6 +858,1229 @@ brief_test( int time_brief )
 				blockbits, keybits );
 				exit( EXIT_FAILURE );
 			}
+
+			/* bulk ECB on every backend must match block-at-a-time ECB */
+			ecbbytes = blockbytes * 1001;
+			for ( i = 0; i < ecbbytes; i += blockbytes )
+			{
+				rijn_encrypt( &ctx, PT + i, result + i );
+			}
+			for ( j = 0; j < rijn_backend_count(); j++ )
+			{
+				const char *name = rijn_backend_name( j );
+
+				if ( !rijn_backend_available( name ) )
+					continue;
+				rijn_set_backend( &ctx, name );
+				rijn_ecb_encrypt( &ctx, PT, CT, ecbbytes );
+				if ( memcmp( CT, result, ecbbytes ) ||
+					 rijn_ecb_decrypt( &ctx, CT, CT, ecbbytes ) ||
+					 memcmp( PT, CT, ecbbytes ) )
+				{
+					printf( "\nECB for block size = %3d, key size = %3d bits, "
+							"backend %s: failed!\n", blockbits, keybits, name );
+					exit( EXIT_FAILURE );
+				}
+			}
+		}
+	}
+
+	/* multi-key ECB must match each context's own rijn_encrypt; shapes
+	   change every 13 contexts so runs of 8, 4 and 1 are all exercised */
+	for ( i = 0; i < MULTIKEYS; i++ )
+	{
+		blockbits = 128 + 32 * ( int )( i / 13 % 5 );
+		keybits = 128 + 32 * ( int )( i / 65 % 5 );
+		key[i % sizeof( key )] ^= ( uint8_t )( i + 1 );
+		rijn_set_key( &mctx[i], key, keybits, blockbits );
+		mptr[i] = &mctx[i];
+		mins[i] = PT + 32 * i;
+		mout[i] = CT + 32 * i;
+		rijn_encrypt( &mctx[i], mins[i], result + 32 * i );
+	}
+	rijn_encrypt_multikey( mptr, mins, mout, MULTIKEYS );
+	for ( i = 0; i < MULTIKEYS; i++ )
+	{
+		if ( memcmp( CT + 32 * i, result + 32 * i, mctx[i].blocklen ) )
+			break;
+	}
+	if ( i == MULTIKEYS )
+	{
+		rijn_decrypt_multikey( mptr, mout, mout, MULTIKEYS );
+		for ( i = 0; i < MULTIKEYS; i++ )
+		{
+			if ( memcmp( CT + 32 * i, PT + 32 * i, mctx[i].blocklen ) )
+				break;
+		}
+	}
+	if ( i != MULTIKEYS )
+	{
+		printf( "\nMulti-key ECB for context %ld: failed!\n", (long) i );
+		exit( EXIT_FAILURE );
+	}
+
+	/* jobs run by the engine must match the rijn_* calls made directly,
+	   in every priority class, inline, urgent and sliced into chunks */
+	engine = rijn_engine_create( 2 );
+	if ( engine == NULL || rijn_engine_set_limits( engine, 64, 64 ) )
+	{
+		printf( "\nrijn_engine_create: failed!\n" );
+		exit( EXIT_FAILURE );
+	}
+	memset( CT, 0, 256 * ENGINEJOBS );
+	memset( result, 0, 256 * ENGINEJOBS );
+	for ( i = 0; i < ENGINEJOBS; i++ )
+	{
+		memset( &job[i], 0, sizeof( job[i] ) );
+		rand_bytes( jobiv[i], sizeof( jobiv[i] ) );
+		memcpy( directiv[i], jobiv[i], sizeof( jobiv[i] ) );
+		job[i].op = ( int )( i % 4 );
+		job[i].ctx = &mctx[i % MULTIKEYS];
+		job[i].iv = jobiv[i];
+		job[i].input = PT + 256 * i;
+		job[i].output = CT + 256 * i;
+		job[i].nbytes = job[i].ctx->blocklen * ( i % 3 ? 1 + i % 8 : 1 );
+		job[i].callback = i % 2 ? engine_test_callback : NULL;
+		job[i].priority = ( int )( i / 4 % 3 );
+		switch ( job[i].op )
+		{
+		case RIJN_JOB_ECB_ENCRYPT:
+			rijn_ecb_encrypt( job[i].ctx, job[i].input, result + 256 * i,
+							  job[i].nbytes );
+			break;
+		case RIJN_JOB_ECB_DECRYPT:
+			rijn_ecb_decrypt( job[i].ctx, job[i].input, result + 256 * i,
+							  job[i].nbytes );
+			break;
+		case RIJN_JOB_CBC_ENCRYPT:
+			rijn_cbc_encrypt( job[i].ctx, directiv[i], job[i].input,
+							  result + 256 * i, job[i].nbytes );
+			break;
+		case RIJN_JOB_CBC_DECRYPT:
+			rijn_cbc_decrypt( job[i].ctx, directiv[i], job[i].input,
+							  result + 256 * i, job[i].nbytes );
+			break;
+		}
+		rijn_engine_submit( engine, &job[i] );
+	}
+	for ( i = 0; i < ENGINEJOBS; i++ )
+	{
+		if ( rijn_job_wait( engine, &job[i] ) ||
+			 memcmp( CT + 256 * i, result + 256 * i, 256 ) ||
+			 memcmp( jobiv[i], directiv[i], sizeof( jobiv[i] ) ) )
+		{
+			printf( "\nJob engine for job %ld: failed!\n", (long) i );
+			exit( EXIT_FAILURE );
+		}
+	}
+	rijn_engine_destroy( engine );
+	if ( engine_test_callbacks != ENGINEJOBS / 2 )
+	{
+		printf( "\nJob engine callbacks: failed!\n" );
+		exit( EXIT_FAILURE );
+	}
+
+	/* the fd pipeline must match rijn_cbc_encrypt on padded data and
+	   decrypt back; small buffers make the stages cycle many times */
+	for ( blockbits = 128; blockbits <= 256; blockbits += 96 )
+	{
+		FILE *in = tmpfile(), *out = tmpfile(), *back = tmpfile();
+		size_t n = 300007, padded;
+		int pipefd[2];
+
+		blockbytes = blockbits / 8;
+		rijn_set_key( &ctx, key, 128, blockbits );
+		padded = ( n / blockbytes + 1 ) * blockbytes;
+		memcpy( result, PT, n );
+		memset( result + n, ( int )( padded - n ), padded - n );
+		memcpy( IV_SAVE, IV, sizeof( IV ) );
+		memcpy( IV_DEC, IV, sizeof( IV ) );
+		rijn_cbc_encrypt( &ctx, IV_DEC, result, result, padded );
+		memcpy( IV_DEC, IV, sizeof( IV ) );
+
+		if ( in == NULL || out == NULL || back == NULL ||
+			 write( fileno( in ), PT, n ) != ( ssize_t )n ||
+			 lseek( fileno( in ), 0, SEEK_SET ) ||
+			 rijn_cbc_pipe( &ctx, IV_DEC, fileno( in ), fileno( out ),
+							RIJN_PIPE_ENCRYPT | RIJN_PIPE_PAD | RIJN_PIPE_PIN,
+							10000, 3 ) ||
+			 lseek( fileno( out ), 0, SEEK_SET ) ||
+			 read( fileno( out ), CT, padded + 1 ) != ( ssize_t )padded ||
+			 memcmp( CT, result, padded ) ||
+			 lseek( fileno( out ), 0, SEEK_SET ) ||
+			 rijn_cbc_pipe( &ctx, IV, fileno( out ), fileno( back ),
+							RIJN_PIPE_DECRYPT | RIJN_PIPE_PAD, 0, 0 ) ||
+			 memcmp( IV, IV_DEC, blockbytes ) ||
+			 lseek( fileno( back ), 0, SEEK_SET ) ||
+			 read( fileno( back ), result, n + 1 ) != ( ssize_t )n ||
+			 memcmp( result, PT, n ) )
+		{
+			printf( "\nPipelined CBC for block size = %3d: failed!\n",
+					blockbits );
+			exit( EXIT_FAILURE );
+		}
+
+		/* rijn_cbc_splice to a file, then back through a real pipe */
+		memcpy( IV_DEC, IV_SAVE, sizeof( IV ) );
+		memcpy( IV, IV_SAVE, sizeof( IV ) );
+		if ( lseek( fileno( in ), 0, SEEK_SET ) ||
+			 ftruncate( fileno( out ), 0 ) ||
+			 lseek( fileno( out ), 0, SEEK_SET ) ||
+			 rijn_cbc_splice( &ctx, IV_DEC, fileno( in ), fileno( out ),
+							  RIJN_PIPE_ENCRYPT | RIJN_PIPE_PAD, 10000 ) ||
+			 lseek( fileno( out ), 0, SEEK_SET ) ||
+			 read( fileno( out ), result, padded + 1 ) != ( ssize_t )padded ||
+			 memcmp( CT, result, padded ) ||
+			 lseek( fileno( out ), 0, SEEK_SET ) ||
+			 pipe( pipefd ) ||
+			 fcntl( pipefd[1], F_SETPIPE_SZ, 1 << 19 ) < ( int )n ||
+			 rijn_cbc_splice( &ctx, IV, fileno( out ), pipefd[1],
+							  RIJN_PIPE_DECRYPT | RIJN_PIPE_PAD, 0 ) ||
+			 close( pipefd[1] ) ||
+			 memcmp( IV, IV_DEC, blockbytes ) ||
+			 read_all( pipefd[0], result, n + 1 ) != n ||
+			 memcmp( result, PT, n ) )
+		{
+			printf( "\nSpliced CBC for block size = %3d: failed!\n",
+					blockbits );
+			exit( EXIT_FAILURE );
+		}
+		close( pipefd[0] );
+		fclose( in );
+		fclose( out );
+		fclose( back );
+	}
+
+	/* a region's pages must read back after being sealed and swept, and
+	   hold XEX ciphertext while encrypted */
+	{
+		rijn_region *region;
+		uint8_t *mem, *raw, tweak[16], block[16];
+		size_t size = 64 * 4096 + 100, page;
+
+		rijn_set_key( &ctx, key, 256, 128 );
+		region = rijn_region_create( &ctx, size, 0 );
+		if ( region == NULL )
+		{
+			printf( "\nEncrypted region create: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+		mem = ( uint8_t * )rijn_region_base( region );
+		raw = region->alias;
+		page = region->pagesize;
+		memcpy( mem, PT, size );
+
+		memset( tweak, 0, sizeof( tweak ) );
+		tweak[0] = 1;
+		rijn_encrypt( &ctx, tweak, tweak );
+		for ( i = 0; i < 16; i++ )
+			block[i] = PT[page + i] ^ tweak[i];
+		rijn_encrypt( &ctx, block, block );
+		for ( i = 0; i < 16; i++ )
+			block[i] ^= tweak[i];
+
+		if ( rijn_region_plain( region ) != region->npages ||
+			 rijn_region_seal( region ) != region->npages ||
+			 rijn_region_plain( region ) != 0 ||
+			 memcmp( raw + page, block, 16 ) ||
+			 memcmp( raw + 2 * page, PT + 2 * page, page ) == 0 ||
+			 memcmp( mem + page, PT + page, page ) ||
+			 rijn_region_plain( region ) != 1 ||
+			 rijn_region_scan( region ) != 0 ||
+			 memcmp( mem + page, PT + page, 16 ) ||
+			 rijn_region_scan( region ) != 0 ||
+			 rijn_region_scan( region ) != 1 ||
+			 memcmp( raw + page, block, 16 ) ||
+			 memcmp( mem, PT, size ) ||
+			 rijn_region_plain( region ) != region->npages )
+		{
+			printf( "\nEncrypted region: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+		rijn_region_destroy( region );
+
+		/* the background sweep must not disturb a writer */
+		region = rijn_region_create( &ctx, size, 1 );
+		mem = ( uint8_t * )rijn_region_base( region );
+		for ( j = 0; j < 20; j++ )
+		{
+			for ( i = 0; i < size; i += 997 )
+				mem[i] = ( uint8_t )( PT[i] + j );
+			for ( i = 0; i < size; i += 997 )
+				if ( mem[i] != ( uint8_t )( PT[i] + j ) )
+				{
+					printf( "\nEncrypted region sweep: failed!\n" );
+					exit( EXIT_FAILURE );
+				}
+			usleep( 1000 );
+		}
+		rijn_region_destroy( region );
+	}
+
+	/* CMAC and EAX known answers (RFC 4493; EAX paper), then CTR chaining
+	   and EAX round trips for every block size */
+	{
+		uint8_t k[16], m[16], n[16], h[8], mac[32], tag[32], want[16];
+
+		test_readhex( k, ( const unsigned char * )
+					  "2b7e151628aed2a6abf7158809cf4f3c", 16 );
+		test_readhex( m, ( const unsigned char * )
+					  "6bc1bee22e409f96e93d7e117393172a", 16 );
+		test_readhex( want, ( const unsigned char * )
+					  "070a16b46b4d4144f79bdd9dd04a287c", 16 );
+		rijn_set_key( &ctx, k, 128, 128 );
+		rijn_cmac( &ctx, m, 16, mac );
+		if ( memcmp( mac, want, 16 ) )
+		{
+			printf( "\nCMAC known answer: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+
+		test_readhex( k, ( const unsigned char * )
+					  "91945D3F4DCBEE0BF45EF52255F095A4", 16 );
+		test_readhex( n, ( const unsigned char * )
+					  "BECAF043B0A23D843194BA972C66DEBD", 16 );
+		test_readhex( h, ( const unsigned char * )"FA3BFD4806EB53FA", 8 );
+		test_readhex( want, ( const unsigned char * )
+					  "5C4C9331049D0BDAB0277408F67967E5", 16 );
+		m[0] = 0xF7;
+		m[1] = 0xFB;
+		rijn_set_key( &ctx, k, 128, 128 );
+		rijn_eax_encrypt( &ctx, n, 16, h, 8, m, m, 2, tag );
+		if ( m[0] != 0x19 || m[1] != 0xDD || memcmp( tag, want, 16 ) )
+		{
+			printf( "\nEAX known answer: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+
+		for ( blockbits = 128; blockbits <= 256; blockbits += 32 )
+		{
+			blockbytes = blockbits / 8;
+			rijn_set_key( &ctx, key, 192, blockbits );
+			ecbbytes = 1000 * blockbytes;
+
+			/* two chained calls make the same stream as one */
+			memcpy( IV_DEC, IV, blockbytes );
+			rijn_ctr_crypt( &ctx, IV_DEC, PT, CT, ecbbytes + 7 );
+			memcpy( IV_DEC, IV, blockbytes );
+			rijn_ctr_crypt( &ctx, IV_DEC, PT, result, 3 * blockbytes );
+			rijn_ctr_crypt( &ctx, IV_DEC, PT + 3 * blockbytes,
+							result + 3 * blockbytes,
+							ecbbytes + 7 - 3 * blockbytes );
+			memcpy( IV_DEC, IV, blockbytes );
+			rijn_encrypt( &ctx, IV_DEC, mac );
+			for ( i = 0; i < blockbytes; i++ )
+				mac[i] ^= PT[i];
+
+			if ( memcmp( CT, result, ecbbytes + 7 ) ||
+				 memcmp( CT, mac, blockbytes ) ||
+				 rijn_eax_encrypt( &ctx, IV, 11, key, 5, PT, CT, 999, tag ) ||
+				 rijn_eax_decrypt( &ctx, IV, 11, key, 5, CT, result, 999,
+								   tag ) ||
+				 memcmp( result, PT, 999 ) ||
+				 ( CT[998] ^= 1,
+				   !rijn_eax_decrypt( &ctx, IV, 11, key, 5, CT, result, 999,
+									  tag ) ) ||
+				 errno != EBADMSG )
+			{
+				printf( "\nCTR/EAX for block size = %3d: failed!\n",
+						blockbits );
+				exit( EXIT_FAILURE );
+			}
+		}
+	}
+
+	/* CRC32C known answer (RFC 3720), the table and SSE4.2 paths agree and
+	   chain, and the fused modes give the checksums of separate passes, in
+	   place, for every block size */
+	{
+		uint32_t crc, incrc, outcrc;
+		int bad;
+
+		bad = rijn_crc32c( 0, ( const uint8_t * )"123456789", 9 ) !=
+			  0xE3069283 ||
+			  ~rijn_crc32c_soft( ~0U, PT, 100001 ) !=
+			  rijn_crc32c( rijn_crc32c( 0, PT, 13 ), PT + 13, 100001 - 13 );
+
+		for ( blockbits = 128; !bad && blockbits <= 256; blockbits += 32 )
+		{
+			blockbytes = blockbits / 8;
+			rijn_set_key( &ctx, key, 128, blockbits );
+			ecbbytes = 500 * blockbytes;
+
+			memcpy( result, PT, ecbbytes );
+			memcpy( IV_DEC, IV, blockbytes );
+			memcpy( IV_SAVE, IV, blockbytes );
+			rijn_cbc_encrypt( &ctx, IV_SAVE, PT, CT, ecbbytes );
+			crc = rijn_crc32c( 0, CT, ecbbytes );
+			incrc = outcrc = 0;
+			bad |= rijn_cbc_encrypt_crc( &ctx, IV_DEC, result, result,
+										 ecbbytes, &incrc, &outcrc ) ||
+				   memcmp( result, CT, ecbbytes ) ||
+				   memcmp( IV_DEC, IV_SAVE, blockbytes ) ||
+				   incrc != rijn_crc32c( 0, PT, ecbbytes ) ||
+				   outcrc != crc;
+
+			memcpy( IV_DEC, IV, blockbytes );
+			incrc = outcrc = 0;
+			bad |= rijn_cbc_decrypt_crc( &ctx, IV_DEC, result, result,
+										 ecbbytes, &incrc, NULL ) ||
+				   memcmp( result, PT, ecbbytes ) || incrc != crc;
+
+			memcpy( result, PT, ecbbytes + 7 );
+			memcpy( IV_DEC, IV, blockbytes );
+			memcpy( IV_SAVE, IV, blockbytes );
+			rijn_ctr_crypt( &ctx, IV_SAVE, PT, CT, ecbbytes + 7 );
+			bad |= rijn_ctr_crypt_crc( &ctx, IV_DEC, result, result,
+									   ecbbytes + 7, NULL, &outcrc ) ||
+				   memcmp( result, CT, ecbbytes + 7 ) ||
+				   outcrc != rijn_crc32c( 0, CT, ecbbytes + 7 );
+		}
+		if ( bad )
+		{
+			printf( "\nCRC32C: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* PMAC1 known answers (from the PMAC reference code), then for every
+	   block size the threaded PMAC and chunks summed out of order agree
+	   with the plain one */
+	{
+		static rijn_pmac_key pk;
+		static const struct {
+			size_t len;
+			const char *tag;
+		} kat[] = {
+			{ 0, "4399572cd6ea5341b8d35876a7098af7" },
+			{ 3, "256ba5193c1b991b4df0c51f388a9e27" },
+			{ 16, "ebbd822fa458daf6dfdad7c27da76338" },
+			{ 20, "0412ca150bbf79058d8c75a58c993f55" },
+			{ 34, "5cba7d5eb24f7c86ccc54604e53d5512" },
+		};
+		uint8_t k[16], m[34], mac[32], mac2[32], sum[32], want[16];
+		size_t n;
+		int bad = 0;
+
+		for ( i = 0; i < 16; i++ )
+			k[i] = ( uint8_t )i;
+		for ( i = 0; i < 34; i++ )
+			m[i] = ( uint8_t )i;
+		rijn_set_key( &ctx, k, 128, 128 );
+		rijn_pmac_init( &pk, &ctx );
+		for ( i = 0; i < sizeof( kat ) / sizeof( kat[0] ); i++ )
+		{
+			test_readhex( want, ( const unsigned char * )kat[i].tag, 16 );
+			rijn_pmac( &pk, m, kat[i].len, mac );
+			bad |= memcmp( mac, want, 16 ) != 0;
+		}
+
+		for ( blockbits = 128; !bad && blockbits <= 256; blockbits += 32 )
+		{
+			blockbytes = blockbits / 8;
+			rijn_set_key( &ctx, key, 256, blockbits );
+			rijn_pmac_init( &pk, &ctx );
+			n = 20000 * blockbytes + 5;
+			rijn_pmac( &pk, PT, n, mac );
+			bad |= rijn_pmac_parallel( &pk, PT, n, mac2, 3 ) ||
+				   memcmp( mac, mac2, blockbytes ) != 0;
+
+			memset( sum, 0, sizeof( sum ) );
+			rijn_pmac_sum( &pk, PT + 7000 * blockbytes, 13000 * blockbytes,
+						   7000, sum );
+			rijn_pmac_sum( &pk, PT, 7000 * blockbytes, 0, sum );
+			bad |= rijn_pmac_final( &pk, sum, PT + 20000 * blockbytes, 5,
+									mac2 ) ||
+				   memcmp( mac, mac2, blockbytes ) != 0;
+		}
+		if ( bad )
+		{
+			printf( "\nPMAC: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+#ifdef __SIZEOF_INT128__
+	/* Poly1305 known answer (RFC 8439 2.5.2) and Poly1305-AES examples
+	   (Bernstein's paper, appendix B); the four-way kernel agrees with the
+	   one-block loop at every length, and the batch with single calls; an
+	   accumulator with its middle limb past 2^44 keeps its value in
+	   26-bit limbs */
+	{
+		rijn_poly1305_state st;
+		uint8_t k[32], r[16], n[16], tag[16], want[16], *nonces[3], *tags[3];
+		uint8_t batchtags[3][16];
+		const uint8_t *msgs[3];
+		size_t len, rest, lens[3];
+		int bad;
+
+		test_readhex( k, ( const unsigned char * )"85d6be7857556d337f4452fe42"
+					  "d506a80103808afb0db2fd4abff6af4149f51b", 32 );
+		test_readhex( want, ( const unsigned char * )
+					  "a8061dc1305136c6c22b8baf0c0127a9", 16 );
+		rijn_poly1305( k, ( const uint8_t * )
+					   "Cryptographic Forum Research Group", 34, tag );
+		bad = memcmp( tag, want, 16 ) != 0;
+
+		test_readhex( k, ( const unsigned char * )
+					  "ec074c835580741701425b623235add6", 16 );
+		test_readhex( n, ( const unsigned char * )
+					  "fb447350c4e868c52ac3275cf9d4327e", 16 );
+		test_readhex( r, ( const unsigned char * )
+					  "851fc40c3467ac0be05cc20404f3f700", 16 );
+		test_readhex( want, ( const unsigned char * )
+					  "f4c633c3044fc145f84f335cb81953de", 16 );
+		rijn_set_key( &ctx, k, 128, 128 );
+		rijn_poly1305_aes( &ctx, r, n, ( const uint8_t * )"\xf3\xf6", 2,
+						   tag );
+		bad |= memcmp( tag, want, 16 ) != 0;
+
+		test_readhex( k, ( const unsigned char * )
+					  "75deaa25c09f208e1dc4ce6b5cad3fbf", 16 );
+		test_readhex( n, ( const unsigned char * )
+					  "61ee09218d29b0aaed7e154a2c5509cc", 16 );
+		test_readhex( r, ( const unsigned char * )
+					  "a0f3080000f46400d0c7e9076c834403", 16 );
+		test_readhex( want, ( const unsigned char * )
+					  "dd3fab2251f11ac759f0887129cc2ee7", 16 );
+		rijn_set_key( &ctx, k, 128, 128 );
+		rijn_poly1305_aes( &ctx, r, n, PT, 0, tag );
+		bad |= memcmp( tag, want, 16 ) != 0;
+
+		for ( len = 0; !bad && len < 3000; len += 1 + len / 7 )
+		{
+			rijn_poly1305( key, PT, len, tag );
+			rest = len % 16;
+			rijn_poly1305_init( &st, key );
+			rijn_poly1305_blocks( &st, PT, len - rest, 1ULL << 40 );
+			if ( rest )
+			{
+				memset( want, 0, 16 );
+				memcpy( want, PT + len - rest, rest );
+				want[rest] = 1;
+				rijn_poly1305_blocks( &st, want, 16, 0 );
+			}
+			rijn_poly1305_finish( &st, want );
+			bad |= memcmp( tag, want, 16 ) != 0;
+		}
+
+		for ( i = 0; i < 3; i++ )
+		{
+			nonces[i] = IV + i;
+			msgs[i] = PT + 1000 * i;
+			lens[i] = 10 + 500 * i;
+			tags[i] = batchtags[i];
+		}
+		bad |= rijn_poly1305_aes_batch( &ctx, key, nonces, msgs, lens, tags,
+										3 );
+		for ( i = 0; i < 3; i++ )
+		{
+			rijn_poly1305_aes( &ctx, key, nonces[i], msgs[i], lens[i], tag );
+			bad |= memcmp( tag, batchtags[i], 16 ) != 0;
+		}
+#ifdef RIJN_POLY1305_AVX2
+		{
+			uint64_t h[3] = { 5, ( 1ULL << 44 ) + 3, 1 }, l[5];
+
+			rijn_poly1305_to26( h, l );
+			rijn_poly1305_from26( l, h );
+			bad |= h[0] != 5 || h[1] != 3 || h[2] != 2;
+		}
+#endif
+		if ( bad )
+		{
+			printf( "\nPoly1305-AES: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+#endif
+
+	/* POLYVAL known answer (RFC 8452 appendix A); the aggregated hash
+	   agrees with the one-block loop; XCTR in pieces agrees with one call;
+	   HCTR2-AES gives known answers both ways, round-trips at every length,
+	   in place and not, and a changed tweak or first byte changes the whole
+	   ciphertext */
+	{
+		rijn_hctr2_key hk;
+		uint64_t s[2], w[2];
+		uint8_t h[16], tag[16], want[16], tweak[48];
+		size_t len;
+		int bad;
+
+		test_readhex( h, ( const unsigned char * )
+					  "25629347589242761d31f826ba4b757b", 16 );
+		test_readhex( result, ( const unsigned char * )"4f4f95668c83dfb640"
+					  "1762bb2d01a262d1a24ddd2721d006bbe45f20d3c9f362", 32 );
+		test_readhex( want, ( const unsigned char * )
+					  "f7a3b47b846119fae5b7866cf5e5b77e", 16 );
+		rijn_polyval( h, result, 32, tag );
+		bad = memcmp( tag, want, 16 ) != 0;
+
+		/* key, tweak and plaintext count up from 0; the answers are from a
+		   separate implementation of the paper's definition over OpenSSL's
+		   AES-ECB */
+		for ( i = 0; i < 48; i++ )
+			tweak[i] = ( uint8_t )i;
+		test_readhex( CT, ( const unsigned char * )"47088df9faf6fbdb979253eb"
+					  "d48c29571b984ce0b8c0595958014d5b464d52d00cdd65b67e4a1f17",
+					  40 );
+		rijn_set_key( &ctx, tweak, 128, 128 );
+		bad |= rijn_hctr2_init( &hk, &ctx ) ||
+			   rijn_hctr2_encrypt( &hk, tweak, 32, tweak, result, 40 ) ||
+			   memcmp( result, CT, 40 ) ||
+			   rijn_hctr2_decrypt( &hk, tweak, 32, CT, result, 40 ) ||
+			   memcmp( result, tweak, 40 );
+		test_readhex( CT, ( const unsigned char * )
+					  "245849aedb4551cf2cd8a83b174b18bc", 16 );
+		rijn_set_key( &ctx, tweak, 256, 128 );
+		bad |= rijn_hctr2_init( &hk, &ctx ) ||
+			   rijn_hctr2_encrypt( &hk, tweak, 0, tweak, result, 16 ) ||
+			   memcmp( result, CT, 16 ) ||
+			   rijn_hctr2_decrypt( &hk, tweak, 0, CT, result, 16 ) ||
+			   memcmp( result, tweak, 16 );
+
+		rijn_set_key( &ctx, key, 256, 128 );
+		bad |= rijn_hctr2_init( &hk, &ctx );
+		s[0] = s[1] = 0;
+		rijn_polyval_blocks( ( const uint64_t ( * )[2] )hk.h, s, PT, 101 );
+		w[0] = w[1] = 0;
+		rijn_polyval_blocks_soft( hk.h[0], w, PT, 101 );
+		bad |= s[0] != w[0] || s[1] != w[1];
+
+		rijn_xctr_crypt( &ctx, IV, 1, PT, CT, 1003 );
+		rijn_xctr_crypt( &ctx, IV, 1, PT, result, 480 );
+		rijn_xctr_crypt( &ctx, IV, 31, PT + 480, result + 480, 523 );
+		bad |= memcmp( CT, result, 1003 ) != 0;
+
+		memset( tweak, 7, sizeof( tweak ) );
+		for ( len = 16; !bad && len < 2100; len += 1 + len / 5 )
+		{
+			rijn_hctr2_encrypt( &hk, tweak, len % 41, PT, CT, len );
+			memcpy( result, CT, len );
+			rijn_hctr2_decrypt( &hk, tweak, len % 41, result, result, len );
+			bad |= memcmp( result, PT, len ) != 0;
+			memcpy( result, PT, len );
+			rijn_hctr2_encrypt( &hk, tweak, len % 41, result, result, len );
+			bad |= memcmp( result, CT, len ) != 0;
+
+			tweak[0] ^= 1;
+			rijn_hctr2_encrypt( &hk, tweak, len % 41 + 1, PT, result, len );
+			tweak[0] ^= 1;
+			bad |= !memcmp( result, CT, 16 ) ||
+				   !memcmp( result + len - 16, CT + len - 16, 16 );
+			PT[0] ^= 1;
+			rijn_hctr2_encrypt( &hk, tweak, len % 41, PT, result, len );
+			PT[0] ^= 1;
+			bad |= !memcmp( result, CT, 16 ) ||
+				   !memcmp( result + len - 16, CT + len - 16, 16 );
+		}
+
+		errno = 0;
+		bad |= !rijn_hctr2_encrypt( &hk, tweak, 0, PT, CT, 15 ) ||
+			   errno != EINVAL;
+		rijn_set_key( &ctx, key, 256, 256 );
+		errno = 0;
+		bad |= !rijn_hctr2_init( &hk, &ctx ) || errno != EINVAL;
+		if ( bad )
+		{
+			printf( "\nHCTR2: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* KDF known answer (OpenSSL KBKDF, CMAC, counter mode); every block
+	   size's output in lanes equals CMAC one counter at a time, and the
+	   derived contexts equal contexts set from the derived bytes */
+	{
+		static rijn_context keys[100], want[100];
+		uint8_t k[16], expect[40], msg[64], mac[32];
+		size_t len;
+		int bad;
+
+		test_readhex( k, ( const unsigned char * )
+					  "000102030405060708090a0b0c0d0e0f", 16 );
+		test_readhex( expect, ( const unsigned char * )"e284a98f984c3ec4e47f"
+					  "a5f5b60db336eaf5bf0bdba31a5c06039bb4efe02278123dd01156"
+					  "760576", 40 );
+		rijn_set_key( &ctx, k, 128, 128 );
+		bad = rijn_kdf_ctr( &ctx, ( const uint8_t * )"tenant", 6,
+							( const uint8_t * )"volume 7", 8, result, 40 );
+		bad |= memcmp( result, expect, 40 ) != 0;
+
+		for ( blockbits = 128; !bad && blockbits <= 256; blockbits += 32 )
+		{
+			rijn_set_key( &ctx, key, 256, blockbits );
+			blocklen = blockbits / 8;
+			len = 70 * blocklen - 3;
+			bad |= rijn_kdf_ctr( &ctx, PT, blocklen - 9, PT + 100, 5, result,
+								 len );
+			memset( msg, 0, sizeof( msg ) );
+			memcpy( msg + 4, PT, blocklen - 9 );
+			memcpy( msg + blocklen - 4, PT + 100, 5 );
+			msg[blocklen + 1] = ( uint8_t )( len * 8 >> 24 );
+			msg[blocklen + 2] = ( uint8_t )( len * 8 >> 16 );
+			msg[blocklen + 3] = ( uint8_t )( len * 8 >> 8 );
+			msg[blocklen + 4] = ( uint8_t )( len * 8 );
+			for ( i = 0; i < 70; i++ )
+			{
+				msg[3] = ( uint8_t )( i + 1 );
+				rijn_cmac( &ctx, msg, blocklen + 5, mac );
+				bad |= memcmp( result + i * blocklen, mac,
+							   min( blocklen, len - i * blocklen ) ) != 0;
+			}
+
+			bad |= rijn_kdf_ctr_keys( &ctx, PT, 3, PT + 50, 20, keys, 100,
+									  224, blockbits );
+			rijn_kdf_ctr( &ctx, PT, 3, PT + 50, 20, result, 100 * 28 );
+			for ( i = 0; i < 100; i++ )
+			{
+				rijn_set_key( &want[i], result + 28 * i, 224, blockbits );
+				rijn_encrypt( &keys[i], IV, mac );
+				rijn_encrypt( &want[i], IV, msg );
+				bad |= memcmp( mac, msg, blocklen ) != 0;
+			}
+		}
+
+		errno = 0;
+		bad |= !rijn_kdf_ctr_keys( &ctx, PT, 3, PT, 3, keys, 2, 100, 128 ) ||
+			   errno != EINVAL;
+		errno = 0;
+		bad |= !rijn_kdf_ctr( &ctx, PT, 3, PT, 3, result, ( size_t )1 << 29 ) ||
+			   errno != EINVAL;
+		if ( bad )
+		{
+			printf( "\nKDF: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* with shadow checking on for every call, each ECB, CBC and CTR call
+	   on each backend and block size is sampled (or dropped, when the
+	   queue is full) and checked clean, the results unchanged, and a call
+	   with the hooks held is not; a sample whose output was altered is
+	   reported */
+	{
+		const char *backend;
+		rijn_shadow_stats stats;
+		uint64_t calls = 0;
+		uint8_t counter[32];
+		void *sample;
+		int b, bad;
+
+		bad = rijn_shadow_start( 1, shadow_test_callback, NULL );
+		for ( b = 0; !bad && ( backend = rijn_backend_name( b ) ); b++ )
+		{
+			for ( blockbits = 128; blockbits <= 256; blockbits += 32 )
+			{
+				blocklen = blockbits / 8;
+				rijn_set_key( &ctx, key, 192, blockbits );
+				if ( rijn_set_backend( &ctx, backend ) )
+					break;
+				memcpy( result, PT, 64 * blocklen );
+				rijn_ecb_encrypt( &ctx, result, result, 64 * blocklen );
+				rijn_ecb_decrypt( &ctx, result, result, 64 * blocklen );
+				memcpy( IV_SAVE, IV, blocklen );
+				rijn_cbc_encrypt( &ctx, IV_SAVE, result, result,
+								  64 * blocklen );
+				memcpy( IV_SAVE, IV, blocklen );
+				rijn_cbc_decrypt( &ctx, IV_SAVE, result, result,
+								  64 * blocklen );
+				memcpy( counter, IV, blocklen );
+				counter[blocklen - 1] = 0xfe;
+				rijn_ctr_crypt( &ctx, counter, result, result,
+								64 * blocklen - 5 );
+				memcpy( counter, IV, blocklen );
+				counter[blocklen - 1] = 0xfe;
+				rijn_ctr_crypt( &ctx, counter, result, result,
+								64 * blocklen - 5 );
+				bad |= memcmp( result, PT, 64 * blocklen ) != 0;
+				calls += 6;
+			}
+		}
+		rijn_hold_shadow( 1 );
+		rijn_ecb_encrypt( &ctx, PT, result, 256 );
+		rijn_hold_shadow( 0 );
+		rijn_shadow_stop();
+		rijn_shadow_get_stats( &stats );
+		bad |= stats.sampled + stats.dropped != calls || stats.sampled == 0 ||
+			   stats.checked != stats.sampled || stats.mismatches != 0 ||
+			   shadow_test_op != -1;
+
+		/* an altered output, through the hooks directly */
+		bad |= rijn_shadow_start( 1, shadow_test_callback, NULL );
+		rijn_set_key( &ctx, key, 128, 128 );
+		rijn_ecb_encrypt( &ctx, PT, result, 256 );
+		sample = rijn_shadow_begin_hook( RIJN_SHADOW_CBC_ENCRYPT, &ctx, IV,
+										 PT, 256 );
+		rijn_cbc_encrypt( &ctx, memcpy( IV_SAVE, IV, 16 ), PT, result, 256 );
+		result[200] ^= 1;
+		if ( sample )
+			rijn_shadow_end_hook( sample, result );
+		rijn_shadow_stop();
+		rijn_shadow_get_stats( &stats );
+		bad |= stats.mismatches != 1 ||
+			   shadow_test_op != RIJN_SHADOW_CBC_ENCRYPT;
+
+		errno = 0;
+		bad |= !rijn_shadow_start( 0, NULL, NULL ) || errno != EINVAL;
+		if ( bad )
+		{
+			printf( "\nShadow: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* concurrent appends to the encrypted log must all read back, from
+	   the chunk each was told, in fewer commits than records; a torn tail
+	   is cut off on reopening, a damaged header fails opening without
+	   cutting anything off, and a changed byte fails the tag */
+	{
+		char path[] = "/tmp/rijn_logXXXXXX";
+		pthread_t writer[LOGWRITERS];
+		int fd = mkstemp( path ), w, counts[LOGWRITERS] = { 0 }, bad = 0;
+		rijn_log_reader *reader;
+		const uint8_t *record;
+		uint64_t chunks, commits = 0;
+		size_t len;
+		off_t size;
+		int end = 0;
+
+		rijn_set_key( &ctx, key, 256, 128 );
+		log_test_log = fd < 0 ? NULL : rijn_log_open( &ctx, path, 0 );
+		for ( w = 0; log_test_log && w < LOGWRITERS; w++ )
+			pthread_create( &writer[w], NULL, log_test_writer,
+							( void * )( intptr_t )w );
+		for ( w = 0; log_test_log && w < LOGWRITERS; w++ )
+		{
+			void *failed;
+
+			pthread_join( writer[w], &failed );
+			bad |= failed != NULL;
+		}
+		if ( log_test_log )
+		{
+			commits = rijn_log_commits( log_test_log );
+			bad |= rijn_log_close( log_test_log );
+		}
+
+		reader = bad ? NULL : rijn_log_reader_open( &ctx, path );
+		bad |= reader == NULL;
+		while ( !bad && !( end = rijn_log_next( reader, &record, &len ) ) )
+		{
+			w = record[0];
+			j = record[1] << 8 | record[2];
+			if ( w >= LOGWRITERS || j != counts[w] ||
+				 len != ( size_t )( 3 + j % 150 ) ||
+				 ( len > 3 && record[len - 1] != ( uint8_t )( w + j ) ) )
+				bad = 1;
+			counts[w]++;
+		}
+		bad |= end && errno != 0;
+		for ( w = 0; w < LOGWRITERS; w++ )
+			bad |= counts[w] != LOGRECORDS;
+		bad |= commits > LOGWRITERS * LOGRECORDS;
+
+		/* the chunk a record was given holds that record */
+		if ( !bad && ( rijn_log_seek( reader, log_test_chunk[2][77] ) ||
+					   rijn_log_next( reader, &record, &len ) ) )
+			bad = 1;
+		while ( !bad && ( record[0] != 2 || record[2] != 77 ) )
+			if ( rijn_log_next( reader, &record, &len ) ||
+				 reader->cur != log_test_chunk[2][77] + 1 )
+				bad = 1;
+		chunks = reader ? rijn_log_chunks( reader ) : 0;
+		rijn_log_reader_close( reader );
+
+		/* a torn chunk is cut off, and indexing continues after it */
+		if ( !bad && ( pwrite( fd, "RJL1", 4, lseek( fd, 0, SEEK_END ) ) != 4 ||
+			 ( log_test_log = rijn_log_open( &ctx, path, 0 ) ) == NULL ||
+			 rijn_log_append( log_test_log, PT, 1000, &commits ) ||
+			 commits != chunks || rijn_log_close( log_test_log ) ) )
+			bad = 1;
+
+		/* the first chunk's magic damaged */
+		size = bad ? 0 : lseek( fd, 0, SEEK_END );
+		if ( !bad && ( pwrite( fd, "X", 1, 0 ) != 1 ||
+			 rijn_log_open( &ctx, path, 0 ) != NULL || errno != EBADMSG ||
+			 rijn_log_reader_open( &ctx, path ) != NULL || errno != EBADMSG ||
+			 lseek( fd, 0, SEEK_END ) != size ||
+			 pwrite( fd, "R", 1, 0 ) != 1 ) )
+			bad = 1;
+
+		/* change one byte of the last record */
+		reader = NULL;
+		if ( !bad && ( pwrite( fd, "x", 1, lseek( fd, 0, SEEK_END ) - 20 -
+							   ctx.blocklen ) != 1 ||
+			 ( reader = rijn_log_reader_open( &ctx, path ) ) == NULL ||
+			 rijn_log_chunks( reader ) != chunks + 1 ||
+			 rijn_log_seek( reader, chunks - 1 ) ||
+			 !rijn_log_seek( reader, chunks ) || errno != EBADMSG ) )
+			bad = 1;
+		rijn_log_reader_close( reader );
+		if ( fd >= 0 )
+		{
+			close( fd );
+			unlink( path );
+		}
+		if ( bad )
+		{
+			printf( "\nEncrypted log: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* two daemon clients loading one key share its handle, and get what
+	   local calls give; a range outside the buffer is refused.  Through a
+	   ring, completions come in submission order with their tags, a full
+	   ring refuses more, and a refused request keeps its place */
+	{
+		char path[64];
+		rijn_daemon *daemon;
+		rijn_client *a = NULL, *b = NULL, *c;
+		uint8_t iv[32], iv2[32], *out = ( uint8_t * )malloc( 4000 );
+		struct stat st;
+		uint32_t ha = 0, hb = 0, hc = 0, hd = 0;
+		uint64_t requests, batches, tag;
+		int bad = 0, i;
+
+		snprintf( path, sizeof( path ), "/tmp/rijn_daemon.%d", ( int )getpid() );
+		daemon = rijn_daemon_start( path, 2 );
+		if ( daemon )
+		{
+			a = rijn_client_connect( path, 4096 );
+			b = rijn_client_connect( path, 8192 );
+		}
+		rijn_set_key( &ctx, key, 192, 160 );
+		memset( iv, 0x5a, sizeof( iv ) );
+		memcpy( iv2, iv, sizeof( iv ) );
+		if ( a == NULL || b == NULL ||
+			 rijn_client_key( a, key, 192, 160, &ha ) ||
+			 rijn_client_key( b, key, 192, 160, &hb ) || ha != hb )
+			bad = 1;
+
+		if ( !bad )
+		{
+			memcpy( rijn_client_buffer( a ) + 20, PT, 4000 );
+			rijn_ecb_encrypt( &ctx, PT, out, 4000 );
+			bad |= rijn_client_crypt( a, RIJN_JOB_ECB_ENCRYPT, ha, NULL,
+									  20, 4000 ) ||
+				   memcmp( rijn_client_buffer( a ) + 20, out, 4000 );
+
+			memcpy( rijn_client_buffer( b ) + 4000, PT, 4000 );
+			rijn_cbc_encrypt( &ctx, iv, PT, out, 4000 );
+			bad |= rijn_client_crypt( b, RIJN_JOB_CBC_ENCRYPT, ha, iv2,
+									  4000, 4000 ) ||
+				   memcmp( rijn_client_buffer( b ) + 4000, out, 4000 ) ||
+				   memcmp( iv, iv2, 20 );
+
+			bad |= !rijn_client_crypt( a, RIJN_JOB_ECB_DECRYPT, ha, NULL,
+									   4080, 20 ) || errno != EINVAL;
+			bad |= !rijn_client_crypt( a, RIJN_JOB_ECB_DECRYPT, ha + 8, NULL,
+									   0, 20 ) || errno != EINVAL;
+			bad |= daemon_test_unsealed( path, RIJN_MSG_HELLO ) ||
+				   daemon_test_unsealed( path, RIJN_MSG_RING );
+
+			/* a second daemon on the same path fails and leaves the first
+			   one's socket, which only its owner may use */
+			bad |= rijn_daemon_start( path, 1 ) != NULL ||
+				   errno != EADDRINUSE || stat( path, &st ) ||
+				   ( st.st_mode & 0777 ) != 0600;
+			c = rijn_client_connect( path, 64 );
+			bad |= c == NULL;
+			rijn_client_close( c );
+
+			/* a handle whose last loader left does not reach the key that
+			   takes its slot */
+			c = rijn_client_connect( path, 64 );
+			bad |= c == NULL || rijn_client_key( c, key, 128, 128, &hc );
+			rijn_client_close( c );
+			c = rijn_client_connect( path, 64 );
+			bad |= c == NULL || rijn_client_key( c, key, 256, 128, &hd ) ||
+				   RIJN_HANDLE_INDEX( hc ) != RIJN_HANDLE_INDEX( hd ) ||
+				   hc == hd;
+			bad |= !rijn_client_crypt( a, RIJN_JOB_ECB_ENCRYPT, hc, NULL,
+									   0, 16 ) || errno != EINVAL;
+			rijn_client_close( c );
+			rijn_daemon_stats( daemon, &requests, &batches );
+			bad |= requests != 2 || batches != 2;
+		}
+
+		if ( !bad && rijn_client_ring( a, 8 ) )
+			bad = 1;
+		if ( !bad )
+		{
+			memcpy( rijn_client_buffer( a ), PT, 4000 );
+			rijn_ecb_encrypt( &ctx, PT, out, 4000 );
+			for ( i = 0; i < 8; i++ )
+				bad |= rijn_client_submit( a, RIJN_JOB_ECB_ENCRYPT, ha, NULL,
+										   i == 5 ? 4000 : i * 500, 500,
+										   100 + i );
+			bad |= !rijn_client_submit( a, RIJN_JOB_ECB_ENCRYPT, ha, NULL, 0,
+										20, 0 ) || errno != EAGAIN;
+			for ( i = 0; i < 8; i++ )
+				if ( rijn_client_reap( a, &tag, 1 ) ? i != 5 || errno != EINVAL
+													: i == 5 )
+					bad = 1;
+				else
+					bad |= tag != ( uint64_t )( 100 + i );
+			bad |= !rijn_client_reap( a, &tag, 1 ) || errno != EAGAIN;
+			memcpy( out + 2500, PT + 2500, 500 );
+			bad |= memcmp( rijn_client_buffer( a ), out, 4000 );
+
+			memcpy( iv2, iv, sizeof( iv ) );
+			memcpy( rijn_client_buffer( a ), PT, 4000 );
+			rijn_cbc_decrypt( &ctx, iv, PT, out, 4000 );
+			bad |= rijn_client_crypt( a, RIJN_JOB_CBC_DECRYPT, ha, iv2, 0,
+									  4000 ) ||
+				   memcmp( rijn_client_buffer( a ), out, 4000 ) ||
+				   memcmp( iv, iv2, 20 );
+		}
+		rijn_client_close( a );
+		rijn_client_close( b );
+		rijn_daemon_stop( daemon );
+		free( out );
+		if ( bad )
+		{
+			printf( "\nEncryption daemon: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* what goes through a sealing and an opening proxy to an echo server
+	   comes back unchanged; a forged record, a record sealed for the other
+	   direction or a stream without its end record resets the connection */
+	{
+		struct sockaddr_in addr;
+		socklen_t len = sizeof( addr );
+		rijn_proxy *sealer = NULL, *opener = NULL;
+		uint8_t *back = ( uint8_t * )malloc( 300000 );
+		uint64_t conns = 0, bytes = 0;
+		size_t got = 0, sent;
+		pthread_t echo;
+		char port[16];
+		ssize_t n = 0;
+		int fd = -1, bad = 0, echoing = 0;
+
+		rijn_set_key( &ctx, key, 128, 128 );
+		memset( &addr, 0, sizeof( addr ) );
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+		proxy_test_listen = socket( AF_INET, SOCK_STREAM, 0 );
+		if ( proxy_test_listen < 0 ||
+			 bind( proxy_test_listen, ( struct sockaddr * )&addr,
+				   sizeof( addr ) ) ||
+			 listen( proxy_test_listen, 4 ) ||
+			 getsockname( proxy_test_listen, ( struct sockaddr * )&addr,
+						  &len ) ||
+			 pthread_create( &echo, NULL, proxy_test_echo, NULL ) )
+			bad = 1;
+		else
+			echoing = 1;
+
+		snprintf( port, sizeof( port ), "%d", ntohs( addr.sin_port ) );
+		if ( !bad )
+			opener = rijn_proxy_start( &ctx, RIJN_PROXY_OPEN, "127.0.0.1", "0",
+									   "127.0.0.1", port );
+		snprintf( port, sizeof( port ), "%d",
+				  opener ? rijn_proxy_port( opener ) : 0 );
+		if ( opener )
+			sealer = rijn_proxy_start( &ctx, RIJN_PROXY_SEAL, "127.0.0.1", "0",
+									   "127.0.0.1", port );
+		if ( sealer )
+		{
+			addr.sin_port = htons( rijn_proxy_port( sealer ) );
+			fd = socket( AF_INET, SOCK_STREAM, 0 );
+		}
+		if ( fd < 0 || connect( fd, ( struct sockaddr * )&addr,
+								sizeof( addr ) ) )
+			bad = 1;
+
+		/* read back as we go, so no buffer on the way fills */
+		for ( sent = 0; !bad && sent < 300000; sent += 30000 )
+		{
+			bad |= write( fd, PT + sent, 30000 ) != 30000;
+			while ( !bad && got < sent + 30000 )
+				if ( ( n = read( fd, back + got, 300000 - got ) ) <= 0 )
+					bad = 1;
+				else
+					got += n;
+		}
+		if ( !bad )
+		{
+			shutdown( fd, SHUT_WR );
+			bad |= read( fd, back, 1 ) != 0 || memcmp( back, PT, 300000 );
+			rijn_proxy_stats( sealer, &conns, &bytes );
+			bad |= conns != 1 || bytes != 600000;
+		}
+		if ( fd >= 0 )
+			close( fd );
+
+		/* a salt, then a 256-byte record that was never sealed */
+		fd = -1;
+		if ( !bad )
+		{
+			addr.sin_port = htons( rijn_proxy_port( opener ) );
+			fd = socket( AF_INET, SOCK_STREAM, 0 );
+			memset( back, 0, 300 );
+			back[18] = 1;
+			if ( fd < 0 || connect( fd, ( struct sockaddr * )&addr,
+									sizeof( addr ) ) ||
+				 write( fd, back, 16 + 4 + 256 + 16 ) != 16 + 4 + 256 + 16 )
+				bad = 1;
+			while ( !bad && ( n = read( fd, back, 300 ) ) > 0 )
+				;
+			bad |= n == 0 || errno != ECONNRESET;
+		}
+		if ( fd >= 0 )
+			close( fd );
+		if ( !bad )
+			bad = proxy_test_raw( &ctx, &addr, 0, 1 ) != 0 ||
+				  proxy_test_raw( &ctx, &addr, 1, 1 ) != 1 ||
+				  proxy_test_raw( &ctx, &addr, 0, 0 ) != 1;
+
+		rijn_proxy_stop( sealer );
+		rijn_proxy_stop( opener );
+		if ( proxy_test_listen >= 0 )
+		{
+			shutdown( proxy_test_listen, SHUT_RDWR );
+			if ( echoing )
+				pthread_join( echo, NULL );
+			close( proxy_test_listen );
+		}
+		free( back );
+		if ( bad )
+		{
+			printf( "\nEncrypting proxy: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* a keystream reservoir gives what rijn_ctr_crypt gives, whether it is
+	   refilled between messages, by its thread, or not at all; messages
+	   split blocks, and the stats account for every byte */
+	{
+		rijn_keystream *ks;
+		uint64_t reserved, on_demand;
+		size_t n;
+		int bad = 0, background;
+
+		for ( blockbits = 128; !bad && blockbits <= 256; blockbits += 32 )
+		{
+			rijn_set_key( &ctx, key, 192, blockbits );
+			for ( background = 0; !bad && background < 3; background++ )
+			{
+				memcpy( IV_SAVE, IV, sizeof( IV ) );
+				rijn_ctr_crypt( &ctx, IV_SAVE, PT, CT, 100000 );
+				ks = rijn_keystream_create( &ctx, IV, 1000, background == 2 );
+				if ( ks == NULL )
+				{
+					bad = 1;
+					break;
+				}
+				if ( background == 1 )
+					bad |= rijn_keystream_refill( ks, 0 ) != ks->cap ||
+						   rijn_keystream_ready( ks ) != ks->cap;
+				for ( i = 0, n = 1; i < 100000; i += n, n = n * 7 % 1013 + 1 )
+				{
+					n = min( n, 100000 - i );
+					if ( background == 1 && i % 3 )
+						rijn_keystream_refill( ks, i % 5 ? 0 : 50 );
+					rijn_keystream_crypt( ks, PT + i, result + i, n );
+				}
+				rijn_keystream_stats( ks, &reserved, &on_demand );
+				bad |= memcmp( CT, result, 100000 ) != 0 ||
+					   reserved + on_demand != 100000 ||
+					   ( background == 0 && reserved != 0 ) ||
+					   ( background == 1 && reserved < on_demand );
+				rijn_keystream_destroy( ks );
+			}
+		}
+		if ( bad )
+		{
+			printf( "\nKeystream reservoir: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* re-encryption gives what decrypting and encrypting again give, for
+	   every pair of modes across two block lengths, in place and on
+	   threads, and leaves each iv or counter where those calls leave it */
+	{
+		static rijn_context from, to;
+		uint8_t fiv[32], tiv[32], fiv2[32], tiv2[32];
+		size_t n;
+		int fm, tm, threads, bad = 0;
+
+		rijn_set_key( &from, key, 128, 160 );
+		rijn_set_key( &to, key, 192, 256 );
+		for ( fm = RIJN_REENCRYPT_ECB; fm <= RIJN_REENCRYPT_CTR; fm++ )
+			for ( tm = RIJN_REENCRYPT_ECB; tm <= RIJN_REENCRYPT_CTR; tm++ )
+				for ( threads = 1; threads <= 3; threads += 2 )
+				{
+					n = 3360 * 40;	/* a multiple of both block lengths */
+					if ( fm == RIJN_REENCRYPT_CTR && tm == RIJN_REENCRYPT_CTR )
+						n -= 7;
+					memcpy( fiv2, IV, sizeof( IV ) );
+					memcpy( tiv2, IV, sizeof( IV ) );
+					rijn_reencrypt_pass( fm, 0, &from, fiv2, PT, CT, n );
+					rijn_reencrypt_pass( tm, 0, &to, tiv2, PT, result, n );
+					memcpy( fiv, IV, sizeof( IV ) );
+					memcpy( tiv, IV, sizeof( IV ) );
+					bad |= rijn_reencrypt_parallel( fm, &from, fiv, tm, &to,
+													tiv, CT, CT, n, threads ) ||
+						   memcmp( CT, result, n ) != 0 ||
+						   memcmp( fiv, fiv2, sizeof( fiv ) ) != 0 ||
+						   memcmp( tiv, tiv2, sizeof( tiv ) ) != 0;
+				}
+		bad |= !rijn_reencrypt( RIJN_REENCRYPT_CBC, &from, fiv,
+								RIJN_REENCRYPT_CTR, &to, tiv, CT, CT, 101 ) ||
+			   errno != EINVAL;
+		if ( bad )
+		{
+			printf( "\nFused re-encryption: failed!\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	/* .rsp text parsed in place: an AESAVS Monte Carlo vector of each mode
+	   (ECBMCT128.rsp and CBCMCT128.rsp, COUNT = 0) passes on every backend
+	   and fails with its answer changed */
+	{
+		static char rsp[2][400] = {
+			"# AESVS MCT test data for ECB\r\n\r\n[ENCRYPT]\r\n\r\n"
+			"COUNT = 0\r\nKEY = 139a35422f1d61de3c91787fe0507afd\r\n"
+			"PLAINTEXT = b9145a768b7dc489a096b546f43b231f\r\n"
+			"CIPHERTEXT = d7c3ffac9031238650901e157364c386\r\n",
+			"# AESVS MCT test data for CBC\n\n[ENCRYPT]\n\nCOUNT = 0\n"
+			"KEY = 9dc2c84a37850c11699818605f47958c\n"
+			"IV = 256953b2feab2a04ae0180d8335bbed6\n"
+			"PLAINTEXT = 2e586692e647f5028ec6fa47a55a2aab\n"
+			"CIPHERTEXT = 1b1ebd1fc45ec43037fd4844241a437f"
+		};
+		rsp_file f;
+		int bad = 0, m;
+
+		for ( m = 0; m < 2; m++ )
+		{
+			memset( &f, 0, sizeof( f ) );
+			f.path = "brief";
+			bad |= rsp_parse( &f, rsp[m], strlen( rsp[m] ) ) ||
+				   f.count != 1 || f.cbc != m || !f.mct;
+			for ( j = 0; !bad && j < rijn_backend_count(); j++ )
+			{
+				f.backend = rijn_backend_name( j );
+				if ( rijn_backend_available( f.backend ) )
+					bad |= !rsp_check( &f, &f.v[0] );
+			}
+			rsp[m][strlen( rsp[m] ) - 3] ^= 1;
+			f.backend = "auto";
+			bad |= rsp_check( &f, &f.v[0] );
+			free( f.v );
+		}
+		if ( bad )
+		{
+			printf( "\n.rsp vectors: failed!\n" );
+			exit( EXIT_FAILURE );
 		}
 	}
 
@@ -271,6 +2096,8 @@ main( int argc, char *argv[] )
 	int test_cbc = 0;
 	int test_brief = 1;
 	int time_brief = 0;
+	int parallel = 0;
+	int failures = 0;
 
 	/* find leading options */
 	while ( --argc > 0 && **++argv == '-' )
@@ -289,6 +2116,9 @@ main( int argc, char *argv[] )
 			case 'e':
 				test_ecb = 1;
 				break;
+			case 'p':
+				parallel = 1;
+				break;
 			case 't':
 				time_brief = 1;
 				break;
@@ -317,6 +2147,18 @@ main( int argc, char *argv[] )
 				"Option -V applies only with option -e, option -c, or both.");
 	}
 
+	if ( verbose && parallel ) {
+		usage(stderr, "Option -V cannot be used with option -p.");
+	}
+
+	if ( parallel )
+	{
+		if ( !test_ecb && !test_cbc )
+			test_ecb = test_cbc = 1;
+		failures += mct_parallel_test( test_ecb, test_cbc );
+		test_ecb = test_cbc = test_brief = 0;
+	}
+
 	if ( test_ecb )
 	{
 		ecb_test( verbose );
@@ -329,13 +2171,19 @@ main( int argc, char *argv[] )
 		test_brief = 0;
 	}
 
+	if ( argc > 0 )
+	{
+		failures += rsp_test( argv, argc );
+		test_brief = 0;
+	}
+
 	if ( test_brief )
 	{
 		brief_test( time_brief );
 		printf( "\n\"%s -h\" for help on more thorough tests.\n", progName );
 	}
 
-	return (0);
+	return ( failures ? EXIT_FAILURE : 0 );
 }
 
 #ifdef __cplusplus